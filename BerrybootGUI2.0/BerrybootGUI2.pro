@@ -11,7 +11,7 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 TARGET = BerrybootInstaller
 TEMPLATE = app
 
-LIBS += -lcurl -lssl -lcrypto -lz -lblkid
+LIBS += -lcurl -lssl -lcrypto -lz -lblkid -lkmod
 
 RPI_USERLAND_DIR=../../staging/usr
 exists($${RPI_USERLAND_DIR}/include/interface/vmcs_host/vc_cecservice.h) {
@@ -57,7 +57,27 @@ SOURCES += main.cpp\
     berrybootsettingsdialog.cpp \
     downloadthread.cpp \
     twoiconsdelegate.cpp \
-    wificountrydetector.cpp
+    wificountrydetector.cpp \
+    diskimagethread.cpp \
+    diskrestorethread.cpp \
+    duplicatethread.cpp \
+    duplicatedialog.cpp \
+    blockdevice.cpp \
+    partitiontable.cpp \
+    benchmarkthread.cpp \
+    storageprofile.cpp \
+    bootfilesnapshot.cpp \
+    cryptoprofile.cpp \
+    boottrace.cpp \
+    devicemonitor.cpp \
+    fastboot.cpp \
+    boottaskgraph.cpp \
+    deviceindex.cpp \
+    fsprobe.cpp \
+    mountmanager.cpp \
+    moduleloader.cpp \
+    firmwareloader.cpp \
+    readaheadprofile.cpp
 
 HEADERS  += mainwindow.h \
     diskdialog.h \
@@ -83,7 +103,27 @@ HEADERS  += mainwindow.h \
     berrybootsettingsdialog.h \
     downloadthread.h \
     twoiconsdelegate.h \
-    wificountrydetector.h
+    wificountrydetector.h \
+    diskimagethread.h \
+    diskrestorethread.h \
+    duplicatethread.h \
+    duplicatedialog.h \
+    blockdevice.h \
+    partitiontable.h \
+    benchmarkthread.h \
+    storageprofile.h \
+    bootfilesnapshot.h \
+    cryptoprofile.h \
+    boottrace.h \
+    devicemonitor.h \
+    fastboot.h \
+    boottaskgraph.h \
+    deviceindex.h \
+    fsprobe.h \
+    mountmanager.h \
+    moduleloader.h \
+    firmwareloader.h \
+    readaheadprofile.h
 
 FORMS    += mainwindow.ui \
     diskdialog.ui \
@@ -101,7 +141,8 @@ FORMS    += mainwindow.ui \
     confeditdialog.ui \
     bootmenudialog.ui \
     logindialog.ui \
-    berrybootsettingsdialog.ui
+    berrybootsettingsdialog.ui \
+    duplicatedialog.ui
 
 RESOURCES += \
     icons.qrc
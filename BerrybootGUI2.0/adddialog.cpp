@@ -550,7 +550,18 @@ void AddDialog::selfUpdate(const QString &updateurl, const QString &sha1)
                     QMessageBox::critical(this, tr("Error"), tr("Error extracting updated shared.tgz"), QMessageBox::Close);
                 }
             }
-            if (sha1file("/boot/shared.img") != sha1sharedimg)
+            if (sha1file("/boot/shared.img") != sha1sharedimg && QFile::exists("/mnt/shared.img"))
+            {
+                qpd.setLabelText(tr("Installing updated shared.img"));
+                QApplication::processEvents();
+
+                /* Shared.img is mounted as overlay layer at boot, so updating is a matter of replacing the file */
+                if (!_i->installSharedImage())
+                {
+                    QMessageBox::critical(this, tr("Error"), tr("Error installing updated shared.img"), QMessageBox::Close);
+                }
+            }
+            else if (sha1file("/boot/shared.img") != sha1sharedimg)
             {
                 qpd.setLabelText(tr("Extracting updated shared.img"));
                 QApplication::processEvents();
@@ -764,53 +775,17 @@ void AddDialog::setProxy()
 void AddDialog::generateListFromShare(const QByteArray &url, QByteArray username, QByteArray password)
 {
     QApplication::processEvents();
-    QByteArray shareType, share;
 
-    if (url.startsWith("cifs:"))
-    {
-        shareType = "cifs";
-        share = url.mid(5);
-        if (username.isEmpty())
-            username = "guest";
-    }
-    else if (url.startsWith("nfs:"))
-    {
-        shareType = "nfs";
-        share = url.mid(4);
-    }
-    else
-    {
+    if (!url.startsWith("cifs:") && !url.startsWith("nfs:"))
         return;
-    }
-
-    _i->loadFilesystemModule(shareType);
 
-    QDir dir("/share");
-    if (dir.exists())
-    {
-        QProcess::execute("umount /share");
-    }
-    else
-    {
-        dir.mkdir("/share");
-    }
-
-    QStringList args;
-    args << "-t" << shareType << share << "/share";
-
-    if (!username.isEmpty())
-    {
-        args << "-o" << "username="+username;
-        if (!password.isEmpty())
-            args << "-o" << "password="+password;
-    }
-    if (QProcess::execute("mount", args) != 0)
+    if (!_i->mountNetworkShare(url, username, password, "/share"))
     {
-        dir.rmdir("/share");
-        QMessageBox::critical(this, tr("Mount error"), tr("Error mounting network share %1").arg(QString(share)), QMessageBox::Ok);
+        QMessageBox::critical(this, tr("Mount error"), tr("Error mounting network share %1").arg(QString(url)), QMessageBox::Ok);
     }
     else
     {
+        QDir dir("/share");
         _ini = NULL;
         ui->groupTabs->clear();
 
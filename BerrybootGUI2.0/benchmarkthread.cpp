@@ -0,0 +1,317 @@
+/* Berryboot -- drive speed and capacity test
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "benchmarkthread.h"
+#include "blockdevice.h"
+#include <QFile>
+#include <QStringList>
+#include <QSet>
+#include <QElapsedTimer>
+#include <QtEndian>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFFER_SIZE         (1024*1024)
+#define SEQUENTIAL_SIZE     (64*1024*1024)
+#define RANDOM_REGION_SIZE  (128*1024*1024)
+#define RANDOM_BLOCK_SIZE   4096
+#define RANDOM_MAX_TIME_MS  5000
+#define RANDOM_MAX_WRITES   2000
+#define SENTINELS           64
+#define SENTINEL_SIZE       4096
+/* Stay clear of the partition table and anything in use */
+#define MIN_SCRATCH_START   (4*1024*1024)
+
+BenchmarkThread::BenchmarkThread(const QString &drive, QObject *parent) :
+    QThread(parent), _drive(drive), _seqRead(0), _seqWrite(0), _iops(0), _avgLatency(0), _maxLatency(0),
+    _reportedCapacity(0), _verifiedCapacity(0), _scratchStart(0), _buf(NULL)
+{
+}
+
+void BenchmarkThread::run()
+{
+    BlockDevice dev(_drive);
+
+    if (!dev.open(O_DIRECT))
+    {
+        emit error(tr("Error opening drive: %1").arg(dev.errorString()));
+        return;
+    }
+
+    _reportedCapacity = dev.size();
+    _scratchStart = scratchStart();
+    if (_reportedCapacity < _scratchStart + 2 * SEQUENTIAL_SIZE)
+    {
+        emit error(tr("Not enough free space on drive to run test"));
+        return;
+    }
+
+    /* O_DIRECT needs aligned buffers. Fill with random data, in case the drive compresses or skips zeroes */
+    if (posix_memalign((void **) &_buf, 4096, BUFFER_SIZE) != 0)
+    {
+        emit error(tr("Out of memory"));
+        return;
+    }
+    QFile f("/dev/urandom");
+    f.open(f.ReadOnly);
+    f.read(_buf, BUFFER_SIZE);
+    f.close();
+
+    bool ok = testCapacity(dev) && testSequential(dev) && testRandomWrite();
+
+    free(_buf);
+    _buf = NULL;
+
+    if (ok)
+        emit completed();
+}
+
+quint64 BenchmarkThread::scratchStart()
+{
+    /* Do not touch partitions that are mounted, e.g. the boot partition of the SD card we started from */
+    quint64 start = MIN_SCRATCH_START;
+    QFile f("/proc/mounts");
+    f.open(f.ReadOnly);
+    QList<QByteArray> lines = f.readAll().split('\n');
+    f.close();
+
+    foreach (QByteArray line, lines)
+    {
+        if (!line.startsWith("/dev/"+_drive.toLatin1()))
+            continue;
+
+        QString part = line.split(' ').first().mid(5);
+        QFile partStart("/sys/class/block/"+part+"/start"), partSize("/sys/class/block/"+part+"/size");
+        partStart.open(partStart.ReadOnly);
+        partSize.open(partSize.ReadOnly);
+        quint64 end = (partStart.readAll().trimmed().toULongLong() + partSize.readAll().trimmed().toULongLong()) * 512;
+        partStart.close();
+        partSize.close();
+
+        start = qMax(start, (end + MIN_SCRATCH_START - 1) / MIN_SCRATCH_START * MIN_SCRATCH_START);
+    }
+
+    return start;
+}
+
+/*
+ * Fake cards report more capacity than they have, and wrap writes beyond their real size.
+ * Write sentinels tagged with their own offset spread over the whole drive, and read them back after all are written.
+ */
+bool BenchmarkThread::testCapacity(BlockDevice &dev)
+{
+    emit statusUpdate(tr("Checking capacity of drive"));
+
+    char *sentinel = _buf + BUFFER_SIZE - SENTINEL_SIZE;
+    char *readback;
+    quint64 span = _reportedCapacity - SENTINEL_SIZE - _scratchStart;
+    QList<quint64> positions;
+
+    if (posix_memalign((void **) &readback, 4096, SENTINEL_SIZE) != 0)
+    {
+        emit error(tr("Out of memory"));
+        return false;
+    }
+
+    for (int i=0; i<SENTINELS; i++)
+        positions.append( (_scratchStart + span * i / (SENTINELS-1)) / SENTINEL_SIZE * SENTINEL_SIZE );
+
+    foreach (quint64 pos, positions)
+    {
+        qToLittleEndian<quint64>(pos, (uchar *) sentinel);
+        if (!dev.writeAt(pos, sentinel, SENTINEL_SIZE))
+        {
+            /* Writes beyond the real capacity failing outright also means fake capacity */
+            break;
+        }
+    }
+    dev.flush();
+
+    /* A sentinel found at another sentinel's position means the write to the latter wrapped around.
+       Neither counts: the one overwritten is lost, and the one that wrapped only seems to survive */
+    QList<bool> intact;
+    QSet<quint64> wrapped;
+    foreach (quint64 pos, positions)
+    {
+        qToLittleEndian<quint64>(pos, (uchar *) sentinel);
+        bool ok = dev.readAt(pos, readback, SENTINEL_SIZE);
+        intact.append(ok && memcmp(readback, sentinel, SENTINEL_SIZE) == 0);
+
+        if (ok && !intact.last() && memcmp(readback+sizeof(quint64), sentinel+sizeof(quint64), SENTINEL_SIZE-sizeof(quint64)) == 0)
+            wrapped.insert(qFromLittleEndian<quint64>((uchar *) readback));
+    }
+
+    /* Capacity is up to the highest sentinel that truly survived */
+    _verifiedCapacity = _scratchStart;
+    for (int i=0; i<positions.count(); i++)
+    {
+        if (intact.at(i) && !wrapped.contains(positions.at(i)))
+            _verifiedCapacity = positions.at(i) + SENTINEL_SIZE;
+    }
+    if (!intact.contains(false))
+        _verifiedCapacity = _reportedCapacity;
+
+    free(readback);
+    return true;
+}
+
+bool BenchmarkThread::testSequential(BlockDevice &dev)
+{
+    quint64 len = SEQUENTIAL_SIZE;
+    QElapsedTimer t;
+
+    emit statusUpdate(tr("Measuring sequential write speed"));
+    t.start();
+    for (quint64 offset = 0; offset < len; offset += BUFFER_SIZE)
+    {
+        if (!dev.writeAt(_scratchStart+offset, _buf, BUFFER_SIZE))
+        {
+            emit error(dev.errorString());
+            return false;
+        }
+    }
+    if (!dev.flush())
+    {
+        emit error(dev.errorString());
+        return false;
+    }
+    _seqWrite = (len / 1048576.0) / (qMax(t.elapsed(), (qint64) 1) / 1000.0);
+
+    emit statusUpdate(tr("Measuring sequential read speed"));
+    t.start();
+    for (quint64 offset = 0; offset < len; offset += BUFFER_SIZE)
+    {
+        if (!dev.readAt(_scratchStart+offset, _buf, BUFFER_SIZE))
+        {
+            emit error(dev.errorString());
+            return false;
+        }
+    }
+    _seqRead = (len / 1048576.0) / (qMax(t.elapsed(), (qint64) 1) / 1000.0);
+
+    return true;
+}
+
+bool BenchmarkThread::testRandomWrite()
+{
+    /* Every write has to reach the card before the next one is issued, as is the case with file system metadata */
+    BlockDevice dev(_drive);
+    if (!dev.open(O_DIRECT | O_DSYNC))
+    {
+        emit error(dev.errorString());
+        return false;
+    }
+
+    emit statusUpdate(tr("Measuring random write speed"));
+
+    int blocks = qMin((quint64) RANDOM_REGION_SIZE, _reportedCapacity - _scratchStart) / RANDOM_BLOCK_SIZE;
+    int writes = 0;
+    double totalLatency = 0;
+    QElapsedTimer total, t;
+    total.start();
+
+    while (writes < RANDOM_MAX_WRITES && total.elapsed() < RANDOM_MAX_TIME_MS)
+    {
+        quint64 offset = _scratchStart + (quint64) (qrand() % blocks) * RANDOM_BLOCK_SIZE;
+        char *data = _buf + (writes % (BUFFER_SIZE / RANDOM_BLOCK_SIZE)) * RANDOM_BLOCK_SIZE;
+
+        t.start();
+        if (!dev.writeAt(offset, data, RANDOM_BLOCK_SIZE))
+        {
+            emit error(dev.errorString());
+            return false;
+        }
+        double latency = t.nsecsElapsed() / 1000000.0;
+
+        totalLatency += latency;
+        _maxLatency = qMax(_maxLatency, latency);
+        writes++;
+    }
+
+    _iops = writes / (qMax(total.elapsed(), (qint64) 1) / 1000.0);
+    _avgLatency = totalLatency / writes;
+
+    return true;
+}
+
+QString BenchmarkThread::recommendedFilesystem() const
+{
+    /* Poor random write performance. Initialize inode tables during format, instead of in the background when the OS is in use */
+    if (_iops < 50)
+        return "ext4 nolazy";
+
+    /* Fast enough to absorb the extra metadata writes of copy-on-write */
+    if (_iops >= 500 && _seqWrite >= 20)
+        return "btrfs";
+
+    return "ext4";
+}
+
+QString BenchmarkThread::drive() const
+{
+    return _drive;
+}
+
+double BenchmarkThread::sequentialRead() const
+{
+    return _seqRead;
+}
+
+double BenchmarkThread::sequentialWrite() const
+{
+    return _seqWrite;
+}
+
+double BenchmarkThread::randomWriteIops() const
+{
+    return _iops;
+}
+
+double BenchmarkThread::averageLatency() const
+{
+    return _avgLatency;
+}
+
+double BenchmarkThread::maxLatency() const
+{
+    return _maxLatency;
+}
+
+bool BenchmarkThread::fakeCapacity() const
+{
+    return _verifiedCapacity < _reportedCapacity;
+}
+
+quint64 BenchmarkThread::reportedCapacity() const
+{
+    return _reportedCapacity;
+}
+
+quint64 BenchmarkThread::verifiedCapacity() const
+{
+    return _verifiedCapacity;
+}
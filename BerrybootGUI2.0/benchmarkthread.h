@@ -0,0 +1,96 @@
+#ifndef BENCHMARKTHREAD_H
+#define BENCHMARKTHREAD_H
+
+/* Berryboot -- drive speed and capacity test
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QThread>
+
+class BlockDevice;
+
+class BenchmarkThread : public QThread
+{
+    Q_OBJECT
+public:
+    /*
+     * Constructor
+     *
+     * - drive: e.g. mmcblk0
+     *
+     * Overwrites everything on the drive after the last mounted partition
+     */
+    explicit BenchmarkThread(const QString &drive, QObject *parent = 0);
+
+    QString drive() const;
+
+    /*
+     * Sequential transfer speed in MB/sec
+     */
+    double sequentialRead() const;
+    double sequentialWrite() const;
+
+    /*
+     * Synchronous 4 KB random writes per second, and their latency in ms
+     */
+    double randomWriteIops() const;
+    double averageLatency() const;
+    double maxLatency() const;
+
+    /*
+     * True if data written near the end of the drive did not read back correctly
+     */
+    bool fakeCapacity() const;
+
+    /*
+     * Size reported by the drive, and the size that could be verified in bytes
+     */
+    quint64 reportedCapacity() const;
+    quint64 verifiedCapacity() const;
+
+    /*
+     * File system best suited to the measured performance: ext4, ext4 nolazy or btrfs
+     */
+    QString recommendedFilesystem() const;
+
+signals:
+    void statusUpdate(const QString &msg);
+    void error(const QString &msg);
+    void completed();
+
+protected:
+    QString _drive;
+    double _seqRead, _seqWrite, _iops, _avgLatency, _maxLatency;
+    quint64 _reportedCapacity, _verifiedCapacity, _scratchStart;
+    char *_buf;
+
+    virtual void run();
+    quint64 scratchStart();
+    bool testCapacity(BlockDevice &dev);
+    bool testSequential(BlockDevice &dev);
+    bool testRandomWrite();
+};
+
+#endif // BENCHMARKTHREAD_H
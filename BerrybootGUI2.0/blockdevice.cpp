@@ -0,0 +1,267 @@
+/* Berryboot -- raw block device access
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "blockdevice.h"
+#include <QFile>
+#include <QList>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+/* Largest allocation unit size defined by the SD specification */
+#define MAX_ALIGNMENT  (64*1024*1024)
+
+static quint64 readSysfsNumber(const QString &filename)
+{
+    QFile f(filename);
+    if (!f.open(f.ReadOnly))
+        return 0;
+
+    return f.readAll().trimmed().toULongLong();
+}
+
+static quint64 gcd(quint64 a, quint64 b)
+{
+    while (b)
+    {
+        quint64 t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+BlockDevice::BlockDevice(const QString &dev)
+    : _dev(dev), _fd(-1)
+{
+}
+
+BlockDevice::~BlockDevice()
+{
+    close();
+}
+
+bool BlockDevice::open(int flags)
+{
+    if (_fd != -1)
+        return true;
+
+    _fd = ::open(QFile::encodeName("/dev/"+_dev).constData(), O_RDWR | O_CLOEXEC | flags);
+    if (_fd == -1)
+        return setError("opening");
+
+    return true;
+}
+
+void BlockDevice::close()
+{
+    if (_fd != -1)
+    {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+quint64 BlockDevice::size()
+{
+    quint64 bytes = 0;
+
+    if (ioctl(_fd, BLKGETSIZE64, &bytes) != 0)
+    {
+        setError("getting size of");
+        return 0;
+    }
+
+    return bytes;
+}
+
+int BlockDevice::sectorSize()
+{
+    int sectorSize = 512;
+
+    if (ioctl(_fd, BLKSSZGET, &sectorSize) != 0)
+        return 512;
+
+    return sectorSize;
+}
+
+quint64 BlockDevice::optimalAlignment()
+{
+    quint64 alignment = 1024*1024;
+    QList<quint64> sizes;
+    sizes << readSysfsNumber("/sys/class/block/"+_dev+"/queue/discard_granularity")
+          << readSysfsNumber("/sys/class/block/"+_dev+"/queue/optimal_io_size")
+          << readSysfsNumber("/sys/class/block/"+_dev+"/device/preferred_erase_size");
+
+    foreach (quint64 size, sizes)
+    {
+        if (!size || size % 512)
+            continue;
+
+        /* Least common multiple, so we are aligned to all of them */
+        quint64 lcm = alignment / gcd(alignment, size) * size;
+        if (lcm <= MAX_ALIGNMENT)
+            alignment = lcm;
+    }
+
+    return alignment;
+}
+
+bool BlockDevice::supportsDiscard()
+{
+    /* Partitions do not have a queue directory of their own, use the one of the drive */
+    QFile f("/sys/class/block/"+_dev+"/queue/discard_max_bytes");
+    if (!f.exists())
+        f.setFileName("/sys/class/block/"+_dev+"/../queue/discard_max_bytes");
+    f.open(f.ReadOnly);
+    quint64 maxBytes = f.readAll().trimmed().toULongLong();
+    f.close();
+
+    return maxBytes > 0;
+}
+
+bool BlockDevice::discard(quint64 offset, quint64 len)
+{
+    uint64_t range[2] = {offset, len};
+
+    if (ioctl(_fd, BLKDISCARD, &range) != 0)
+        return setError("discarding");
+
+    return true;
+}
+
+bool BlockDevice::zeroOut(quint64 offset, quint64 len)
+{
+    /* Kernel writes zero pages itself if the device has no native support */
+    uint64_t range[2] = {offset, len};
+
+    if (ioctl(_fd, BLKZEROOUT, &range) != 0)
+        return setError("zeroing");
+
+    return true;
+}
+
+QByteArray BlockDevice::readAt(quint64 offset, int len)
+{
+    QByteArray buf(len, 0);
+
+    if (!readAt(offset, buf.data(), len))
+        return QByteArray();
+
+    return buf;
+}
+
+bool BlockDevice::readAt(quint64 offset, char *buf, qint64 len)
+{
+    while (len)
+    {
+        ssize_t bytesRead = pread(_fd, buf, len, offset);
+        if (bytesRead == -1 && errno == EINTR)
+            continue;
+        if (bytesRead <= 0)
+            return setError("reading from");
+
+        buf    += bytesRead;
+        offset += bytesRead;
+        len    -= bytesRead;
+    }
+
+    return true;
+}
+
+bool BlockDevice::writeAt(quint64 offset, const QByteArray &data)
+{
+    return writeAt(offset, data.constData(), data.size());
+}
+
+bool BlockDevice::writeAt(quint64 offset, const char *buf, qint64 len)
+{
+    while (len)
+    {
+        ssize_t written = pwrite(_fd, buf, len, offset);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return setError("writing to");
+
+        buf    += written;
+        offset += written;
+        len    -= written;
+    }
+
+    return true;
+}
+
+bool BlockDevice::writeFileAt(quint64 offset, const QString &filename)
+{
+    QFile f(filename);
+    if (!f.open(f.ReadOnly))
+    {
+        _error = QString("Error opening %1").arg(filename);
+        return false;
+    }
+
+    return writeAt(offset, f.readAll());
+}
+
+bool BlockDevice::flush()
+{
+    if (fsync(_fd) != 0)
+        return setError("flushing");
+
+    return true;
+}
+
+bool BlockDevice::rereadPartitionTable()
+{
+    /* Device may be briefly busy if something else is still probing the old partitions */
+    for (int i=0; i<10; i++)
+    {
+        if (ioctl(_fd, BLKRRPART) == 0)
+            return true;
+        if (errno != EBUSY)
+            break;
+
+        usleep(100000);
+    }
+
+    return setError("rereading partition table of");
+}
+
+QString BlockDevice::errorString() const
+{
+    return _error;
+}
+
+bool BlockDevice::setError(const QString &action)
+{
+    _error = QString("Error %1 /dev/%2: %3").arg(action, _dev, QString::fromLocal8Bit(strerror(errno)));
+    return false;
+}
@@ -0,0 +1,112 @@
+#ifndef BLOCKDEVICE_H
+#define BLOCKDEVICE_H
+
+/* Berryboot -- raw block device access
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QString>
+#include <QByteArray>
+
+class BlockDevice
+{
+public:
+    /*
+     * Constructor
+     *
+     * - dev: device name, e.g. mmcblk0
+     */
+    explicit BlockDevice(const QString &dev);
+    ~BlockDevice();
+
+    /*
+     * Open device read-write
+     *
+     * - flags: additional open() flags, e.g. O_DIRECT
+     */
+    bool open(int flags = 0);
+    void close();
+
+    /*
+     * Size of the device in bytes
+     */
+    quint64 size();
+
+    /*
+     * Logical sector size in bytes
+     */
+    int sectorSize();
+
+    /*
+     * Boundary in bytes partitions should be aligned to.
+     * At least 1 MB, or the erase block size of the card if that is larger
+     */
+    quint64 optimalAlignment();
+
+    /*
+     * True if the device (or the drive the partition is on) accepts discard requests
+     */
+    bool supportsDiscard();
+
+    /*
+     * Tell the device the range is no longer in use (BLKDISCARD)
+     * Contents of the range are undefined afterwards
+     */
+    bool discard(quint64 offset, quint64 len);
+
+    /*
+     * Zero out range (BLKZEROOUT)
+     */
+    bool zeroOut(quint64 offset, quint64 len);
+
+    QByteArray readAt(quint64 offset, int len);
+    bool readAt(quint64 offset, char *buf, qint64 len);
+    bool writeAt(quint64 offset, const QByteArray &data);
+    bool writeAt(quint64 offset, const char *buf, qint64 len);
+    bool writeFileAt(quint64 offset, const QString &filename);
+
+    /*
+     * Wait until all writes hit the device
+     */
+    bool flush();
+
+    /*
+     * Ask the kernel to pick up a new partition table (BLKRRPART)
+     */
+    bool rereadPartitionTable();
+
+    /*
+     * Description of the last error
+     */
+    QString errorString() const;
+
+protected:
+    QString _dev, _error;
+    int _fd;
+
+    bool setError(const QString &action);
+};
+
+#endif // BLOCKDEVICE_H
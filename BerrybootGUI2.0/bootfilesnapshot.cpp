@@ -0,0 +1,292 @@
+/* Berryboot -- compressed in-memory copy of the boot partition
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bootfilesnapshot.h"
+#include <QFile>
+#include <QDir>
+#include <QDirIterator>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <unistd.h>
+#include <fcntl.h>
+
+/* Boot files are mostly kernels and firmware that are compressed already, favour speed */
+#define COMPRESSION_LEVEL  1
+
+/* Files larger than this (kernels, initramfs) are not kept in the heap, but spooled to tmpfs */
+#define MAX_HEAP_FILE_SIZE  (1024 * 1024)
+#define SPOOL_DIR           "/tmp/bootfiles"
+#define CHUNK_SIZE          (256 * 1024)
+
+/* Copies src to dst in chunks, returning the SHA1 of the data, or an empty array on error */
+static QByteArray copyFile(QFile &src, QFile &dst)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    while (!src.atEnd())
+    {
+        QByteArray chunk = src.read(CHUNK_SIZE);
+        if (chunk.isEmpty() || dst.write(chunk) != chunk.size())
+            return QByteArray();
+        hash.addData(chunk);
+    }
+
+    return hash.result();
+}
+
+static QByteArray sha1OfFile(QFile &f)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    while (!f.atEnd())
+    {
+        QByteArray chunk = f.read(CHUNK_SIZE);
+        if (chunk.isEmpty())
+            return QByteArray();
+        hash.addData(chunk);
+    }
+
+    return hash.result();
+}
+
+BootFileSnapshot::BootFileSnapshot()
+{
+}
+
+bool BootFileSnapshot::save(const QString &dir)
+{
+    QDir base(dir);
+    QDirIterator it(dir, QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    qint64 spooledSize = 0;
+
+    clear();
+
+    while (it.hasNext())
+    {
+        QString path = it.next();
+        QFileInfo fi = it.fileInfo();
+        QString name = base.relativeFilePath(path);
+
+        if (fi.isDir())
+        {
+            _dirs.append(name);
+            continue;
+        }
+
+        QFile f(path);
+        if (!f.open(f.ReadOnly))
+        {
+            _error = QString("Error reading %1: %2").arg(path, f.errorString());
+            clear();
+            return false;
+        }
+
+        Entry e;
+        e.name = name;
+
+        if (fi.size() > MAX_HEAP_FILE_SIZE)
+        {
+            e.spoolFile = QString(SPOOL_DIR"/%1").arg(_files.count());
+            QDir().mkpath(SPOOL_DIR);
+            QFile spool(e.spoolFile);
+            if (!spool.open(spool.WriteOnly) || (e.sha1 = copyFile(f, spool)).isEmpty() || spool.size() != fi.size())
+            {
+                _error = QString("Error saving %1 to %2").arg(path, e.spoolFile);
+                spool.remove();
+                clear();
+                return false;
+            }
+            spool.close();
+            spooledSize += fi.size();
+        }
+        else
+        {
+            QByteArray data = f.readAll();
+            if (data.size() != fi.size())
+            {
+                _error = QString("Error reading %1").arg(path);
+                clear();
+                return false;
+            }
+
+            e.sha1 = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+            e.data = qCompress(data, COMPRESSION_LEVEL);
+        }
+        _files.append(e);
+    }
+
+    qDebug() << "Saved" << _files.count() << "boot files in" << compressedSize() / 1024 << "KB of memory and"
+             << spooledSize / 1024 << "KB in" << SPOOL_DIR;
+
+    return true;
+}
+
+bool BootFileSnapshot::restore(const QString &dir, QString *errorMsg) const
+{
+    QDir base(dir);
+
+    foreach (QString d, _dirs)
+        base.mkpath(d);
+
+    foreach (const Entry &e, _files)
+    {
+        QString path = base.filePath(e.name);
+        QFile f(path);
+        bool ok;
+
+        if (!f.open(f.WriteOnly))
+        {
+            if (errorMsg)
+                *errorMsg = QString("Error writing %1: %2").arg(path, f.errorString());
+            return false;
+        }
+
+        if (e.spoolFile.isEmpty())
+        {
+            QByteArray data = qUncompress(e.data);
+
+            if (QCryptographicHash::hash(data, QCryptographicHash::Sha1) != e.sha1)
+            {
+                if (errorMsg)
+                    *errorMsg = QString("Memory copy of %1 is corrupt").arg(e.name);
+                return false;
+            }
+            ok = f.write(data) == data.size();
+        }
+        else
+        {
+            QFile spool(e.spoolFile);
+            ok = spool.open(spool.ReadOnly) && !copyFile(spool, f).isEmpty();
+        }
+
+        /* Make sure the data is on the card, and drop it from the page cache, so that the read back comes from the card */
+        if (!ok || !f.flush() || fsync(f.handle()) != 0)
+        {
+            if (errorMsg)
+                *errorMsg = QString("Error writing %1: %2").arg(path, f.errorString());
+            return false;
+        }
+        posix_fadvise(f.handle(), 0, 0, POSIX_FADV_DONTNEED);
+        f.close();
+
+        /* Read back */
+        if (!f.open(f.ReadOnly) || sha1OfFile(f) != e.sha1)
+        {
+            if (errorMsg)
+                *errorMsg = QString("Verification of %1 failed").arg(path);
+            return false;
+        }
+        f.close();
+    }
+
+    return true;
+}
+
+void BootFileSnapshot::clear()
+{
+    foreach (const Entry &e, _files)
+    {
+        if (!e.spoolFile.isEmpty())
+            QFile::remove(e.spoolFile);
+    }
+    QDir().rmdir(SPOOL_DIR);
+
+    _files.clear();
+    _dirs.clear();
+}
+
+bool BootFileSnapshot::isEmpty() const
+{
+    return _files.isEmpty();
+}
+
+int BootFileSnapshot::indexOf(const QString &filename) const
+{
+    for (int i=0; i<_files.count(); i++)
+    {
+        if (_files.at(i).name == filename)
+            return i;
+    }
+
+    return -1;
+}
+
+bool BootFileSnapshot::contains(const QString &filename) const
+{
+    return indexOf(filename) != -1;
+}
+
+QByteArray BootFileSnapshot::file(const QString &filename) const
+{
+    int i = indexOf(filename);
+
+    if (i == -1)
+        return QByteArray();
+
+    if (!_files.at(i).spoolFile.isEmpty())
+    {
+        QFile f(_files.at(i).spoolFile);
+        f.open(f.ReadOnly);
+        return f.readAll();
+    }
+
+    return qUncompress(_files.at(i).data);
+}
+
+void BootFileSnapshot::setFile(const QString &filename, const QByteArray &data)
+{
+    Entry e;
+    e.name = filename;
+    e.sha1 = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    e.data = qCompress(data, COMPRESSION_LEVEL);
+
+    int i = indexOf(filename);
+    if (i == -1)
+    {
+        _files.append(e);
+    }
+    else
+    {
+        if (!_files[i].spoolFile.isEmpty())
+            QFile::remove(_files[i].spoolFile);
+        _files[i] = e;
+    }
+}
+
+qint64 BootFileSnapshot::compressedSize() const
+{
+    qint64 size = 0;
+
+    foreach (const Entry &e, _files)
+        size += e.data.size();
+
+    return size;
+}
+
+QString BootFileSnapshot::errorString() const
+{
+    return _error;
+}
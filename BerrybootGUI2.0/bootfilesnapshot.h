@@ -0,0 +1,92 @@
+#ifndef BOOTFILESNAPSHOT_H
+#define BOOTFILESNAPSHOT_H
+
+/* Berryboot -- compressed in-memory copy of the boot partition
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QList>
+
+class BootFileSnapshot
+{
+public:
+    BootFileSnapshot();
+
+    /*
+     * Read all files under dir into memory, compressed, and remember their SHA1
+     * Large files such as kernels are copied to tmpfs instead, in chunks
+     */
+    bool save(const QString &dir = "/boot");
+
+    /*
+     * Write the files back to dir, sync them, and read them back from the card to verify the checksums
+     * Can be called from several threads at once, so reports errors through errorMsg
+     */
+    bool restore(const QString &dir = "/boot", QString *errorMsg = 0) const;
+
+    /*
+     * Free memory and remove the files in tmpfs
+     */
+    void clear();
+
+    bool isEmpty() const;
+    bool contains(const QString &filename) const;
+
+    /*
+     * Uncompressed contents of a single file, e.g. cmdline.txt
+     */
+    QByteArray file(const QString &filename) const;
+    void setFile(const QString &filename, const QByteArray &data);
+
+    /*
+     * Heap memory used by the compressed files in bytes
+     */
+    qint64 compressedSize() const;
+
+    /*
+     * Description of the last save() error
+     */
+    QString errorString() const;
+
+protected:
+    struct Entry
+    {
+        QString name;
+        QByteArray data, sha1;
+        /* Copy in tmpfs, if the file is too large to keep in the heap */
+        QString spoolFile;
+    };
+
+    QList<Entry> _files;
+    QStringList _dirs;
+    QString _error;
+
+    int indexOf(const QString &filename) const;
+};
+
+#endif // BOOTFILESNAPSHOT_H
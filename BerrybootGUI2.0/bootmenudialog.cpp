@@ -31,6 +31,13 @@
 #include "diskdialog.h"
 #include "adddialog.h"
 #include "mainwindow.h"
+#include "boottrace.h"
+#include "devicemonitor.h"
+#include "boottaskgraph.h"
+#include "mountmanager.h"
+#include "moduleloader.h"
+#include "readaheadprofile.h"
+#include "copythread.h"
 
 #include <iostream>
 #include <unistd.h>
@@ -39,6 +46,8 @@
 
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
+#include <QEventLoop>
 #include <QProgressDialog>
 #include <QProcess>
 #include <QMessageBox>
@@ -47,16 +56,26 @@
 #include <QDebug>
 #include <QCloseEvent>
 #include <QScreen>
+#include <QtConcurrentRun>
 
 #define runonce_file  "/mnt/data/runonce"
 #define default_file  "/mnt/data/default"
+/* Name of the image premounted at /squashfs, read by init */
+#define premounted_file  "/tmp/premounted"
+/* tmpfs images are copied to when copy to RAM is enabled, read by init */
+#define ramimage_dir  "/ramimage"
+/* Memory that must remain available to the OS after copying its image to RAM */
+#define RAM_COPY_RESERVE_MB  192
 
 
 BootMenuDialog::BootMenuDialog(Installer *i, QWidget *parent) :
     QDialog(parent),
     ui(new Ui::BootMenuDialog),
     _i(i),
-    _countdown(11)
+    _countdown(11),
+    _remountOk(true),
+    _tasks(NULL),
+    _taskProgress(NULL)
 {
     ui->setupUi(this);
 
@@ -73,6 +92,7 @@ BootMenuDialog::BootMenuDialog(Installer *i, QWidget *parent) :
 #endif
 
     setEnabled(false);
+    connect(&_remount, SIGNAL(finished()), this, SLOT(onRemountFinished()));
     QTimer::singleShot(1, this, SLOT(initialize()));
 }
 
@@ -88,122 +108,93 @@ void BootMenuDialog::closeEvent(QCloseEvent *ev)
 }
 
 /* Mount data partition and populate menu
- * TODO: move stuff to seperate thread instead of messing with processEvents()
+ * Work is split up in tasks that run in parallel as far as their dependencies allow
  */
 void BootMenuDialog::initialize()
 {
-    bool success   = false;
     QByteArray datadev = _i->bootParam("datadev");
     QByteArray qmap    = _i->bootParam("qmap");
+    bool ssh  = !_i->bootParam("ssh_authorized_key").isEmpty();
+    bool luks = _i->bootoptions().contains("luks");
+    bool staticWifi = _i->bootParam("ipv4").endsWith("/wlan0");
 
     if (!qmap.isEmpty())
         _i->setKeyboardLayout(qmap);
 
-    startSSHserverIfEnabled();
-
-    if (!datadev.isEmpty())
-    {
-        if (datadev == "iscsi")
-        {
-            startISCSI();
-        }
-        else
-        {
-            _i->startNetworkInterface();
-        }
-    }
-    else
+    if (datadev.isEmpty())
     {
+        /* Keep the system partition mounted during these steps, instead of mounting it for each one */
+        mountSystemPartition();
+        startSSHserverIfEnabled();
         initializeA10();
         startInstaller();
+        umountSystemPartition();
         return;
     }
+    _datadev = datadev;
 
-    QProgressDialog qpd(tr("Waiting for data partition %1").arg(QString(datadev)), QString(), 0, 0, this);
-    qpd.show();
-    QApplication::processEvents();
-
-    /* Wait 10 seconds for named data partition */
-    waitForDevice(datadev);
+    _tasks = new BootTaskGraph(this, this);
+    connect(_tasks, SIGNAL(taskStatusChanged(QByteArray)), this, SLOT(onTaskStatusChanged()));
+    connect(_tasks, SIGNAL(finished()), this, SLOT(onTasksFinished()));
 
-    qpd.setLabelText(tr("Mounting data partition %1").arg(QString(datadev)));
-    QApplication::processEvents();
-
-    if (_i->bootoptions().contains("luks"))
-    {
-        askLuksPassword(datadev);
-        success = mountDataPartition("mapper/luks");
-    }
+    if (datadev == "iscsi")
+        _tasks->addTask("iscsi", tr("Connecting to iSCSI SAN"), "iscsiTask", "", true);
     else
+        _tasks->addTask("network", tr("Enabling network interface"), "networkTask", "", true);
+    if (ssh || luks || staticWifi)
+        _tasks->addTask("bootpart", tr("Mounting system partition"), "mountBootPartitionTask", "?iscsi");
+    if (ssh)
+        _tasks->addTask("ssh", tr("Starting SSH server (can take a while on first run)"), "sshTask", "bootpart");
+    _tasks->addTask("datadev", tr("Waiting for data partition %1").arg(QString(datadev)), "waitForDataDeviceTask", "?iscsi");
+    if (luks)
     {
-        success = mountDataPartition(datadev);
+        _tasks->addTask("cryptomodules", tr("Loading encryption modules"), "loadCryptoModulesTask", "?bootpart");
+        /* Start SSH first, so the password can be entered remotely */
+        _tasks->addTask("luks", tr("Unlocking encrypted data partition"), "unlockLuksTask", "?datadev ?cryptomodules ?ssh", true);
     }
+    /* Runs even if the data partition did not show up in time or could not be unlocked,
+       it has its own fallbacks (label search, fsck, error message) */
+    _tasks->addTask("mount", tr("Mounting data partition %1").arg(QString(datadev)), "mountDataPartitionTask", "?datadev ?luks", true);
+    if (staticWifi)
+        _tasks->addTask("wifi", tr("Starting wifi"), "wifiTask", "bootpart mount", true);
+    if (ssh || luks || staticWifi)
+        _tasks->addTask("bootumount", tr("Unmounting system partition"), "umountBootPartitionTask", "?ssh ?cryptomodules ?wifi");
+    /* Unmounting the system partition stops udev, so load drivers after that */
+    if (QFile::exists("/sbin/udevd"))
+        _tasks->addTask("drivers", tr("Loading drivers"), "loadDriversTask", "mount ?bootumount");
+    /* prepareDrivers() is not reentrant, so these run one after the other */
+    _tasks->addTask("preloadmodules", tr("Preloading drivers"), "preloadModulesTask", "mount ?bootumount ?drivers");
+    if (isA10())
+        _tasks->addTask("a10", tr("Loading Allwinner drivers"), "loadA10ModulesTask", "mount ?drivers ?preloadmodules");
+
+    _taskProgress = new QProgressDialog(QString(), QString(), 0, 0, this);
+    _taskProgress->setLabelText(_tasks->statusText());
+    _taskProgress->show();
+    _tasks->start();
+}
 
-    if (!success)
-    {
-        qpd.setLabelText(tr("Data is not at %1. Searching other partitions...").arg(QString(datadev)));
-        QApplication::processEvents();
-        datadev.clear();
-
-        /* Search 10 times */
-        for (unsigned int i=0; i<10 && datadev.isEmpty(); i++)
-        {
-            if (i != 0)
-            {
-                processEventSleep(1000);
-            }
-
-            datadev = _i->getPartitionByLabel("berryboot");
-        }
+void BootMenuDialog::onTaskStatusChanged()
+{
+    if (_taskProgress)
+        _taskProgress->setLabelText(_tasks->statusText());
+}
 
-        if (!datadev.isEmpty())
-        {
-            qpd.setLabelText(tr("Found other berryboot partition to mount: %1").arg(QString(datadev)));
-            QApplication::processEvents();
-            success = mountDataPartition(datadev);
-        }
-    }
+/* All boot tasks completed, show the menu */
+void BootMenuDialog::onTasksFinished()
+{
+    _taskProgress->hide();
+    _taskProgress->deleteLater();
+    _taskProgress = NULL;
 
-    if (!success)
+    if (_tasks->status("mount") != BootTaskGraph::Done)
     {
-        qpd.hide();
-
-        datadev = _i->bootParam("datadev");
-        if (_i->bootoptions().contains("luks"))
-            datadev = "mapper/luks";
-
-        if (QFile::exists("/dev/"+datadev) && !_i->bootoptions().contains("btrfs"))
-        {
-            if (QMessageBox::question(this, tr("Perform fsck?"),
-                tr("Error mounting data partition. Try to repair file system?"), QMessageBox::Yes, QMessageBox::No)
-                    == QMessageBox::Yes)
-            {
-                QProcess proc;
-                _i->switchConsole(5);
-                proc.start(QByteArray("openvt -c 5 -w /usr/sbin/fsck.ext4 -yf /dev/"+datadev));
-                QApplication::processEvents();
-                proc.waitForFinished(-1);
-                success = mountDataPartition(datadev);
-                _i->switchConsole(1);
-            }
-        }
-
-        if (!success)
-        {
-            QMessageBox::critical(this, tr("No data found..."), tr("Cannot find my data partition :-("), QMessageBox::Ok);
-            reject();
-            return;
-        }
+        reject();
+        return;
     }
-    if (QFile::exists("/sbin/udevd"))
-        _i->loadDrivers();
-    initializeA10();
 
     if (QFile::exists(runonce_file))
     {
         waitForRemountRW();
-        qpd.setLabelText(tr("Removing runonce file"));
-        QApplication::processEvents();
         QByteArray runonce = file_get_contents(runonce_file);
         QFile::remove(runonce_file);
         sync();
@@ -212,7 +203,6 @@ void BootMenuDialog::initialize()
         return;
     }
 
-    qpd.hide();
     if (_i->bootoptions().contains("reconfigure"))
     {
         reconfigureLocale();
@@ -238,6 +228,12 @@ void BootMenuDialog::initialize()
             ui->list->setCurrentItem(item);
     }
 
+    /* Read ahead what the default image needs during boot, while the countdown runs */
+    QtConcurrent::run(ReadaheadProfile::prefetch, def.toLatin1());
+    _prefetched = def;
+    _premounted = def;
+    _premount.setFuture(QtConcurrent::run(BootMenuDialog::premountImage, def.toLatin1()));
+
     if (_i->bootoptions().contains("sound"))
     {
         /* Set sound channel (HDMI/headphones) */
@@ -265,6 +261,150 @@ void BootMenuDialog::initialize()
     ui->list->setFocus();
 }
 
+/* Boot tasks. These run in a worker thread, unless added with guiThread set */
+bool BootMenuDialog::networkTask()
+{
+    _i->startNetworkInterface();
+    return true;
+}
+
+bool BootMenuDialog::iscsiTask()
+{
+    startISCSI();
+    return true;
+}
+
+bool BootMenuDialog::mountBootPartitionTask()
+{
+    return mountBootPartition();
+}
+
+bool BootMenuDialog::sshTask()
+{
+    return startSSHserver();
+}
+
+bool BootMenuDialog::waitForDataDeviceTask()
+{
+    return waitForDevice(_datadev);
+}
+
+bool BootMenuDialog::loadCryptoModulesTask()
+{
+    _i->loadCryptoModules(_i->bootParam("luks_cipher"));
+    return true;
+}
+
+bool BootMenuDialog::unlockLuksTask()
+{
+    askLuksPassword(_datadev);
+    return QFile::exists("/dev/mapper/luks");
+}
+
+bool BootMenuDialog::mountDataPartitionTask()
+{
+    bool success;
+    QByteArray datadev = _datadev;
+
+    if (_i->bootoptions().contains("luks"))
+        datadev = "mapper/luks";
+
+    success = mountDataPartition(datadev);
+
+    if (!success)
+    {
+        _tasks->setTaskLabel("mount", tr("Data is not at %1. Searching other partitions...").arg(QString(datadev)));
+        QApplication::processEvents();
+        datadev.clear();
+
+        /* Search 10 times */
+        for (unsigned int i=0; i<10 && datadev.isEmpty(); i++)
+        {
+            if (i != 0)
+            {
+                processEventSleep(1000);
+            }
+
+            datadev = _i->getPartitionByLabel("berryboot");
+        }
+
+        if (!datadev.isEmpty())
+        {
+            _tasks->setTaskLabel("mount", tr("Found other berryboot partition to mount: %1").arg(QString(datadev)));
+            QApplication::processEvents();
+            success = mountDataPartition(datadev);
+        }
+    }
+
+    if (!success)
+    {
+        datadev = _datadev;
+        if (_i->bootoptions().contains("luks"))
+            datadev = "mapper/luks";
+
+        if (QFile::exists("/dev/"+datadev) && !_i->bootoptions().contains("btrfs"))
+        {
+            if (QMessageBox::question(this, tr("Perform fsck?"),
+                tr("Error mounting data partition. Try to repair file system?"), QMessageBox::Yes, QMessageBox::No)
+                    == QMessageBox::Yes)
+            {
+                QProcess proc;
+                _i->switchConsole(5);
+                if (_i->bootoptions().contains("fstype=f2fs"))
+                    proc.start(QByteArray("openvt -c 5 -w /usr/sbin/fsck.f2fs -f -y /dev/"+datadev));
+                else
+                    proc.start(QByteArray("openvt -c 5 -w /usr/sbin/fsck.ext4 -yf /dev/"+datadev));
+                QApplication::processEvents();
+                proc.waitForFinished(-1);
+                success = mountDataPartition(datadev);
+                _i->switchConsole(1);
+            }
+        }
+
+        if (!success)
+        {
+            QMessageBox::critical(this, tr("No data found..."), tr("Cannot find my data partition :-("), QMessageBox::Ok);
+        }
+    }
+
+    return success;
+}
+
+bool BootMenuDialog::wifiTask()
+{
+    _i->startWifi();
+    return true;
+}
+
+bool BootMenuDialog::umountBootPartitionTask()
+{
+    umountSystemPartition();
+    return true;
+}
+
+bool BootMenuDialog::loadDriversTask()
+{
+    _i->loadDrivers();
+    return true;
+}
+
+bool BootMenuDialog::preloadModulesTask()
+{
+    _i->preloadModules();
+    return true;
+}
+
+bool BootMenuDialog::loadA10ModulesTask()
+{
+    /* Some Allwinner A10/A13 drivers are not compiled into the kernel
+       load them as module
+       FIXME: driver should be loaded dynamically
+     */
+    _i->prepareDrivers();
+    // Wifi
+    return _i->moduleLoader()->load(QStringList("8192cu"));
+}
+
 void BootMenuDialog::on_bootButton_clicked()
 {
     bootImage(ui->list->currentItem()->data(Qt::UserRole).toString());
@@ -327,6 +467,8 @@ void BootMenuDialog::bootImage(const QString &name)
     int currentmemsplit = currentMemsplit();
     int needsmemsplit   = imageNeedsMemsplit(name);
     waitForRemountRW();
+    if (name != _premounted)
+        releasePremount();
 
     if (_i->isMemsplitHandlingEnabled() && needsmemsplit && needsmemsplit != currentmemsplit)
     {
@@ -354,13 +496,24 @@ void BootMenuDialog::bootImage(const QString &name)
         /* rename() it. This is an atomic operation according to man page */
         rename("/boot/config.new", "/boot/config.txt");
         umountSystemPartition();
+        releasePremount();
         file_put_contents(runonce_file, name.toLatin1());
-        QProcess::execute("umount /mnt");
+        MountManager::umount("/mnt", MountManager::AllReferences);
         sync(); //sleep(1);
         reboot();
     }
     else
     {
+        if (name != _prefetched)
+            ReadaheadProfile::prefetch(name.toLatin1());
+        /* init checks for the premounted image once we exit */
+        _premount.waitForFinished();
+        if (_i->isCopyToRamEnabled(name))
+        {
+            stopCountdown();
+            releasePremount();
+            copyImageToRam(name);
+        }
         file_put_contents("/tmp/answer", name.toLatin1() );
         reject();
     }
@@ -374,6 +527,7 @@ bool BootMenuDialog::memsplitsEnabled()
 
 void BootMenuDialog::startInstaller()
 {
+    releasePremount();
     _i->startNetworking();
     mountSystemPartition();
     accept();
@@ -549,14 +703,19 @@ void BootMenuDialog::loadModule(const QByteArray &name)
     qpd.setLabelText(tr("Loading module: %1").arg(QString(name)));
     qpd.show();
     QApplication::processEvents();
-    QProcess::execute("/sbin/modprobe", QStringList(name));
+    _i->moduleLoader()->load(QStringList(name));
 }
 
-void BootMenuDialog::initializeA10()
+bool BootMenuDialog::isA10()
 {
     QByteArray cpuinfo = file_get_contents("/proc/cpuinfo");
 
-    if (cpuinfo.contains("sun4i") || cpuinfo.contains("sun5i"))
+    return cpuinfo.contains("sun4i") || cpuinfo.contains("sun5i");
+}
+
+void BootMenuDialog::initializeA10()
+{
+    if (isA10())
     {
         /* Some Allwinner A10/A13 drivers are not compiled into the kernel
            load them as module
@@ -604,62 +763,86 @@ QByteArray BootMenuDialog::getBootOptions()
 
 bool BootMenuDialog::mountDataPartition(const QByteArray &dev, bool rw)
 {
-    QString mountoptions = "-o noatime";
-    if (!rw)
-        mountoptions += ",ro";
+    BootTraceScope trace("mount data partition");
+
+    /* Mount options of the storage profile chosen when formatting */
+    QByteArray profile = _i->bootParam("mountopts");
+    QByteArray mountoptions = (profile.isEmpty() ? QByteArray("noatime") : profile);
+    QByteArray fstype = "ext4";
 
     if (!QFile::exists("/mnt"))
         mkdir("/mnt", 0755);
 
     if (getBootOptions().contains("fstype=btrfs"))
     {
-        mountoptions += ",compress=lzo -t btrfs";
+        if (profile.isEmpty())
+            mountoptions += ",compress=lzo";
+        fstype = "btrfs";
         //loadModule("btrfs");
     }
-    else
+    else if (getBootOptions().contains("fstype=f2fs"))
     {
-        mountoptions += " -t ext4";
+        fstype = "f2fs";
     }
 
     /* Try mounting read-only first.
      * If that fails try mounting read-write straight away as it might recover from journal */
-    if (QProcess::execute("mount "+mountoptions+" /dev/"+dev+" /mnt") != 0
-        && QProcess::execute("mount "+mountoptions.replace(",ro","")+" /dev/"+dev+" /mnt") != 0)
+    if ((rw || !MountManager::mount("/dev/"+dev, "/mnt", fstype, mountoptions+",ro"))
+        && !MountManager::mount("/dev/"+dev, "/mnt", fstype, mountoptions))
     {
         return false;
     }
 
     if (!QFile::exists("/mnt/images"))
     {
-        if (QProcess::execute("umount /mnt") != 0)
-        {
-            //log_error("Error unmounting data partition");
-        }
+        MountManager::umount("/mnt", MountManager::AllReferences);
         return false;
     }
 
     /* Remount read-write in the background */
     if (!rw)
-        _remountproc.start("mount -o remount,rw /mnt");
+    {
+        BootTrace::begin("remount data partition rw", BootTrace::BackgroundTrack);
+        _remountOk = false;
+        _remount.setFuture(QtConcurrent::run(MountManager::remount, QByteArray("/mnt"), QByteArray("rw")));
+    }
 
     return true;
 }
 
+void BootMenuDialog::onRemountFinished()
+{
+    _remountOk = _remount.result();
+    BootTrace::end("remount data partition rw", BootTrace::BackgroundTrack);
+
+    /* Modules loaded while /mnt was read-only could not be recorded yet */
+    if (_remountOk)
+        QtConcurrent::run(_i->moduleLoader(), &ModuleLoader::saveRecorded);
+}
+
 void BootMenuDialog::waitForRemountRW()
 {
-    if (_remountproc.state() != _remountproc.NotRunning)
+    if (_remount.isRunning())
     {
         QProgressDialog qpd(tr("Remounting data partition read-write"), QString(), 0, 0, this);
         qpd.show();
         QApplication::processEvents();
 
-        if (_remountproc.state() != _remountproc.NotRunning && !_remountproc.waitForFinished())
+        QTime t;
+        t.start();
+        while (_remount.isRunning() && t.elapsed() < 30000)
+            QApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+
+        if (_remount.isRunning())
         {
             QMessageBox::critical(this, tr("Error remounting data partition"), tr("Timed out waiting for remounting data partition read-write to complete"), QMessageBox::Ok);
+            return;
         }
+        /* Finished signal may not have been delivered yet */
+        _remountOk = _remount.result();
     }
 
-    if (_remountproc.exitCode() != 0)
+    if (!_remountOk)
     {
         if (QMessageBox::question(this, tr("Perform fsck?"),
             tr("Error remounting data partition read-write. Try to repair file system?"), QMessageBox::Yes, QMessageBox::No)
@@ -670,15 +853,19 @@ void BootMenuDialog::waitForRemountRW()
                 datadev = "mapper/luks";
             else if (datadev.contains('='))
                 datadev = _i->getPartitionByUuid(_i->datadev());
+            releasePremount();
             qDebug() << "killing udev" << QProcess::execute("killall udevd");
-            qDebug() << "unmounting" << QProcess::execute("umount -f /dev/"+datadev);
+            qDebug() << "unmounting" << MountManager::umount("/mnt", MountManager::AllReferences | MountManager::Force);
 
             QProcess proc;
             _i->switchConsole(5);
-            proc.start(QByteArray("openvt -c 5 -w /usr/sbin/fsck.ext4 -yf /dev/"+datadev));
+            if (_i->bootoptions().contains("fstype=f2fs"))
+                proc.start(QByteArray("openvt -c 5 -w /usr/sbin/fsck.f2fs -f -y /dev/"+datadev));
+            else
+                proc.start(QByteArray("openvt -c 5 -w /usr/sbin/fsck.ext4 -yf /dev/"+datadev));
             QApplication::processEvents();
             proc.waitForFinished(-1);
-            mountDataPartition(datadev, true);
+            _remountOk = mountDataPartition(datadev, true);
             _i->switchConsole(1);
         }
     }
@@ -700,7 +887,7 @@ bool BootMenuDialog::waitForDevice(QByteArray &dev)
         if (QFile::exists("/dev/"+dev))
             return true;
 
-        QApplication::processEvents(QEventLoop::WaitForMoreEvents, 250);
+        _i->deviceMonitor()->waitFor(SIGNAL(blockDeviceAdded(QString)), 20000 - t.elapsed());
     }
 
     return false;
@@ -708,14 +895,24 @@ bool BootMenuDialog::waitForDevice(QByteArray &dev)
 
 void BootMenuDialog::mountSystemPartition()
 {
+    BootTraceScope trace("mount boot partition");
     QProgressDialog qpd(tr("Mounting system partition..."), QString(), 0, 0, this);
     qpd.show();
     QApplication::processEvents();
 
+    if (!mountBootPartition())
+    {
+        qpd.hide();
+        QMessageBox::critical(this, tr("Error mounting system partition"), tr("Unable to mount system partition"), QMessageBox::Ok);
+    }
+}
+
+bool BootMenuDialog::mountBootPartition()
+{
     if (!QFile::exists("/boot"))
         mkdir("/boot", 0755);
     if (_i->isPxeBoot())
-        return;
+        return true;
 
     QByteArray bootdev = _i->bootdev();
     if (bootdev == "mmcblk0p1")
@@ -730,21 +927,20 @@ void BootMenuDialog::mountSystemPartition()
     {
         if (bootdev == "mmcblk0p1")
         {
-            if (QProcess::execute("mount /dev/mmcblk0p1 /boot") == 0 || QProcess::execute("mount /dev/mmcblk0 /boot") == 0)
-                return;
+            if (MountManager::mount("/dev/mmcblk0p1", "/boot") || MountManager::mount("/dev/mmcblk0", "/boot"))
+                return true;
         }
         else
         {
-            if (QProcess::execute("mount /dev/"+bootdev+" /boot") == 0)
-                return;
+            if (MountManager::mount("/dev/"+bootdev, "/boot"))
+                return true;
         }
 
-        qpd.setLabelText(tr("Error mounting system partition... Retrying..."));
-        processEventSleep(1000);
+        qDebug() << "Error mounting system partition... Retrying...";
+        ::usleep(1000000);
     }
 
-    qpd.hide();
-    QMessageBox::critical(this, tr("Error mounting system partition"), tr("Unable to mount system partition"), QMessageBox::Ok);
+    return false;
 }
 
 void BootMenuDialog::umountSystemPartition()
@@ -752,8 +948,10 @@ void BootMenuDialog::umountSystemPartition()
     if (_i->isPxeBoot())
         return;
 
-    _i->cleanupDrivers();
-    QProcess::execute("umount /boot");
+    /* Drivers loop mounted from /boot/shared.img keep it busy. Only matters when releasing the last reference */
+    if (MountManager::references("/boot") <= 1)
+        _i->cleanupDrivers();
+    MountManager::umount("/boot");
 }
 
 int BootMenuDialog::currentMemsplit()
@@ -825,9 +1023,115 @@ QByteArray BootMenuDialog::memsplitParameter(int memsplit)
     return r;
 }
 
+bool BootMenuDialog::premountImage(const QByteArray &image)
+{
+    BootTraceScope trace("premount "+image, BootTrace::BackgroundTrack);
+    QByteArray datadir = "/mnt/data/"+image;
+
+    /* A pending OpenELEC update replaces the image before init mounts it */
+    if (QFile::exists(datadir+"/storage/.kodi/temp/oe_update/SYSTEM") || QFile::exists(datadir+"/storage/.update/SYSTEM"))
+        return false;
+    /* Will be mounted from RAM instead */
+    if (QFile::exists(datadir+"/copy_to_ram"))
+        return false;
+    /* init creates the data and work directories for the overlay if missing, but cannot replace a file */
+    QFileInfo datadirInfo(datadir);
+    if (datadirInfo.exists() && !datadirInfo.isDir())
+        return false;
+
+    QDir dir;
+    dir.mkdir("/squashfs");
+    if (!MountManager::mountImage("/mnt/images/"+image, "/squashfs", "squashfs"))
+        return false;
+
+    /* Same init candidates as the init script. Usually symlinks to absolute paths that only resolve after switch_root */
+    static const char *initfiles[] = { "sbin/init", "usr/lib/systemd/systemd", "lib/systemd/systemd", "init", NULL };
+    bool hasInit = false;
+    for (int i = 0; initfiles[i] && !hasInit; i++)
+    {
+        QFileInfo fi(QByteArray("/squashfs/")+initfiles[i]);
+        hasInit = fi.exists() || fi.isSymLink();
+    }
+    if (!hasInit)
+    {
+        MountManager::umount("/squashfs");
+        return false;
+    }
+
+    QFile f(premounted_file);
+    f.open(f.WriteOnly);
+    f.write(image);
+    f.close();
+
+    return true;
+}
+
+void BootMenuDialog::releasePremount()
+{
+    if (_premounted.isEmpty())
+        return;
+
+    _premount.waitForFinished();
+    if (_premount.result())
+    {
+        QFile::remove(premounted_file);
+        MountManager::umount("/squashfs");
+    }
+    _premounted.clear();
+}
+
+bool BootMenuDialog::copyImageToRam(const QString &name)
+{
+    QString image = "/mnt/images/"+name, datadir = "/mnt/data/"+name;
+
+    /* A pending OpenELEC update replaces the image, init would boot the old copy */
+    if (QFile::exists(datadir+"/storage/.kodi/temp/oe_update/SYSTEM") || QFile::exists(datadir+"/storage/.update/SYSTEM"))
+        return false;
+
+    /* MemAvailable:     3713768 kB */
+    QByteArray meminfo = file_get_contents("/proc/meminfo");
+    int pos = meminfo.indexOf("MemAvailable:");
+    if (pos == -1)
+        pos = meminfo.indexOf("MemFree:");
+    qint64 available = meminfo.mid(pos).split('\n').first().simplified().split(' ').value(1).toLongLong() * 1024;
+    qint64 size = QFileInfo(image).size();
+
+    if (pos == -1 || !size || size + qint64(RAM_COPY_RESERVE_MB)*1024*1024 > available)
+    {
+        qDebug() << "Not enough memory to copy" << name << "to RAM, booting from disk";
+        return false;
+    }
+
+    QDir dir;
+    dir.mkdir(ramimage_dir);
+    if (!MountManager::mount("tmpfs", ramimage_dir, "tmpfs", "size="+QByteArray::number(size/1024 + 1024)+"k"))
+        return false;
+
+    QProgressDialog qpd(tr("Copying %1 to RAM...").arg(_i->imageFilenameToFriendlyName(name)), QString(), 0, 100, this);
+    qpd.show();
+    QApplication::processEvents();
+
+    /* One large sequential read, instead of the OS reading squashfs blocks from SD randomly */
+    CopyThread ct(image, ramimage_dir+QString("/")+name);
+    QEventLoop loop;
+    connect(&ct, SIGNAL(progress(int)), &qpd, SLOT(setValue(int)));
+    connect(&ct, SIGNAL(finished()), &loop, SLOT(quit()));
+    ct.start();
+    loop.exec();
+
+    if (!QFile::exists(ramimage_dir+QString("/")+name))
+    {
+        qDebug() << "Error copying" << name << "to RAM, booting from disk";
+        MountManager::umount(ramimage_dir);
+        return false;
+    }
+
+    return true;
+}
+
 void BootMenuDialog::reboot()
 {
-    QProcess::execute("umount -ar");
+    MountManager::umountAll();
     sync();
     ::reboot(RB_AUTOBOOT);
 }
@@ -836,7 +1140,7 @@ void BootMenuDialog::halt()
 {
     QProcess::execute("killall udevd");
     ::usleep(100000);
-    QProcess::execute("umount -ar");
+    MountManager::umountAll();
     sync();
     if (_i->datadev().startsWith("sda"))
     {
@@ -861,10 +1165,6 @@ void BootMenuDialog::processEventSleep(int ms)
 
 void BootMenuDialog::askLuksPassword(const QString &datadev)
 {
-    mountSystemPartition();
-    _i->loadCryptoModules();
-    umountSystemPartition();
-
     /* For added security let cryptsetup ask for password in a text console,
      * as it can remain in memory if we do it in the GUI.
      * Also allow it to be entered through SSH if enabled.
@@ -890,17 +1190,10 @@ void BootMenuDialog::askLuksPassword(const QString &datadev)
 
 void BootMenuDialog::startSSHserverIfEnabled()
 {
-    QByteArray sshkey = _i->bootParam("ssh_authorized_key").replace("\\n", "\n");
-    if (sshkey.isEmpty())
+    if (_i->bootParam("ssh_authorized_key").isEmpty())
         return;
 
-    /* Write authorized_key provided through boot parameter to tmpfs */
-    ::chmod("/root", 0700);
-    ::mkdir("/root/.ssh", 0700);
-    QFile f("/root/.ssh/authorized_keys");
-    f.open(f.WriteOnly);
-    f.write(sshkey);
-    f.close();
+    BootTraceScope trace("start SSH server");
 
     /* Let dropbear store the host's public key on the FAT partition */
     mountSystemPartition();
@@ -909,12 +1202,26 @@ void BootMenuDialog::startSSHserverIfEnabled()
     qpd.show();
     QApplication::processEvents();
 
+    startSSHserver();
+    umountSystemPartition();
+}
+
+bool BootMenuDialog::startSSHserver()
+{
+    QByteArray sshkey = _i->bootParam("ssh_authorized_key").replace("\\n", "\n");
+
+    /* Write authorized_key provided through boot parameter to tmpfs */
+    ::chmod("/root", 0700);
+    ::mkdir("/root/.ssh", 0700);
+    QFile f("/root/.ssh/authorized_keys");
+    f.open(f.WriteOnly);
+    f.write(sshkey);
+    f.close();
+
     QFile::link("/boot", "/etc/dropbear");
     ::mkdir("/dev/pts", 0755);
-    QProcess::execute("mount -t devpts devpts /dev/pts");
-    QProcess::execute("/etc/init.d/S50dropbear start");
-
-    umountSystemPartition();
+    MountManager::mount("devpts", "/dev/pts", "devpts");
+    return QProcess::execute("/etc/init.d/S50dropbear start") == 0;
 }
 
 void BootMenuDialog::stopSSHserver()
@@ -922,6 +1229,6 @@ void BootMenuDialog::stopSSHserver()
     if (!_i->bootParam("ssh_authorized_key").isEmpty())
     {
         QProcess::execute("/etc/init.d/S50dropbear stop");
-        QProcess::execute("umount /dev/pts");
+        MountManager::umount("/dev/pts");
     }
 }
@@ -30,12 +30,14 @@
 #include <QDialog>
 #include <QTimer>
 #include <QModelIndex>
-#include <QProcess>
+#include <QFutureWatcher>
 
 namespace Ui {
 class BootMenuDialog;
 }
 class Installer;
+class BootTaskGraph;
+class QProgressDialog;
 
 class BootMenuDialog : public QDialog
 {
@@ -69,6 +71,10 @@ protected:
      * Load Allwinner A10 modules
      */
     void initializeA10();
+    /*
+     * True if running on an Allwinner A10/A13
+     */
+    bool isA10();
     /*
      * Load data from file
      */
@@ -90,9 +96,13 @@ protected:
      */
     bool waitForDevice(QByteArray &dev);
     /*
-     * Mount boot partition
+     * Mount boot partition, showing progress and errors
      */
     void mountSystemPartition();
+    /*
+     * Mount boot partition without user interaction. Safe to call from a boot task
+     */
+    bool mountBootPartition();
     /*
      * Unmount boot partition
      */
@@ -139,6 +149,10 @@ protected:
      * Start SSH daemon (if ssh_authorized_key boot parameter is present)
      */
     void startSSHserverIfEnabled();
+    /*
+     * Start SSH daemon, with the boot partition already mounted
+     */
+    bool startSSHserver();
     /*
      * Stop SSH daemon
      */
@@ -151,12 +165,32 @@ protected:
      * Show locale settings dialog
      */
     void reconfigureLocale();
+    /*
+     * Mount the default image at /squashfs during the countdown, so init can reuse it
+     */
+    static bool premountImage(const QByteArray &image);
+    /*
+     * Undo premountImage(), if another image is booted or the installer is started
+     */
+    void releasePremount();
+    /*
+     * Copy image to tmpfs at /ramimage with progress dialog, init mounts it from there
+     * Returns false if there is not enough memory or copying failed
+     */
+    bool copyImageToRam(const QString &name);
 
     Ui::BootMenuDialog *ui;
     Installer *_i;
     int _countdown;
     QTimer _countdownTimer;
-    QProcess _remountproc;
+    QFutureWatcher<bool> _remount;
+    bool _remountOk;
+    QByteArray _datadev;
+    QString _prefetched;
+    QFutureWatcher<bool> _premount;
+    QString _premounted;
+    BootTaskGraph *_tasks;
+    QProgressDialog *_taskProgress;
 
 protected slots:
     void on_bootButton_clicked();
@@ -166,6 +200,24 @@ protected slots:
     void autoBootTimeout();
     void stopCountdown();
     void initialize();
+    void onRemountFinished();
+    void onTaskStatusChanged();
+    void onTasksFinished();
+
+    /* Boot tasks, run by the task graph */
+    bool networkTask();
+    bool iscsiTask();
+    bool mountBootPartitionTask();
+    bool sshTask();
+    bool waitForDataDeviceTask();
+    bool loadCryptoModulesTask();
+    bool unlockLuksTask();
+    bool mountDataPartitionTask();
+    bool wifiTask();
+    bool umountBootPartitionTask();
+    bool loadDriversTask();
+    bool preloadModulesTask();
+    bool loadA10ModulesTask();
 };
 
 #endif // BOOTMENUDIALOG_H
@@ -0,0 +1,294 @@
+/* Berryboot -- boot task graph
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "boottaskgraph.h"
+#include "boottrace.h"
+#include <QRunnable>
+#include <QStringList>
+#include <QMetaObject>
+#include <QDebug>
+
+/* Most tasks wait for hardware or child processes instead of using the CPU */
+#define MAX_WORKER_THREADS  8
+
+class BootTaskRunnable : public QRunnable
+{
+public:
+    /* Name and method are copied, as the task list is only accessed by the GUI thread */
+    BootTaskRunnable(BootTaskGraph *graph, int task, const QByteArray &name, const QByteArray &method)
+        : _graph(graph), _task(task), _name(name), _method(method)
+    {
+    }
+
+    virtual void run()
+    {
+        _graph->runTask(_task, _name, _method);
+    }
+
+protected:
+    BootTaskGraph *_graph;
+    int _task;
+    QByteArray _name, _method;
+};
+
+BootTaskGraph::BootTaskGraph(QObject *receiver, QObject *parent) :
+    QObject(parent), _receiver(receiver), _started(false), _guiBusy(false), _finished(false)
+{
+    _pool.setMaxThreadCount(MAX_WORKER_THREADS);
+}
+
+BootTaskGraph::~BootTaskGraph()
+{
+    _pool.waitForDone();
+}
+
+void BootTaskGraph::addTask(const QByteArray &name, const QString &label, const char *method,
+                            const QByteArray &dependencies, bool guiThread)
+{
+    Task t;
+    t.name      = name;
+    t.method    = method;
+    t.label     = label;
+    t.guiThread = guiThread;
+    t.status    = Pending;
+
+    foreach (QByteArray dep, dependencies.split(' '))
+    {
+        if (dep.startsWith('?'))
+            t.after.append(dep.mid(1));
+        else if (!dep.isEmpty())
+            t.dependencies.append(dep);
+    }
+    _tasks.append(t);
+}
+
+void BootTaskGraph::setTaskLabel(const QByteArray &name, const QString &label)
+{
+    int task = indexOf(name);
+    if (task == -1)
+        return;
+
+    _tasks[task].label = label;
+    emit taskStatusChanged(name);
+}
+
+void BootTaskGraph::start()
+{
+    _started = true;
+    schedule();
+}
+
+int BootTaskGraph::indexOf(const QByteArray &name) const
+{
+    for (int i=0; i<_tasks.count(); i++)
+    {
+        if (_tasks[i].name == name)
+            return i;
+    }
+
+    return -1;
+}
+
+BootTaskGraph::Status BootTaskGraph::status(const QByteArray &name) const
+{
+    int task = indexOf(name);
+    return task == -1 ? Skipped : _tasks[task].status;
+}
+
+bool BootTaskGraph::isFinished() const
+{
+    return _finished;
+}
+
+QString BootTaskGraph::statusText() const
+{
+    QStringList lines;
+
+    foreach (const Task &t, _tasks)
+    {
+        switch (t.status)
+        {
+        case Pending:
+            lines.append(tr("%1 (waiting)").arg(t.label));
+            break;
+        case Running:
+            lines.append(tr("%1...").arg(t.label));
+            break;
+        case Done:
+            lines.append(tr("%1 (done)").arg(t.label));
+            break;
+        case Failed:
+            lines.append(tr("%1 (failed)").arg(t.label));
+            break;
+        case Skipped:
+            lines.append(tr("%1 (skipped)").arg(t.label));
+            break;
+        }
+    }
+
+    return lines.join("\n");
+}
+
+void BootTaskGraph::setStatus(int task, Status status)
+{
+    _tasks[task].status = status;
+    emit taskStatusChanged(_tasks[task].name);
+}
+
+bool BootTaskGraph::isReady(int task, bool *skip) const
+{
+    bool ready = true;
+
+    if (skip)
+        *skip = false;
+
+    foreach (QByteArray dep, _tasks[task].dependencies)
+    {
+        int d = indexOf(dep);
+        if (d == -1)
+            continue;
+        if (_tasks[d].status == Failed || _tasks[d].status == Skipped)
+        {
+            if (skip)
+                *skip = true;
+            ready = false;
+        }
+        else if (_tasks[d].status != Done)
+            ready = false;
+    }
+    foreach (QByteArray dep, _tasks[task].after)
+    {
+        int d = indexOf(dep);
+        if (d != -1 && (_tasks[d].status == Pending || _tasks[d].status == Running))
+            ready = false;
+    }
+
+    return ready;
+}
+
+void BootTaskGraph::schedule()
+{
+    bool changed = true, busy = false, guiReady = false;
+
+    if (!_started)
+        return;
+
+    /* Repeat, as skipping a task can make its dependents skip as well */
+    while (changed)
+    {
+        changed = false;
+
+        for (int i=0; i<_tasks.count(); i++)
+        {
+            if (_tasks[i].status != Pending)
+                continue;
+
+            bool skip;
+            bool ready = isReady(i, &skip);
+
+            if (skip)
+            {
+                qDebug() << "Skipping boot task" << _tasks[i].name;
+                setStatus(i, Skipped);
+                changed = true;
+            }
+            else if (ready && !_tasks[i].guiThread)
+            {
+                setStatus(i, Running);
+                _pool.start(new BootTaskRunnable(this, i, _tasks[i].name, _tasks[i].method));
+            }
+            else if (ready)
+            {
+                guiReady = true;
+            }
+        }
+    }
+
+    if (guiReady)
+        QMetaObject::invokeMethod(this, "runGuiTasks", Qt::QueuedConnection);
+
+    foreach (const Task &t, _tasks)
+    {
+        if (t.status == Pending || t.status == Running)
+            busy = true;
+    }
+
+    if (!busy && !_finished)
+    {
+        _finished = true;
+        emit finished();
+    }
+}
+
+bool BootTaskGraph::invoke(const QByteArray &name, const QByteArray &method, BootTrace::Track track)
+{
+    bool ok = false;
+
+    BootTrace::begin(name, track);
+    if (!QMetaObject::invokeMethod(_receiver, method.constData(), Qt::DirectConnection, Q_RETURN_ARG(bool, ok)))
+        qDebug() << "Error invoking boot task" << name;
+    BootTrace::end(name, track);
+
+    return ok;
+}
+
+void BootTaskGraph::runTask(int task, const QByteArray &name, const QByteArray &method)
+{
+    bool ok = invoke(name, method, BootTrace::Track(BootTrace::TaskTrack+task));
+    QMetaObject::invokeMethod(this, "onTaskFinished", Qt::QueuedConnection, Q_ARG(int, task), Q_ARG(bool, ok));
+}
+
+void BootTaskGraph::runGuiTasks()
+{
+    /* Tasks showing dialogs may run an event loop. Do not start another one from that */
+    if (_guiBusy)
+        return;
+
+    for (int i=0; i<_tasks.count(); i++)
+    {
+        if (_tasks[i].status != Pending || !_tasks[i].guiThread)
+            continue;
+
+        if (isReady(i))
+        {
+            setStatus(i, Running);
+            _guiBusy = true;
+            bool ok = invoke(_tasks[i].name, _tasks[i].method, BootTrace::GuiTrack);
+            _guiBusy = false;
+            onTaskFinished(i, ok);
+            return;
+        }
+    }
+}
+
+void BootTaskGraph::onTaskFinished(int task, bool ok)
+{
+    if (!ok)
+        qDebug() << "Boot task failed:" << _tasks[task].name;
+
+    setStatus(task, ok ? Done : Failed);
+    schedule();
+}
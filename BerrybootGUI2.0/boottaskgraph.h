@@ -0,0 +1,113 @@
+#ifndef BOOTTASKGRAPH_H
+#define BOOTTASKGRAPH_H
+
+/* Berryboot -- boot task graph
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QObject>
+#include <QList>
+#include <QByteArray>
+#include <QString>
+#include <QThreadPool>
+#include "boottrace.h"
+
+/*
+ * Runs initialization tasks as soon as the tasks they depend on have completed
+ *
+ * A task is a slot of the receiver returning bool.
+ * Worker tasks run in a thread pool, so they may only block, not touch widgets.
+ * Tasks that show dialogs run in the GUI thread, one at a time.
+ * If a task fails, the tasks depending on it are skipped, unless they only need to run after it.
+ */
+class BootTaskGraph : public QObject
+{
+    Q_OBJECT
+public:
+    enum Status { Pending, Running, Done, Failed, Skipped };
+
+    explicit BootTaskGraph(QObject *receiver, QObject *parent = 0);
+    virtual ~BootTaskGraph();
+
+    /*
+     * Add task calling slot 'method' of the receiver
+     * 'dependencies' is a space separated list of task names. Names of tasks that are not added are ignored
+     * A name prefixed with '?' only orders the tasks: the task still runs if that one failed or was skipped
+     */
+    void addTask(const QByteArray &name, const QString &label, const char *method,
+                 const QByteArray &dependencies = QByteArray(), bool guiThread = false);
+    /*
+     * Change the description shown for a task (e.g. while it is running)
+     */
+    void setTaskLabel(const QByteArray &name, const QString &label);
+    void start();
+    Status status(const QByteArray &name) const;
+    bool isFinished() const;
+    /*
+     * One line per task with its current status, for display in a progress dialog
+     */
+    QString statusText() const;
+
+    /* Used by the worker threads */
+    void runTask(int task, const QByteArray &name, const QByteArray &method);
+
+signals:
+    void taskStatusChanged(const QByteArray &name);
+    void finished();
+
+protected slots:
+    void onTaskFinished(int task, bool ok);
+    void runGuiTasks();
+
+protected:
+    struct Task
+    {
+        QByteArray name, method;
+        QString label;
+        QList<QByteArray> dependencies, after;
+        bool guiThread;
+        Status status;
+    };
+
+    QObject *_receiver;
+    QList<Task> _tasks;
+    QThreadPool _pool;
+    bool _started, _guiBusy, _finished;
+
+    int indexOf(const QByteArray &name) const;
+    /*
+     * True if all dependencies are done and the tasks to run after are finished
+     * Sets skip if a dependency failed or was skipped, in which case the task can never run
+     */
+    bool isReady(int task, bool *skip = 0) const;
+    /*
+     * Start tasks whose dependencies are satisfied, and skip those that can no longer run
+     */
+    void schedule();
+    void setStatus(int task, Status status);
+    bool invoke(const QByteArray &name, const QByteArray &method, BootTrace::Track track);
+};
+
+#endif // BOOTTASKGRAPH_H
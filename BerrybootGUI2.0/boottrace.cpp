@@ -0,0 +1,79 @@
+/* Berryboot -- boot time tracing
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "boottrace.h"
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef CLOCK_BOOTTIME
+#define CLOCK_BOOTTIME 7
+#endif
+
+#define BOOTTRACE_FILE  "/tmp/boottrace"
+
+void BootTrace::begin(const QByteArray &name, Track track)
+{
+    write('B', name, track);
+}
+
+void BootTrace::end(const QByteArray &name, Track track)
+{
+    write('E', name, track);
+}
+
+void BootTrace::instant(const QByteArray &name, Track track)
+{
+    write('i', name, track);
+}
+
+void BootTrace::write(char phase, const QByteArray &name, Track track)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    qint64 usec = qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+
+    /* Format: <usec> <phase> <track> <name> */
+    QByteArray line = QByteArray::number(usec)+" "+phase+" "+QByteArray::number(track)+" "+name+"\n";
+
+    /* Single write() with O_APPEND, so lines of the GUI and init script never interleave */
+    int fd = ::open(BOOTTRACE_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd == -1)
+        return;
+    if (::write(fd, line.constData(), line.size()) != line.size()) { }
+    ::close(fd);
+}
+
+BootTraceScope::BootTraceScope(const QByteArray &name, BootTrace::Track track)
+    : _name(name), _track(track)
+{
+    BootTrace::begin(_name, _track);
+}
+
+BootTraceScope::~BootTraceScope()
+{
+    BootTrace::end(_name, _track);
+}
@@ -0,0 +1,68 @@
+#ifndef BOOTTRACE_H
+#define BOOTTRACE_H
+
+/* Berryboot -- boot time tracing
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QByteArray>
+
+/*
+ * Records begin/end of boot phases to /tmp/boottrace, shared with the init script.
+ * Before switching root, init converts it to Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+ * in /mnt/boottrace/boot.json, and keeps the traces of the previous boots as boot.1.json to boot.4.json
+ *
+ * Timestamps are CLOCK_BOOTTIME in microseconds, same clock as /proc/uptime used by init.
+ */
+class BootTrace
+{
+public:
+    /* Phases on the same track must nest, use a separate track for things running in the background */
+    /* Task n of the boot task graph is recorded on track TaskTrack+n */
+    enum Track { InitTrack = 1, GuiTrack = 2, BackgroundTrack = 3, TaskTrack = 10 };
+
+    static void begin(const QByteArray &name, Track track = GuiTrack);
+    static void end(const QByteArray &name, Track track = GuiTrack);
+    static void instant(const QByteArray &name, Track track = GuiTrack);
+
+protected:
+    static void write(char phase, const QByteArray &name, Track track);
+};
+
+/*
+ * Records a phase lasting until it goes out of scope
+ */
+class BootTraceScope
+{
+public:
+    explicit BootTraceScope(const QByteArray &name, BootTrace::Track track = BootTrace::GuiTrack);
+    ~BootTraceScope();
+
+protected:
+    QByteArray _name;
+    BootTrace::Track _track;
+};
+
+#endif // BOOTTRACE_H
@@ -49,6 +49,8 @@ protected:
 signals:
     void completed();
     void failed();
+    /* Percentage of source file copied so far */
+    void progress(int percent);
 };
 
 #endif // COPYTHREAD_H
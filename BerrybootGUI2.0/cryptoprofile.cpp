@@ -0,0 +1,248 @@
+/* Berryboot -- disk encryption cipher selection
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "cryptoprofile.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QProcess>
+#include <QRegExp>
+#include <QDebug>
+#include <string.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <sys/socket.h>
+#include <linux/if_alg.h>
+
+#ifndef SOL_ALG
+#define SOL_ALG 279
+#endif
+
+/* Time cryptsetup should spend on key derivation when unlocking */
+#define TARGET_UNLOCK_TIME_MS  2000
+
+/* Time to spend measuring each cipher */
+#define BENCHMARK_TIME_MS      250
+
+/* dm-crypt encrypts per sector */
+#define BENCHMARK_BLOCK_SIZE   4096
+
+#define VERSION_CODE(major, minor, patch)  (((major) << 16) | ((minor) << 8) | (patch))
+
+struct cipherCandidate
+{
+    const char *cipher, *algorithm;
+    int keyBytes, ivBytes;
+    /* Minimum kernel and cryptsetup version supporting the cipher */
+    int minKernel, minCryptsetup;
+};
+
+/* AES-XTS is fastest on CPUs with AES instructions, Adiantum on those without (e.g. Pi 0-3) */
+static const struct cipherCandidate candidates[] = {
+    {"aes-xts-plain64", "xts(aes)", 64, 16, 0, 0},
+    {"xchacha12,aes-adiantum-plain64", "adiantum(xchacha12,aes)", 32, 32, VERSION_CODE(5,0,0), VERSION_CODE(2,0,6)},
+    {"xchacha20,aes-adiantum-plain64", "adiantum(xchacha20,aes)", 32, 32, VERSION_CODE(5,0,0), VERSION_CODE(2,0,6)},
+    {NULL, NULL, 0, 0, 0, 0}
+};
+
+/* Parses the first x.y.z in str */
+static int parseVersion(const QString &str)
+{
+    QRegExp rx("(\\d+)\\.(\\d+)(\\.(\\d+))?");
+
+    if (rx.indexIn(str) == -1)
+        return 0;
+
+    return VERSION_CODE(rx.cap(1).toInt(), rx.cap(2).toInt(), rx.cap(4).toInt());
+}
+
+CryptoProfile::CryptoProfile()
+    : _cipher("aes-xts-plain64"), _keySize(512), _kernelVersion(0), _cryptsetupVersion(0)
+{
+    struct utsname u;
+    if (uname(&u) == 0)
+        _kernelVersion = parseVersion(u.release);
+
+    /* Output is e.g. "cryptsetup 1.7.5" */
+    QProcess proc;
+    proc.start("/usr/sbin/cryptsetup --version");
+    if (proc.waitForFinished())
+        _cryptsetupVersion = parseVersion(proc.readAll());
+}
+
+void CryptoProfile::benchmark()
+{
+    double best = 0;
+
+    for (int i=0; candidates[i].cipher; i++)
+    {
+        if (_kernelVersion < candidates[i].minKernel || _cryptsetupVersion < candidates[i].minCryptsetup)
+        {
+            qDebug() << "Cipher" << candidates[i].cipher << "not supported by kernel or cryptsetup";
+            continue;
+        }
+
+        double speed = measure(candidates[i].algorithm, candidates[i].keyBytes, candidates[i].ivBytes);
+        qDebug() << "Cipher" << candidates[i].cipher << "encrypts at" << speed << "MB/s";
+
+        if (speed > best)
+        {
+            best = speed;
+            _cipher = candidates[i].cipher;
+            _keySize = candidates[i].keyBytes * 8;
+        }
+    }
+
+    qDebug() << "Selected cipher" << _cipher;
+}
+
+double CryptoProfile::measure(const char *algorithm, int keyBytes, int ivBytes)
+{
+    struct sockaddr_alg sa;
+    int tfmfd, opfd;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.salg_family = AF_ALG;
+    strcpy((char *) sa.salg_type, "skcipher");
+    strncpy((char *) sa.salg_name, algorithm, sizeof(sa.salg_name)-1);
+
+    tfmfd = socket(AF_ALG, SOCK_SEQPACKET, 0);
+    if (tfmfd == -1)
+        return 0;
+
+    /* bind() fails if the kernel does not have the algorithm */
+    QByteArray key(keyBytes, 0);
+    for (int i=0; i<keyBytes; i++)
+        key[i] = i;
+
+    if (bind(tfmfd, (struct sockaddr *) &sa, sizeof(sa)) != 0
+            || setsockopt(tfmfd, SOL_ALG, ALG_SET_KEY, key.constData(), key.size()) != 0
+            || (opfd = accept(tfmfd, NULL, 0)) == -1)
+    {
+        close(tfmfd);
+        return 0;
+    }
+
+    QByteArray buf(BENCHMARK_BLOCK_SIZE, 0);
+    char cbuf[CMSG_SPACE(sizeof(quint32)) + CMSG_SPACE(sizeof(struct af_alg_iv) + 32)];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    struct af_alg_iv *iv;
+    qint64 bytes = 0;
+    QElapsedTimer t;
+
+    memset(cbuf, 0, sizeof(cbuf));
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = cbuf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(quint32)) + CMSG_SPACE(sizeof(struct af_alg_iv) + ivBytes);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_ALG;
+    cmsg->cmsg_type = ALG_SET_OP;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(quint32));
+    *(quint32 *) CMSG_DATA(cmsg) = ALG_OP_ENCRYPT;
+
+    cmsg = CMSG_NXTHDR(&msg, cmsg);
+    cmsg->cmsg_level = SOL_ALG;
+    cmsg->cmsg_type = ALG_SET_IV;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct af_alg_iv) + ivBytes);
+    iv = (struct af_alg_iv *) CMSG_DATA(cmsg);
+    iv->ivlen = ivBytes;
+
+    t.start();
+    while (t.elapsed() < BENCHMARK_TIME_MS)
+    {
+        /* Sector number as IV, like plain64 */
+        memcpy(iv->iv, &bytes, sizeof(bytes));
+        iov.iov_base = buf.data();
+        iov.iov_len = buf.size();
+
+        if (sendmsg(opfd, &msg, 0) != buf.size()
+                || read(opfd, buf.data(), buf.size()) != buf.size())
+        {
+            bytes = 0;
+            break;
+        }
+        bytes += buf.size();
+    }
+
+    close(opfd);
+    close(tfmfd);
+
+    if (!bytes)
+        return 0;
+
+    return bytes / 1048576.0 / (t.elapsed() / 1000.0);
+}
+
+QString CryptoProfile::cipher() const
+{
+    return _cipher;
+}
+
+QString CryptoProfile::luksFormatOptions() const
+{
+    /* cryptsetup 1.x only knows LUKS1 with PBKDF2 */
+    if (_cryptsetupVersion < VERSION_CODE(2,0,0))
+    {
+        return QString("--cipher %1 --key-size %2 --hash sha256 --iter-time %3")
+                .arg(_cipher).arg(_keySize).arg(TARGET_UNLOCK_TIME_MS);
+    }
+
+    /* Argon2 is memory-hard, use a quarter of RAM at most, so it also unlocks on 256 MB boards */
+    int memoryKB = 1048576;
+    QFile f("/proc/meminfo");
+    if (f.open(f.ReadOnly))
+    {
+        QByteArray line = f.readLine().simplified(); /* MemTotal: 1000000 kB */
+        int total = line.split(' ').value(1).toInt();
+        if (total)
+            memoryKB = qBound(32768, total / 4, 1048576);
+        f.close();
+    }
+
+    return QString("--type luks2 --cipher %1 --key-size %2 --pbkdf argon2id --iter-time %3 --pbkdf-memory %4")
+            .arg(_cipher).arg(_keySize).arg(TARGET_UNLOCK_TIME_MS).arg(memoryKB);
+}
+
+QStringList CryptoProfile::modulesForCipher(const QByteArray &cipher)
+{
+    /* Needed by cryptsetup itself and dm-crypt, regardless of cipher */
+    QStringList modules;
+    modules << "dm_crypt" << "sha256" << "hmac" << "algif_hash" << "algif_skcipher";
+
+    /* Not every module exists on every architecture and kernel version, the caller filters the list through ModuleLoader::available() */
+    if (cipher.isEmpty() || cipher.contains("aes-xts"))
+        modules << "aes" << "aes_arm_bs" << "aes_arm" << "aes_neon_bs" << "aes_ce_blk" << "xts";
+    if (cipher.isEmpty() || cipher.contains("adiantum"))
+        modules << "aes" << "aes_arm" << "chacha_neon" << "chacha20_neon" << "chacha_generic" << "chacha20_generic"
+                << "nhpoly1305_neon" << "nhpoly1305" << "poly1305_generic" << "adiantum";
+
+    modules.removeDuplicates();
+    return modules;
+}
@@ -0,0 +1,71 @@
+#ifndef CRYPTOPROFILE_H
+#define CRYPTOPROFILE_H
+
+/* Berryboot -- disk encryption cipher selection
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+
+class CryptoProfile
+{
+public:
+    CryptoProfile();
+
+    /*
+     * Measure throughput of the candidate ciphers in the kernel through AF_ALG,
+     * and select the fastest one supported by both the kernel and cryptsetup.
+     * Requires algif_skcipher to be loaded
+     */
+    void benchmark();
+
+    /*
+     * Selected cipher in cryptsetup notation, e.g. aes-xts-plain64
+     */
+    QString cipher() const;
+
+    /*
+     * cryptsetup luksFormat arguments, to be put in front of the device name
+     * Uses LUKS2 with Argon2id, or LUKS1 with PBKDF2 if cryptsetup is older than 2.0,
+     * with cost calibrated by cryptsetup to the target unlock time
+     */
+    QString luksFormatOptions() const;
+
+    /*
+     * Kernel modules needed to open a volume encrypted with cipher
+     * Returns the modules for all candidates if cipher is empty (unknown)
+     */
+    static QStringList modulesForCipher(const QByteArray &cipher);
+
+protected:
+    QString _cipher;
+    int _keySize, _kernelVersion, _cryptsetupVersion;
+
+    double measure(const char *algorithm, int keyBytes, int ivBytes);
+};
+
+#endif // CRYPTOPROFILE_H
@@ -0,0 +1,161 @@
+/* Berryboot -- block device index
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deviceindex.h"
+#include "devicemonitor.h"
+#include <QDir>
+#include <QStringList>
+#include <QMutexLocker>
+#include <QDebug>
+#include <fcntl.h>
+#include <unistd.h>
+#include <blkid/blkid.h>
+
+DeviceIndex::DeviceIndex(DeviceMonitor *monitor, QObject *parent) :
+    QObject(parent), _built(false)
+{
+    connect(monitor, SIGNAL(blockDeviceAdded(QString)), this, SLOT(onDeviceAdded(QString)));
+    connect(monitor, SIGNAL(blockDeviceChanged(QString)), this, SLOT(onDeviceAdded(QString)));
+    connect(monitor, SIGNAL(blockDeviceRemoved(QString)), this, SLOT(onDeviceRemoved(QString)));
+}
+
+void DeviceIndex::build()
+{
+    QString dirname = "/sys/class/block";
+    QDir dir(dirname);
+    QStringList list = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+
+    foreach (QString devname, list)
+    {
+        /* Skip ramdisks and loop mounted images, but not device mapper (LUKS) */
+        if (devname.startsWith("ram") || devname.startsWith("loop"))
+            continue;
+
+        _devices.insert(devname.toLatin1(), probe(devname.toLatin1()));
+    }
+    _built = true;
+}
+
+DeviceIndex::Tags DeviceIndex::probe(const QByteArray &device)
+{
+    Tags tags;
+    QByteArray path = "/dev/"+device;
+    /* Do not wait for drives without media */
+    int fd = ::open(path.constData(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1)
+        return tags;
+
+    blkid_probe pr = blkid_new_probe();
+    if (pr && blkid_probe_set_device(pr, fd, 0, 0) == 0)
+    {
+        blkid_probe_enable_superblocks(pr, 1);
+        blkid_probe_set_superblocks_flags(pr, BLKID_SUBLKS_LABEL | BLKID_SUBLKS_UUID | BLKID_SUBLKS_TYPE);
+        blkid_probe_enable_partitions(pr, 1);
+        blkid_probe_set_partitions_flags(pr, BLKID_PARTS_ENTRY_DETAILS);
+
+        if (blkid_do_safeprobe(pr) == 0)
+        {
+            int count = blkid_probe_numof_values(pr);
+            for (int i=0; i<count; i++)
+            {
+                const char *name, *value;
+                if (blkid_probe_get_value(pr, i, &name, &value, NULL) == 0)
+                    tags.insert(name, value);
+            }
+
+            /* Names used in specs for GPT partition entries */
+            if (tags.contains("PART_ENTRY_UUID"))
+                tags.insert("PARTUUID", tags.value("PART_ENTRY_UUID"));
+            if (tags.contains("PART_ENTRY_NAME"))
+                tags.insert("PARTLABEL", tags.value("PART_ENTRY_NAME"));
+        }
+    }
+    if (pr)
+        blkid_free_probe(pr);
+    ::close(fd);
+
+    return tags;
+}
+
+QByteArray DeviceIndex::find(const QByteArray &spec)
+{
+    QByteArray name = "UUID", value = spec;
+    int eq = spec.indexOf('=');
+    if (eq != -1)
+    {
+        name  = spec.left(eq);
+        value = spec.mid(eq+1);
+    }
+    /* Accept quoted values, as used in fstab */
+    if (value.startsWith('"') && value.endsWith('"') && value.size() > 1)
+        value = value.mid(1, value.size()-2);
+
+    QMutexLocker lock(&_mutex);
+    if (!_built)
+        build();
+
+    for (QMap<QByteArray, Tags>::const_iterator iter = _devices.constBegin(); iter != _devices.constEnd(); iter++)
+    {
+        if (iter.value().value(name) == value)
+            return iter.key();
+    }
+
+    return QByteArray();
+}
+
+QByteArray DeviceIndex::tag(const QByteArray &device, const QByteArray &name)
+{
+    QMutexLocker lock(&_mutex);
+    if (!_built)
+        build();
+
+    return _devices.value(device).value(name);
+}
+
+void DeviceIndex::refresh(const QByteArray &device)
+{
+    Tags tags = probe(device);
+
+    QMutexLocker lock(&_mutex);
+    _devices.insert(device, tags);
+}
+
+void DeviceIndex::onDeviceAdded(const QString &name)
+{
+    /* Nothing to update if nobody asked yet */
+    QMutexLocker lock(&_mutex);
+    if (!_built)
+        return;
+    lock.unlock();
+
+    refresh(name.toLatin1());
+}
+
+void DeviceIndex::onDeviceRemoved(const QString &name)
+{
+    QMutexLocker lock(&_mutex);
+    _devices.remove(name.toLatin1());
+}
@@ -0,0 +1,80 @@
+#ifndef DEVICEINDEX_H
+#define DEVICEINDEX_H
+
+/* Berryboot -- block device index
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QObject>
+#include <QMap>
+#include <QByteArray>
+#include <QMutex>
+
+class DeviceMonitor;
+
+/*
+ * In-memory index of the file system tags (UUID, LABEL, TYPE, PARTUUID) of all block devices
+ *
+ * Built from sysfs and superblock probing on first use, and kept up-to-date
+ * with the add/change/remove uevents reported by the DeviceMonitor.
+ * Lookups are thread-safe.
+ */
+class DeviceIndex : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DeviceIndex(DeviceMonitor *monitor, QObject *parent = 0);
+
+    /*
+     * Name of the device (e.g. sda1) matching "UUID=x", "LABEL=x", "PARTUUID=x", etc.
+     * A spec without '=' is taken as UUID. Returns empty string if no device matches
+     */
+    QByteArray find(const QByteArray &spec);
+    /*
+     * Tag value of device (e.g. sda1)
+     */
+    QByteArray tag(const QByteArray &device, const QByteArray &name);
+    /*
+     * Probe device again, e.g. after a file system has been created on it
+     */
+    void refresh(const QByteArray &device);
+
+protected:
+    typedef QMap<QByteArray, QByteArray> Tags;
+
+    QMutex _mutex;
+    QMap<QByteArray, Tags> _devices;
+    bool _built;
+
+    /* Must be called with mutex held */
+    void build();
+    static Tags probe(const QByteArray &device);
+
+protected slots:
+    void onDeviceAdded(const QString &name);
+    void onDeviceRemoved(const QString &name);
+};
+
+#endif // DEVICEINDEX_H
@@ -0,0 +1,177 @@
+/* Berryboot -- kernel device and network event listener
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "devicemonitor.h"
+#include "firmwareloader.h"
+#include <QSocketNotifier>
+#include <QEventLoop>
+#include <QTimer>
+#include <QList>
+#include <QByteArray>
+#include <QDebug>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/* Kernel broadcasts uevents to multicast group 1 (udev uses group 2 for its own) */
+#define UEVENT_GROUP_KERNEL  1
+
+DeviceMonitor::DeviceMonitor(QObject *parent) :
+    QObject(parent), _ueventFd(-1), _rtnlFd(-1), _ueventNotifier(NULL), _rtnlNotifier(NULL), _firmwareLoader(NULL)
+{
+    struct sockaddr_nl addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = UEVENT_GROUP_KERNEL;
+    _ueventFd = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (_ueventFd == -1 || ::bind(_ueventFd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        qDebug() << "Error opening uevent socket";
+    }
+    else
+    {
+        _ueventNotifier = new QSocketNotifier(_ueventFd, QSocketNotifier::Read, this);
+        connect(_ueventNotifier, SIGNAL(activated(int)), this, SLOT(readUevent()));
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+    _rtnlFd = ::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (_rtnlFd == -1 || ::bind(_rtnlFd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        qDebug() << "Error opening rtnetlink socket";
+    }
+    else
+    {
+        _rtnlNotifier = new QSocketNotifier(_rtnlFd, QSocketNotifier::Read, this);
+        connect(_rtnlNotifier, SIGNAL(activated(int)), this, SLOT(readRtnetlink()));
+    }
+}
+
+DeviceMonitor::~DeviceMonitor()
+{
+    if (_ueventFd != -1)
+        ::close(_ueventFd);
+    if (_rtnlFd != -1)
+        ::close(_rtnlFd);
+}
+
+void DeviceMonitor::waitFor(const char *signal, int timeout)
+{
+    QEventLoop loop;
+
+    connect(this, signal, &loop, SLOT(quit()));
+    QTimer::singleShot(timeout, &loop, SLOT(quit()));
+    loop.exec();
+}
+
+void DeviceMonitor::startFirmwareLoader()
+{
+    if (!_firmwareLoader)
+    {
+        _firmwareLoader = new FirmwareLoader(this);
+        _firmwareLoader->start();
+    }
+}
+
+void DeviceMonitor::readUevent()
+{
+    char buf[4096];
+    ssize_t len = ::recv(_ueventFd, buf, sizeof(buf)-1, 0);
+
+    if (len <= 0)
+        return;
+    buf[len] = 0;
+
+    /* Message is "action@devpath", followed by KEY=value pairs, all null terminated */
+    QByteArray action, subsystem, devname;
+    for (ssize_t pos = strlen(buf)+1; pos < len; pos += strlen(buf+pos)+1)
+    {
+        QByteArray var(buf+pos);
+
+        if (var.startsWith("ACTION="))
+            action = var.mid(7);
+        else if (var.startsWith("SUBSYSTEM="))
+            subsystem = var.mid(10);
+        else if (var.startsWith("DEVNAME="))
+            devname = var.mid(8);
+    }
+
+    if (subsystem != "block" || devname.isEmpty())
+        return;
+
+    if (action == "add")
+        emit blockDeviceAdded(devname);
+    else if (action == "remove")
+        emit blockDeviceRemoved(devname);
+    else if (action == "change")
+        emit blockDeviceChanged(devname);
+}
+
+void DeviceMonitor::readRtnetlink()
+{
+    char buf[8192];
+    ssize_t len = ::recv(_rtnlFd, buf, sizeof(buf), 0);
+
+    if (len <= 0)
+        return;
+
+    for (struct nlmsghdr *nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, (size_t) len); nh = NLMSG_NEXT(nh, len))
+    {
+        if (nh->nlmsg_type == RTM_NEWLINK)
+        {
+            struct ifinfomsg *ifi = (struct ifinfomsg *) NLMSG_DATA(nh);
+            char iface[IF_NAMESIZE];
+
+            if (if_indextoname(ifi->ifi_index, iface))
+                emit linkChanged(iface);
+        }
+        else if (nh->nlmsg_type == RTM_NEWADDR)
+        {
+            struct ifaddrmsg *ifa = (struct ifaddrmsg *) NLMSG_DATA(nh);
+            int attrlen = IFA_PAYLOAD(nh);
+            char iface[IF_NAMESIZE], address[INET_ADDRSTRLEN];
+
+            if (ifa->ifa_family != AF_INET || !if_indextoname(ifa->ifa_index, iface))
+                continue;
+
+            for (struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, attrlen); rta = RTA_NEXT(rta, attrlen))
+            {
+                if (rta->rta_type == IFA_LOCAL && inet_ntop(AF_INET, RTA_DATA(rta), address, sizeof(address)))
+                {
+                    emit addressAdded(iface, address);
+                    break;
+                }
+            }
+        }
+    }
+}
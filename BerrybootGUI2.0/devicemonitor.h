@@ -0,0 +1,79 @@
+#ifndef DEVICEMONITOR_H
+#define DEVICEMONITOR_H
+
+/* Berryboot -- kernel device and network event listener
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QObject>
+#include <QString>
+
+class QSocketNotifier;
+class FirmwareLoader;
+
+/*
+ * Listens for kernel uevents (NETLINK_KOBJECT_UEVENT) and rtnetlink messages,
+ * so callers can react to devices and network changes instead of polling sysfs
+ */
+class DeviceMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DeviceMonitor(QObject *parent = 0);
+    virtual ~DeviceMonitor();
+
+    /*
+     * Run event loop until signal is emitted or timeout expires, e.g.
+     * waitFor(SIGNAL(blockDeviceAdded(QString)), 1000)
+     * When called from a worker thread, runs an event loop in that thread
+     */
+    void waitFor(const char *signal, int timeout);
+    /*
+     * Answer firmware requests of drivers ourselves, for when udevd is not running
+     */
+    void startFirmwareLoader();
+
+signals:
+    /* Disk or partition, e.g. sda1. The /dev node exists when this is emitted */
+    void blockDeviceAdded(const QString &name);
+    void blockDeviceRemoved(const QString &name);
+    /* Media or partition table of a block device changed */
+    void blockDeviceChanged(const QString &name);
+    /* Network interface appeared, or its flags (up, carrier) changed */
+    void linkChanged(const QString &iface);
+    /* IPv4 address assigned to interface */
+    void addressAdded(const QString &iface, const QString &address);
+
+protected:
+    int _ueventFd, _rtnlFd;
+    QSocketNotifier *_ueventNotifier, *_rtnlNotifier;
+    FirmwareLoader *_firmwareLoader;
+
+protected slots:
+    void readUevent();
+    void readRtnetlink();
+};
+
+#endif // DEVICEMONITOR_H
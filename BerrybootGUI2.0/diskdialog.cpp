@@ -28,12 +28,18 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "installer.h"
 #include "syncthread.h"
 #include "driveformatthread.h"
+#include "diskrestorethread.h"
+#include "benchmarkthread.h"
 #include "iscsidialog.h"
+#include "devicemonitor.h"
+#include "mountmanager.h"
 #include <QDir>
+#include <QFileDialog>
 #include <QIcon>
 #include <QProgressDialog>
 #include <QMessageBox>
 #include <QSettings>
+#include <QRegExp>
 #include <unistd.h>
 
 DiskDialog::DiskDialog(Installer *i, QWidget *parent) :
@@ -44,17 +50,18 @@ DiskDialog::DiskDialog(Installer *i, QWidget *parent) :
 {
     setWindowFlags(Qt::Window | Qt::CustomizeWindowHint | Qt::WindowTitleHint);
     ui->setupUi(this);
-    connect(&_pollDisksTimer,SIGNAL(timeout()), this, SLOT(pollForNewDisks()));
     connect(i, SIGNAL(error(QString)), this, SLOT(onError(QString)));
 
     QString defaultFS = _i->settings()->value("berryboot/defaultfs").toString();
     if (defaultFS == "btrfs")
         ui->filesystemCombo->setCurrentIndex(3);
+    else if (defaultFS == "f2fs")
+        ui->filesystemCombo->setCurrentIndex(4);
     else if (defaultFS == "ext4_nolazy")
         ui->filesystemCombo->setCurrentIndex(2);
 
-    /* Check every second if the user attached a USB disk */
-    _pollDisksTimer.start(1000);
+    /* Refresh the list if the user attaches a USB disk */
+    watchForNewDisks(true);
     QTimer::singleShot(1, this, SLOT(populateDrivelist()) );
 }
 
@@ -115,7 +122,7 @@ void DiskDialog::populateDrivelist()
 
                 if (_i->settings()->value("berryboot/preloaded").toBool() && hasExistingBerryboot(devname))
                 {
-                    ui->filesystemCombo->setCurrentIndex(4);
+                    ui->filesystemCombo->setCurrentIndex(5);
                     on_formatButton_clicked();
                 }
             }
@@ -130,6 +137,19 @@ void DiskDialog::populateDrivelist()
     _devlistcount = list.count();
 }
 
+void DiskDialog::watchForNewDisks(bool enable)
+{
+    if (enable)
+    {
+        connect(_i->deviceMonitor(), SIGNAL(blockDeviceAdded(QString)), this, SLOT(pollForNewDisks()), Qt::UniqueConnection);
+        connect(_i->deviceMonitor(), SIGNAL(blockDeviceRemoved(QString)), this, SLOT(pollForNewDisks()), Qt::UniqueConnection);
+    }
+    else
+    {
+        disconnect(_i->deviceMonitor(), 0, this, SLOT(pollForNewDisks()));
+    }
+}
+
 void DiskDialog::pollForNewDisks()
 {
     QDir dir("/sys/class/block");
@@ -140,7 +160,7 @@ void DiskDialog::pollForNewDisks()
 void DiskDialog::on_formatButton_clicked()
 {
     setEnabled(false);
-    _pollDisksTimer.stop();
+    watchForNewDisks(false);
     QString drive = ui->driveList->currentItem()->data(Qt::UserRole).toString();
     QString fs;
 
@@ -150,7 +170,7 @@ void DiskDialog::on_formatButton_clicked()
         if (id.exec() != id.Accepted)
         {
             setEnabled(true);
-            _pollDisksTimer.start(1000);
+            watchForNewDisks(true);
             return;
         }
     }
@@ -167,12 +187,15 @@ void DiskDialog::on_formatButton_clicked()
         fs = "btrfs";
         break;
     case 4:
+        fs = "f2fs";
+        break;
+    case 5:
         fs = "existing";
         if ( !hasExistingBerryboot(ui->driveList->currentItem()->data(Qt::UserRole).toString()) )
         {
             QMessageBox::critical(this, tr("Error"), tr("No existing Berryboot installation found on this drive"), QMessageBox::Close);
             setEnabled(true);
-            _pollDisksTimer.start(1000);
+            watchForNewDisks(true);
             return;
         }
         break;
@@ -226,7 +249,178 @@ void DiskDialog::onError(const QString &errormsg)
         _qpd->hide();
     QMessageBox::critical(this, tr("Error"), errormsg, QMessageBox::Close);
     setEnabled(true);
-    _pollDisksTimer.start(1000);
+    watchForNewDisks(true);
+}
+
+void DiskDialog::on_restoreButton_clicked()
+{
+    QString drive = ui->driveList->currentItem()->data(Qt::UserRole).toString();
+
+    if (drive == "iscsi")
+    {
+        QMessageBox::critical(this, tr("Error"), tr("Restoring disk images to networked storage is not supported"), QMessageBox::Close);
+        return;
+    }
+
+    watchForNewDisks(false);
+    if (!mountMedia(drive))
+    {
+        QMessageBox::information(this, tr("No media found"), tr("Insert a USB stick or other external medium first, and try again."), QMessageBox::Close);
+        watchForNewDisks(true);
+        return;
+    }
+
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Select disk image"), "/media", tr("Compressed disk images (*.img.gz)"));
+    if (fileName.isEmpty()
+            || QMessageBox::question(this, tr("Confirm"), tr("Are you sure you want to restore the disk image to '%1'? WARNING: this will overwrite all existing files.").arg(drive), QMessageBox::Yes, QMessageBox::No) != QMessageBox::Yes)
+    {
+        umountMedia();
+        watchForNewDisks(true);
+        return;
+    }
+
+    setEnabled(false);
+    _qpd = new QProgressDialog( tr("Preparing disk image restore"), QString(), 0, 100, this);
+    _qpd->show();
+
+    DiskRestoreThread *drt = new DiskRestoreThread(fileName, drive, _i, this);
+    connect(drt, SIGNAL(statusUpdate(QString)), _qpd, SLOT(setLabelText(QString)));
+    connect(drt, SIGNAL(progress(int)), _qpd, SLOT(setValue(int)));
+    connect(drt, SIGNAL(error(QString)), this, SLOT(onError(QString)));
+    connect(drt, SIGNAL(completed()), this, SLOT(onRestoreComplete()));
+    connect(drt, SIGNAL(finished()), this, SLOT(umountMedia()));
+    connect(drt, SIGNAL(finished()), drt, SLOT(deleteLater()));
+    drt->start();
+}
+
+void DiskDialog::onRestoreComplete()
+{
+    DiskRestoreThread *drt = qobject_cast<DiskRestoreThread *>(sender());
+
+    _qpd->hide();
+    _usbboot = _i->supportsUSBboot() && !drt->drive().startsWith("mmcblk");
+    accept();
+}
+
+void DiskDialog::on_benchmarkButton_clicked()
+{
+    QString drive = ui->driveList->currentItem()->data(Qt::UserRole).toString();
+
+    if (drive == "iscsi")
+    {
+        QMessageBox::critical(this, tr("Error"), tr("Testing networked storage is not supported"), QMessageBox::Close);
+        return;
+    }
+    if (QMessageBox::question(this, tr("Confirm"), tr("Testing overwrites existing files on '%1'. Continue?").arg(drive), QMessageBox::Yes, QMessageBox::No) != QMessageBox::Yes)
+        return;
+
+    setEnabled(false);
+    watchForNewDisks(false);
+    _qpd = new QProgressDialog( tr("Testing drive"), QString(), 0, 0, this);
+    _qpd->show();
+
+    BenchmarkThread *bt = new BenchmarkThread(drive, this);
+    connect(bt, SIGNAL(statusUpdate(QString)), _qpd, SLOT(setLabelText(QString)));
+    connect(bt, SIGNAL(error(QString)), this, SLOT(onError(QString)));
+    connect(bt, SIGNAL(completed()), this, SLOT(onBenchmarkComplete()));
+    connect(bt, SIGNAL(finished()), bt, SLOT(deleteLater()));
+    bt->start();
+}
+
+void DiskDialog::onBenchmarkComplete()
+{
+    BenchmarkThread *bt = qobject_cast<BenchmarkThread *>(sender());
+    QString drive = bt->drive();
+    QString fs = bt->recommendedFilesystem();
+
+    _qpd->hide();
+    setEnabled(true);
+    watchForNewDisks(true);
+
+    /* Keep results with the card, so card quality can be tracked. One group per card, identified by
+       the CID of SD cards, or the serial number and model of other drives */
+    QString model  = get_file_contents("/sys/class/block/"+drive+"/device/name").trimmed()+get_file_contents("/sys/class/block/"+drive+"/device/model").trimmed();
+    QString serial = get_file_contents("/sys/class/block/"+drive+"/device/serial").trimmed();
+    QString id     = get_file_contents("/sys/class/block/"+drive+"/device/cid").trimmed();
+    if (id.isEmpty())
+        id = model+serial;
+    if (id.isEmpty())
+        id = drive;
+    id.replace(QRegExp("[^A-Za-z0-9]"), "");
+
+    QSettings *s = _i->settings();
+    s->beginGroup("benchmark_"+id);
+    s->setValue("drive", drive);
+    s->setValue("model", model);
+    s->setValue("serial", serial);
+    s->setValue("capacity", bt->reportedCapacity());
+    s->setValue("verifiedcapacity", bt->verifiedCapacity());
+    s->setValue("seqread", QString::number(bt->sequentialRead(), 'f', 1));
+    s->setValue("seqwrite", QString::number(bt->sequentialWrite(), 'f', 1));
+    s->setValue("randwriteiops", QString::number(bt->randomWriteIops(), 'f', 0));
+    s->setValue("avglatency", QString::number(bt->averageLatency(), 'f', 1));
+    s->setValue("maxlatency", QString::number(bt->maxLatency(), 'f', 1));
+    s->setValue("recommendedfs", fs);
+    s->endGroup();
+    s->sync();
+
+    if (bt->fakeCapacity())
+    {
+        QMessageBox::critical(this, tr("Fake capacity"),
+                              tr("Drive claims to be %1 MB, but data written beyond %2 MB is lost. The drive is counterfeit or broken, do not use it.")
+                              .arg(QString::number(bt->reportedCapacity()/1024/1024), QString::number(bt->verifiedCapacity()/1024/1024)), QMessageBox::Close);
+        return;
+    }
+
+    if (fs == "btrfs")
+        ui->filesystemCombo->setCurrentIndex(3);
+    else if (fs == "ext4 nolazy")
+        ui->filesystemCombo->setCurrentIndex(2);
+    else
+        ui->filesystemCombo->setCurrentIndex(0);
+
+    QMessageBox::information(this, tr("Test results"),
+                             tr("Sequential read: %1 MB/sec\nSequential write: %2 MB/sec\nRandom 4K writes: %3 IOPS (latency %4 ms average, %5 ms max)\n\nRecommended file system: %6")
+                             .arg(QString::number(bt->sequentialRead(), 'f', 1), QString::number(bt->sequentialWrite(), 'f', 1), QString::number(bt->randomWriteIops(), 'f', 0))
+                             .arg(QString::number(bt->averageLatency(), 'f', 1), QString::number(bt->maxLatency(), 'f', 1), ui->filesystemCombo->currentText()), QMessageBox::Close);
+}
+
+bool DiskDialog::mountMedia(const QString &excludeDrive)
+{
+    QDir dir("/sys/class/block");
+    QStringList list = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    /* The drive itself and its partitions, e.g. sda1 or mmcblk1p1, but not sdaa */
+    QRegExp excludeRx(QRegExp::escape(excludeDrive)+"(p?[0-9]+)?");
+
+    if (!dir.exists("/media"))
+        dir.mkdir("/media");
+
+    foreach (QString devname, list)
+    {
+        if (excludeRx.exactMatch(devname) || devname.startsWith("mmcblk0") || QFile::symLinkTarget("/sys/class/block/"+devname).contains("/devices/virtual/"))
+            continue;
+
+        QString mntdir = "/media/"+devname;
+        dir.mkdir(mntdir);
+        if (MountManager::mount("/dev/"+devname.toLatin1(), mntdir.toLatin1(), QByteArray(), "ro"))
+            _medialist.append(devname);
+        else
+            dir.rmdir(mntdir);
+    }
+
+    return !_medialist.isEmpty();
+}
+
+void DiskDialog::umountMedia()
+{
+    QDir dir;
+
+    foreach (QString devname, _medialist)
+    {
+        MountManager::umount("/media/"+devname.toLatin1());
+        dir.rmdir("/media/"+devname);
+    }
+    _medialist.clear();
 }
 
 void DiskDialog::on_driveList_currentRowChanged(int currentRow)
@@ -236,9 +430,9 @@ void DiskDialog::on_driveList_currentRowChanged(int currentRow)
 
     if ( hasExistingBerryboot(ui->driveList->currentItem()->data(Qt::UserRole).toString()) )
     {
-        ui->filesystemCombo->setCurrentIndex(4);
+        ui->filesystemCombo->setCurrentIndex(5);
     }
-    else if (ui->filesystemCombo->currentIndex() == 4)
+    else if (ui->filesystemCombo->currentIndex() == 5)
     {
         ui->filesystemCombo->setCurrentIndex(0);
     }
@@ -271,7 +465,7 @@ bool DiskDialog::hasExistingBerryboot(const QString &drive)
 
 void DiskDialog::on_filesystemCombo_currentIndexChanged(const QString &)
 {
-    if (ui->filesystemCombo->currentIndex() == 4)
+    if (ui->filesystemCombo->currentIndex() == 5)
     {
         /* Using existing files */
         ui->luksCheck->setEnabled(false);
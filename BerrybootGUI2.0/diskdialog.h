@@ -29,6 +29,7 @@
 
 #include <QDialog>
 #include <QTimer>
+#include <QStringList>
 
 namespace Ui {
 class DiskDialog;
@@ -48,16 +49,26 @@ public:
 protected:
     Ui::DiskDialog *ui;
     int _devlistcount;
-    QTimer _pollDisksTimer;
     QProgressDialog *_qpd;
     Installer *_i;
     bool _usbboot;
+    QStringList _medialist;
 
     /*
      * Test if drive has an existing Berryboot installation
      */
     bool hasExistingBerryboot(const QString &drive);
 
+    /*
+     * Mount external media read-only under /media, skipping the drive we are about to overwrite
+     */
+    bool mountMedia(const QString &excludeDrive);
+
+    /*
+     * Refresh drive list when disks are attached or removed
+     */
+    void watchForNewDisks(bool enable);
+
 protected slots:
     /*
      * Populate GUI widget with available drives
@@ -78,11 +89,34 @@ protected slots:
      */
     void onError(const QString &error);
 
+    /*
+     * Called when restoring a disk image is complete
+     */
+    void onRestoreComplete();
+
+    /*
+     * Unmount media mounted by mountMedia()
+     */
+    void umountMedia();
+
+    /*
+     * Called when testing the drive is complete
+     */
+    void onBenchmarkComplete();
+
 private slots:
     /*
      * Called when "format" button has been clicked by user
      */
     void on_formatButton_clicked();
+    /*
+     * Called when "restore disk image" button has been clicked by user
+     */
+    void on_restoreButton_clicked();
+    /*
+     * Called when "test drive" button has been clicked by user
+     */
+    void on_benchmarkButton_clicked();
     void on_driveList_currentRowChanged(int currentRow);
     void on_filesystemCombo_currentIndexChanged(const QString &arg1);
 };
@@ -0,0 +1,803 @@
+/* Berryboot -- thread writing a sparse compressed image of a drive
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "diskimagethread.h"
+#include "mountmanager.h"
+#include <QFile>
+#include <QDir>
+#include <QProcess>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QtEndian>
+#include <blkid/blkid.h>
+#include <openssl/sha.h>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/btrfs.h>
+#include <linux/btrfs_tree.h>
+
+/* Size of the independently compressed gzip members */
+#define CHUNK_SIZE  (4 * 1024 * 1024)
+
+/* ext4 superblock and group descriptor fields */
+#define EXT4_SUPER_MAGIC                0xEF53
+#define EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+#define EXT4_FEATURE_RO_COMPAT_GDT_CSUM 0x0010
+#define EXT4_FEATURE_RO_COMPAT_BIGALLOC 0x0200
+#define EXT4_FEATURE_RO_COMPAT_METADATA_CSUM 0x0400
+#define EXT4_FEATURE_INCOMPAT_META_BG   0x0010
+#define EXT4_FEATURE_INCOMPAT_64BIT     0x0080
+#define EXT4_BG_BLOCK_UNINIT            0x0002
+
+/* btrfs primary superblock location, mirrors are at 64 MB and 256 GB */
+#define BTRFS_SUPERBLOCK_OFFSET         0x10000
+#define BTRFS_SUPERBLOCK_SIZE           4096
+
+inline QByteArray get_file_contents(const QString &filename)
+{
+    QByteArray r;
+
+    QFile f(filename);
+    f.open(f.ReadOnly);
+    r = f.readAll();
+    f.close();
+
+    return r;
+}
+
+static inline quint16 le16(const char *p)
+{
+    return qFromLittleEndian<quint16>((const uchar *) p);
+}
+
+static inline quint32 le32(const char *p)
+{
+    return qFromLittleEndian<quint32>((const uchar *) p);
+}
+
+static inline quint64 le64(const char *p)
+{
+    return qFromLittleEndian<quint64>((const uchar *) p);
+}
+
+/*
+ * Compresses a chunk of the image into a self-contained gzip member
+ * Members are written in order, and concatenated form a valid gzip file
+ */
+class GzipChunk : public QRunnable
+{
+public:
+    GzipChunk(const QByteArray &data) : _in(data)
+    {
+        setAutoDelete(false);
+    }
+
+    /* Chunk that has already been compressed */
+    static GzipChunk *precompressed(const QByteArray &data)
+    {
+        GzipChunk *c = new GzipChunk(QByteArray());
+        c->_out = data;
+        c->_done.release();
+        return c;
+    }
+
+    static QByteArray compress(const QByteArray &in)
+    {
+        QByteArray out;
+        z_stream s;
+        memset(&s, 0, sizeof(s));
+
+        /* Favour speed, the Pi's CPU is the bottleneck rather than the USB stick */
+        if (deflateInit2(&s, Z_BEST_SPEED, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return out;
+
+        out.resize(deflateBound(&s, in.size()));
+        s.next_in   = (Bytef *) in.constData();
+        s.avail_in  = in.size();
+        s.next_out  = (Bytef *) out.data();
+        s.avail_out = out.size();
+
+        if (deflate(&s, Z_FINISH) == Z_STREAM_END)
+            out.resize(s.total_out);
+        else
+            out.clear();
+        deflateEnd(&s);
+
+        return out;
+    }
+
+    virtual void run()
+    {
+        _out = compress(_in);
+        _in.clear();
+        _done.release();
+    }
+
+    /* Blocks until compression is finished */
+    QByteArray result()
+    {
+        _done.acquire();
+        _done.release();
+        return _out;
+    }
+
+protected:
+    QByteArray _in, _out;
+    QSemaphore _done;
+};
+
+/*
+ * Iterates over the items of a btrfs tree using the tree search ioctl
+ */
+class BtrfsTreeSearch
+{
+public:
+    BtrfsTreeSearch(int fd, quint64 treeId) : _fd(fd), _count(0), _item(0), _offset(0), _finished(false), _failed(false)
+    {
+        memset(&_args, 0, sizeof(_args));
+        _args.key.tree_id      = treeId;
+        _args.key.max_objectid = (quint64) -1;
+        _args.key.max_offset   = (quint64) -1;
+        _args.key.max_transid  = (quint64) -1;
+        _args.key.max_type     = 255;
+    }
+
+    bool next(struct btrfs_ioctl_search_header &hdr, const char *&data)
+    {
+        if (_item == _count)
+        {
+            if (_finished)
+                return false;
+
+            if (_count)
+            {
+                /* Continue after the last key returned */
+                _args.key.min_objectid = _last.objectid;
+                _args.key.min_type     = _last.type;
+                _args.key.min_offset   = _last.offset;
+                if (_args.key.min_offset < (quint64) -1)
+                {
+                    _args.key.min_offset++;
+                }
+                else if (_args.key.min_type < 255)
+                {
+                    _args.key.min_type++;
+                    _args.key.min_offset = 0;
+                }
+                else
+                {
+                    _args.key.min_objectid++;
+                    _args.key.min_type = 0;
+                    _args.key.min_offset = 0;
+                }
+            }
+
+            _args.key.nr_items = 4096;
+            if (ioctl(_fd, BTRFS_IOC_TREE_SEARCH, &_args) < 0)
+            {
+                _failed = _finished = true;
+                return false;
+            }
+            if (_args.key.nr_items == 0)
+            {
+                _finished = true;
+                return false;
+            }
+            _count  = _args.key.nr_items;
+            _item   = 0;
+            _offset = 0;
+        }
+
+        memcpy(&hdr, _args.buf+_offset, sizeof(hdr));
+        _offset += sizeof(hdr);
+        data     = _args.buf+_offset;
+        _offset += hdr.len;
+        _item++;
+        _last = hdr;
+
+        return true;
+    }
+
+    bool failed() const
+    {
+        return _failed;
+    }
+
+protected:
+    int _fd;
+    struct btrfs_ioctl_search_args _args;
+    struct btrfs_ioctl_search_header _last;
+    quint32 _count, _item, _offset;
+    bool _finished, _failed;
+};
+
+struct BtrfsChunk
+{
+    quint64 length;
+    QList<quint64> stripes;
+};
+
+/* Returns where a device is mounted, or an empty string if it is not */
+static QString mountpointOf(const QString &device)
+{
+    QList<QByteArray> lines = get_file_contents("/proc/mounts").split('\n');
+    QByteArray devpath = "/dev/"+device.toLatin1();
+
+    foreach (QByteArray line, lines)
+    {
+        QList<QByteArray> fields = line.split(' ');
+        if (fields.count() > 1 && fields[0] == devpath)
+            return fields[1];
+    }
+
+    return QString();
+}
+
+/* Groups 0, 1 and powers of 3, 5 and 7 hold a superblock backup if sparse_super is set */
+static bool hasSuperblockBackup(quint64 group, bool sparse)
+{
+    if (!sparse || group <= 1)
+        return true;
+
+    for (quint64 base = 3; base <= 7; base += 2)
+    {
+        quint64 n = base;
+        while (n < group)
+            n *= base;
+        if (n == group)
+            return true;
+    }
+
+    return false;
+}
+
+DiskImageThread::DiskImageThread(const QString &drive, const QString &imagefile, QObject *parent) :
+    QThread(parent), _drive(drive), _imagefile(imagefile), _imageSize(0), _dev(NULL)
+{
+}
+
+QString DiskImageThread::bmapFilename(const QString &imagefile)
+{
+    QString bmap = imagefile;
+
+    if (bmap.endsWith(".gz"))
+        bmap.chop(3);
+
+    return bmap+".bmap";
+}
+
+void DiskImageThread::run()
+{
+    bool ok = false;
+
+    emit statusUpdate(tr("Remounting file systems read-only"));
+    sync();
+    /* Boot partition may not be mounted, ignore errors */
+    MountManager::remount("/boot", "ro");
+    if (!MountManager::remount("/mnt", "ro"))
+    {
+        MountManager::remount("/boot", "rw");
+        emit error(tr("Error remounting data partition read-only"));
+        return;
+    }
+
+    QFile dev("/dev/"+_drive);
+    if (dev.open(dev.ReadOnly))
+    {
+        _dev = &dev;
+
+        emit statusUpdate(tr("Reading file system allocation maps"));
+        if (mapDrive())
+        {
+            quint64 mapped = 0;
+            for (int i=0; i<_blocks.count(); i++)
+                mapped += _blocks[i].second - _blocks[i].first + 1;
+
+            emit statusUpdate(tr("Writing disk image (%1 MB of %2 MB in use)").arg(
+                                  QString::number(mapped * BlockSize / 1024 / 1024), QString::number(_imageSize / 1024 / 1024)));
+            ok = writeImage() && writeBmap();
+        }
+        dev.close();
+        _dev = NULL;
+    }
+    else
+    {
+        emit error(tr("Error opening drive '%1'").arg(_drive));
+    }
+
+    MountManager::remount("/mnt", "rw");
+    MountManager::remount("/boot", "rw");
+
+    if (ok)
+        emit completed();
+}
+
+bool DiskImageThread::readAt(quint64 pos, char *buf, qint64 len)
+{
+    if (!_dev->seek(pos))
+        return false;
+
+    while (len > 0)
+    {
+        qint64 r = _dev->read(buf, len);
+        if (r <= 0)
+            return false;
+        buf += r;
+        len -= r;
+    }
+
+    return true;
+}
+
+bool DiskImageThread::mapDrive()
+{
+    QDir dir("/sys/class/block/"+_drive);
+    QStringList partitions = dir.entryList(QStringList(_drive+"*"), QDir::Dirs | QDir::NoDotAndDotDot);
+    quint64 firstPartition = (quint64) -1;
+
+    _ranges.clear();
+    _imageSize = 0;
+
+    foreach (QString part, partitions)
+    {
+        quint64 start = get_file_contents(dir.absoluteFilePath(part+"/start")).trimmed().toULongLong() * 512;
+        quint64 size  = get_file_contents(dir.absoluteFilePath(part+"/size")).trimmed().toULongLong() * 512;
+
+        if (!size)
+            continue;
+
+        firstPartition = qMin(firstPartition, start);
+        _imageSize     = qMax(_imageSize, start+size);
+    }
+
+    if (!_imageSize)
+    {
+        emit error(tr("No partitions found on drive '%1'").arg(_drive));
+        return false;
+    }
+
+    /* Partition table, and u-boot SPL on A10 devices */
+    addRange(0, firstPartition);
+
+    foreach (QString part, partitions)
+    {
+        quint64 start = get_file_contents(dir.absoluteFilePath(part+"/start")).trimmed().toULongLong() * 512;
+        quint64 size  = get_file_contents(dir.absoluteFilePath(part+"/size")).trimmed().toULongLong() * 512;
+        QByteArray type;
+        bool mapped = false;
+
+        if (!size)
+            continue;
+
+        char *cstr = blkid_get_tag_value(NULL, "TYPE", QString("/dev/"+part).toLatin1().constData());
+        if (cstr)
+        {
+            type = cstr;
+            free(cstr);
+        }
+
+        if (type.startsWith("ext"))
+            mapped = mapExt4(start, size);
+        else if (type == "btrfs")
+            mapped = mapBtrfs(start, size, mountpointOf(part));
+
+        /* FAT, LUKS or something we do not understand. Include it entirely */
+        if (!mapped)
+            addRange(start, size);
+    }
+
+    mergeRanges();
+
+    return true;
+}
+
+void DiskImageThread::addRange(quint64 start, quint64 len)
+{
+    if (!len)
+        return;
+
+    QMap<quint64,quint64>::iterator it = _ranges.find(start);
+    if (it != _ranges.end())
+        it.value() = qMax(it.value(), start+len);
+    else
+        _ranges.insert(start, start+len);
+}
+
+void DiskImageThread::mergeRanges()
+{
+    quint64 lastBlock = (_imageSize + BlockSize - 1) / BlockSize - 1;
+    quint64 first = 0, last = 0;
+    bool haveRange = false;
+
+    _blocks.clear();
+
+    for (QMap<quint64,quint64>::const_iterator it = _ranges.constBegin(); it != _ranges.constEnd(); ++it)
+    {
+        quint64 b1 = it.key() / BlockSize;
+        quint64 b2 = qMin((it.value() + BlockSize - 1) / BlockSize - 1, lastBlock);
+
+        if (b1 > lastBlock)
+            break;
+
+        if (haveRange && b1 <= last+1)
+        {
+            last = qMax(last, b2);
+        }
+        else
+        {
+            if (haveRange)
+                _blocks.append(qMakePair(first, last));
+            first = b1;
+            last  = b2;
+            haveRange = true;
+        }
+    }
+    if (haveRange)
+        _blocks.append(qMakePair(first, last));
+
+    _ranges.clear();
+}
+
+bool DiskImageThread::mapExt4(quint64 offset, quint64 size)
+{
+    QByteArray sb(1024, 0);
+
+    if (!readAt(offset+1024, sb.data(), sb.size()))
+        return false;
+
+    const char *s = sb.constData();
+    if (le16(s+0x38) != EXT4_SUPER_MAGIC)
+        return false;
+
+    quint32 incompat = le32(s+0x60), rocompat = le32(s+0x64);
+    /* Descriptors spread over meta block groups, and cluster bitmaps are not supported */
+    if (incompat & EXT4_FEATURE_INCOMPAT_META_BG || rocompat & EXT4_FEATURE_RO_COMPAT_BIGALLOC)
+        return false;
+
+    bool is64bit     = incompat & EXT4_FEATURE_INCOMPAT_64BIT;
+    bool sparse      = rocompat & EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER;
+    bool uninit      = rocompat & (EXT4_FEATURE_RO_COMPAT_GDT_CSUM | EXT4_FEATURE_RO_COMPAT_METADATA_CSUM);
+    quint64 bs       = 1024 << le32(s+0x18);
+    quint64 blocks   = le32(s+0x04);
+    quint64 firstDataBlock = le32(s+0x14);
+    quint64 blocksPerGroup = le32(s+0x20);
+    quint64 inodesPerGroup = le32(s+0x28);
+    quint64 inodeSize      = le32(s+0x4C) ? le16(s+0x58) : 128;
+    quint64 descSize       = 32;
+    quint64 reservedGdt    = le16(s+0xCE);
+
+    if (is64bit)
+    {
+        blocks  |= (quint64) le32(s+0x150) << 32;
+        descSize = qMax((quint64) le16(s+0xFE), descSize);
+    }
+    if (!blocksPerGroup || blocks*bs > size)
+        return false;
+
+    quint64 groups        = (blocks - firstDataBlock + blocksPerGroup - 1) / blocksPerGroup;
+    quint64 gdtBlocks     = (groups * descSize + bs - 1) / bs;
+    quint64 itableBlocks  = (inodesPerGroup * inodeSize + bs - 1) / bs;
+    QByteArray gdt(gdtBlocks * bs, 0);
+    QByteArray bitmap(bs, 0);
+
+    if (!readAt(offset + (firstDataBlock+1) * bs, gdt.data(), gdt.size()))
+        return false;
+
+    /* Boot sector and primary superblock are not necessarily covered by the bitmap */
+    addRange(offset, 2048);
+
+    for (quint64 g = 0; g < groups; g++)
+    {
+        const char *d = gdt.constData() + g * descSize;
+        quint64 blockBitmap = le32(d);
+        quint64 inodeBitmap = le32(d+0x04);
+        quint64 inodeTable  = le32(d+0x08);
+        quint16 flags       = le16(d+0x12);
+        quint64 groupStart  = firstDataBlock + g * blocksPerGroup;
+        quint64 groupBlocks = qMin(blocksPerGroup, blocks - groupStart);
+
+        if (is64bit && descSize >= 64)
+        {
+            blockBitmap |= (quint64) le32(d+0x20) << 32;
+            inodeBitmap |= (quint64) le32(d+0x24) << 32;
+            inodeTable  |= (quint64) le32(d+0x28) << 32;
+        }
+
+        /* With flex_bg these may live in another group, so always include them */
+        addRange(offset + blockBitmap * bs, bs);
+        addRange(offset + inodeBitmap * bs, bs);
+        addRange(offset + inodeTable * bs, itableBlocks * bs);
+
+        if (uninit && (flags & EXT4_BG_BLOCK_UNINIT))
+        {
+            /* Bitmap was never initialized, group only holds metadata */
+            if (hasSuperblockBackup(g, sparse))
+                addRange(offset + groupStart * bs, (1 + gdtBlocks + reservedGdt) * bs);
+            continue;
+        }
+
+        if (!readAt(offset + blockBitmap * bs, bitmap.data(), bitmap.size()))
+            return false;
+
+        const uchar *bm = (const uchar *) bitmap.constData();
+        quint64 runStart = 0;
+        bool inRun = false;
+
+        for (quint64 i = 0; i < groupBlocks; i++)
+        {
+            /* Skip whole bytes that do not change state */
+            if ((i & 7) == 0 && i+8 <= groupBlocks && bm[i >> 3] == (inRun ? 0xFF : 0x00))
+            {
+                i += 7;
+                continue;
+            }
+
+            bool used = bm[i >> 3] & (1 << (i & 7));
+            if (used && !inRun)
+            {
+                runStart = i;
+                inRun = true;
+            }
+            else if (!used && inRun)
+            {
+                addRange(offset + (groupStart + runStart) * bs, (i - runStart) * bs);
+                inRun = false;
+            }
+        }
+        if (inRun)
+            addRange(offset + (groupStart + runStart) * bs, (groupBlocks - runStart) * bs);
+    }
+
+    return true;
+}
+
+bool DiskImageThread::mapBtrfs(quint64 offset, quint64 size, const QString &mountpoint)
+{
+    QByteArray sb(4096, 0);
+
+    /* The tree search ioctl needs the file system to be mounted */
+    if (mountpoint.isEmpty() || !readAt(offset+BTRFS_SUPERBLOCK_OFFSET, sb.data(), sb.size()))
+        return false;
+
+    const char *s = sb.constData();
+    if (memcmp(s+0x40, "_BHRfS_M", 8) != 0 || le64(s+0x88) != 1)
+        return false; /* not btrfs, or spanning multiple devices */
+
+    quint64 nodesize = le32(s+0x94);
+    int fd = ::open(QFile::encodeName(mountpoint).constData(), O_RDONLY | O_DIRECTORY);
+    if (fd == -1)
+        return false;
+
+    struct btrfs_ioctl_search_header hdr;
+    const char *data;
+    QMap<quint64, BtrfsChunk> chunks;
+
+    /* Chunk tree translates logical addresses to physical locations on disk */
+    BtrfsTreeSearch chunkSearch(fd, BTRFS_CHUNK_TREE_OBJECTID);
+    while (chunkSearch.next(hdr, data))
+    {
+        if (hdr.type != BTRFS_CHUNK_ITEM_KEY)
+            continue;
+
+        BtrfsChunk chunk;
+        quint16 numStripes = le16(data+offsetof(struct btrfs_chunk, num_stripes));
+        chunk.length = le64(data+offsetof(struct btrfs_chunk, length));
+
+        for (int i=0; i<numStripes; i++)
+        {
+            const char *stripe = data + offsetof(struct btrfs_chunk, stripe) + i * sizeof(struct btrfs_stripe);
+            chunk.stripes.append(le64(stripe+offsetof(struct btrfs_stripe, offset)));
+        }
+        chunks.insert(hdr.offset, chunk);
+    }
+
+    /* Extent tree lists all allocated data and metadata */
+    BtrfsTreeSearch extentSearch(fd, BTRFS_EXTENT_TREE_OBJECTID);
+    while (!chunkSearch.failed() && extentSearch.next(hdr, data))
+    {
+        quint64 logical = hdr.objectid, len;
+
+        if (hdr.type == BTRFS_EXTENT_ITEM_KEY)
+            len = hdr.offset;
+        else if (hdr.type == BTRFS_METADATA_ITEM_KEY)
+            len = nodesize;
+        else
+            continue;
+
+        QMap<quint64, BtrfsChunk>::const_iterator it = chunks.upperBound(logical);
+        if (it == chunks.constBegin())
+            continue;
+        --it;
+        if (logical >= it.key() + it.value().length)
+            continue;
+
+        foreach (quint64 stripe, it.value().stripes)
+            addRange(offset + stripe + (logical - it.key()), len);
+    }
+    ::close(fd);
+
+    if (chunkSearch.failed() || extentSearch.failed() || chunks.isEmpty())
+        return false;
+
+    /* Superblock and its mirrors */
+    for (quint64 pos = BTRFS_SUPERBLOCK_OFFSET; pos + BTRFS_SUPERBLOCK_SIZE <= size && pos <= 0x4000000000ULL; pos = (pos == BTRFS_SUPERBLOCK_OFFSET ? 0x4000000 : pos << 12))
+        addRange(offset + pos, BTRFS_SUPERBLOCK_SIZE);
+
+    return true;
+}
+
+bool DiskImageThread::writeImage()
+{
+    QFile out(_imagefile);
+    if (!out.open(out.WriteOnly))
+    {
+        emit error(tr("Error creating image file '%1'").arg(_imagefile));
+        return false;
+    }
+
+    QThreadPool pool;
+    QList<GzipChunk *> queue;
+    QByteArray zeroMember;
+    SHA256_CTX ctx;
+    unsigned char md[SHA256_DIGEST_LENGTH];
+    int range = 0, lastPercent = -1;
+    int maxQueued = qMax(QThread::idealThreadCount(), 1) * 2;
+    bool ok = true;
+
+    pool.setMaxThreadCount(qMax(QThread::idealThreadCount(), 1));
+    _checksums.clear();
+
+    for (quint64 pos = 0; pos < _imageSize && ok; pos += CHUNK_SIZE)
+    {
+        qint64 len = qMin((quint64) CHUNK_SIZE, _imageSize - pos);
+        QByteArray buf(len, 0);
+        bool mapped = false;
+
+        /* Fill in the parts of the chunk that are in use, and hash them */
+        while (range < _blocks.count())
+        {
+            quint64 rangeStart = _blocks[range].first * BlockSize;
+            quint64 rangeEnd   = qMin((_blocks[range].second+1) * BlockSize, _imageSize);
+            if (rangeStart >= pos+len)
+                break;
+
+            quint64 s = qMax(rangeStart, pos), e = qMin(rangeEnd, pos+len);
+            if (s == rangeStart)
+                SHA256_Init(&ctx);
+
+            if (!readAt(s, buf.data() + (s-pos), e-s))
+            {
+                emit error(tr("Error reading from drive '%1'").arg(_drive));
+                ok = false;
+                break;
+            }
+            SHA256_Update(&ctx, buf.constData() + (s-pos), e-s);
+            mapped = true;
+
+            if (e != rangeEnd)
+                break;
+            SHA256_Final(md, &ctx);
+            _checksums.append(QByteArray((const char *) md, sizeof(md)).toHex());
+            range++;
+        }
+
+        if (!mapped && len == CHUNK_SIZE)
+        {
+            /* Unused space is identical every time, only compress it once */
+            if (zeroMember.isEmpty())
+                zeroMember = GzipChunk::compress(buf);
+            queue.append(GzipChunk::precompressed(zeroMember));
+        }
+        else
+        {
+            GzipChunk *c = new GzipChunk(buf);
+            pool.start(c);
+            queue.append(c);
+        }
+
+        while (ok && (queue.count() >= maxQueued || (pos+len >= _imageSize && !queue.isEmpty())))
+        {
+            GzipChunk *c = queue.takeFirst();
+            QByteArray member = c->result();
+            delete c;
+
+            if (member.isEmpty() || out.write(member) != member.size())
+            {
+                emit error(tr("Error writing image file. Disk full?"));
+                ok = false;
+            }
+        }
+
+        int percent = (pos+len) * 100 / _imageSize;
+        if (percent != lastPercent)
+        {
+            emit progress(percent);
+            lastPercent = percent;
+        }
+    }
+
+    pool.waitForDone();
+    qDeleteAll(queue);
+    out.close();
+    sync();
+
+    if (!ok)
+        QFile::remove(_imagefile);
+
+    return ok;
+}
+
+bool DiskImageThread::writeBmap()
+{
+    QByteArray zeroChecksum(SHA256_DIGEST_LENGTH * 2, '0');
+    quint64 mapped = 0;
+    QByteArray ranges;
+
+    for (int i=0; i<_blocks.count(); i++)
+    {
+        quint64 first = _blocks[i].first, last = _blocks[i].second;
+
+        mapped += last - first + 1;
+        ranges += "        <Range chksum=\""+_checksums[i]+"\"> "+QByteArray::number(first);
+        if (last != first)
+            ranges += "-"+QByteArray::number(last);
+        ranges += " </Range>\n";
+    }
+
+    QByteArray xml = "<?xml version=\"1.0\" ?>\n"
+            "<bmap version=\"2.0\">\n"
+            "    <ImageSize> "+QByteArray::number(_imageSize)+" </ImageSize>\n"
+            "    <BlockSize> "+QByteArray::number(BlockSize)+" </BlockSize>\n"
+            "    <BlocksCount> "+QByteArray::number((_imageSize + BlockSize - 1) / BlockSize)+" </BlocksCount>\n"
+            "    <MappedBlocksCount> "+QByteArray::number(mapped)+" </MappedBlocksCount>\n"
+            "    <ChecksumType> sha256 </ChecksumType>\n"
+            "    <BmapFileChecksum> "+zeroChecksum+" </BmapFileChecksum>\n"
+            "    <BlockMap>\n"+ranges+
+            "    </BlockMap>\n"
+            "</bmap>\n";
+
+    /* Checksum of the file itself is calculated with the checksum field zeroed */
+    unsigned char md[SHA256_DIGEST_LENGTH];
+    SHA256((const unsigned char *) xml.constData(), xml.size(), md);
+    int pos = xml.indexOf(zeroChecksum);
+    xml.replace(pos, zeroChecksum.size(), QByteArray((const char *) md, sizeof(md)).toHex());
+
+    QFile f(bmapFilename(_imagefile));
+    if (!f.open(f.WriteOnly) || f.write(xml) != xml.size())
+    {
+        emit error(tr("Error writing block map file"));
+        return false;
+    }
+    f.close();
+    sync();
+
+    return true;
+}
@@ -0,0 +1,97 @@
+#ifndef DISKIMAGETHREAD_H
+#define DISKIMAGETHREAD_H
+
+/* Berryboot -- thread writing a sparse compressed image of a drive
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QThread>
+#include <QMap>
+#include <QList>
+#include <QPair>
+
+class QFile;
+
+class DiskImageThread : public QThread
+{
+    Q_OBJECT
+public:
+    /*
+     * Constructor
+     *
+     * - drive: drive holding the Berryboot installation, e.g. mmcblk0
+     * - imagefile: destination file. Written as concatenated gzip members,
+     *   a bmaptool compatible block map is written next to it as <image>.bmap
+     */
+    explicit DiskImageThread(const QString &drive, const QString &imagefile, QObject *parent = 0);
+
+    /*
+     * Returns name of the block map file belonging to an image
+     */
+    static QString bmapFilename(const QString &imagefile);
+
+    /*
+     * Block size used in the block map
+     */
+    static const int BlockSize = 4096;
+
+signals:
+    void statusUpdate(const QString &msg);
+    void progress(int percent);
+    void error(const QString &msg);
+    void completed();
+
+protected:
+    QString _drive, _imagefile;
+    quint64 _imageSize;
+    QFile *_dev;
+    /* Byte ranges of the drive that have to be included in the image: start -> end */
+    QMap<quint64,quint64> _ranges;
+    /* Merged ranges in BlockSize units (first, last) with SHA256 checksum */
+    QList<QPair<quint64,quint64> > _blocks;
+    QList<QByteArray> _checksums;
+
+    virtual void run();
+    bool readAt(quint64 pos, char *buf, qint64 len);
+
+    /*
+     * Determine which parts of the drive are in use
+     */
+    bool mapDrive();
+    void addRange(quint64 start, quint64 len);
+    void mergeRanges();
+
+    /*
+     * Add the blocks marked as in use by the file system allocation bitmaps
+     * Returns false if the file system is not supported
+     */
+    bool mapExt4(quint64 offset, quint64 size);
+    bool mapBtrfs(quint64 offset, quint64 size, const QString &mountpoint);
+
+    bool writeImage();
+    bool writeBmap();
+};
+
+#endif // DISKIMAGETHREAD_H
@@ -0,0 +1,277 @@
+/* Berryboot -- thread writing a disk image back to a drive
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "diskrestorethread.h"
+#include "diskimagethread.h"
+#include "installer.h"
+#include "mountmanager.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QRegExp>
+#include <blkid/blkid.h>
+#include <openssl/sha.h>
+#include <zlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define CHUNK_SIZE  (4 * 1024 * 1024)
+
+DiskRestoreThread::DiskRestoreThread(const QString &imagefile, const QString &drive, Installer *i, QObject *parent) :
+    QThread(parent), _imagefile(imagefile), _drive(drive), _i(i), _imageSize(0), _blockSize(0)
+{
+}
+
+QString DiskRestoreThread::drive()
+{
+    return _drive;
+}
+
+void DiskRestoreThread::run()
+{
+    if (!readBmap())
+        return;
+
+    emit statusUpdate(tr("Unmounting partitions of drive '%1'").arg(_drive));
+    if (QString(_i->bootdev()).startsWith(_drive))
+        _i->cleanupDrivers();
+
+    QFile f("/proc/mounts");
+    f.open(f.ReadOnly);
+    QList<QByteArray> mounts = f.readAll().split('\n');
+    f.close();
+
+    foreach (QByteArray line, mounts)
+    {
+        QList<QByteArray> fields = line.split(' ');
+        if (fields.count() > 1 && fields[0].startsWith("/dev/"+_drive.toLatin1()))
+        {
+            if (!MountManager::umount(fields[1], MountManager::AllReferences))
+            {
+                emit error(tr("Error unmounting '%1'").arg(QString(fields[1])));
+                return;
+            }
+        }
+    }
+
+    if (!writeImage())
+        return;
+
+    QString datadev = _drive;
+    if (!datadev.startsWith("sd") && !datadev.startsWith("hd"))
+        datadev += "p";
+    datadev += "2";
+
+    /* Mount the restored partitions, so the installer finds the operating systems on it */
+    emit statusUpdate(tr("Mounting restored partitions"));
+    if (QString(_i->bootdev()).startsWith(_drive))
+        _i->mountSystemPartition();
+
+    char *cstr = blkid_get_tag_value(NULL, "TYPE", QString("/dev/"+datadev).toLatin1().constData());
+    if (cstr)
+    {
+        if (qstrcmp(cstr, "crypto_LUKS") != 0)
+            MountManager::mount("/dev/"+datadev.toLatin1(), "/mnt");
+        free(cstr);
+    }
+
+    emit completed();
+}
+
+bool DiskRestoreThread::readBmap()
+{
+    QFile f(DiskImageThread::bmapFilename(_imagefile));
+
+    _blocks.clear();
+    _checksums.clear();
+    _blockSize = 0;
+
+    /* Without block map the whole image is written */
+    if (!f.exists())
+        return true;
+
+    if (!f.open(f.ReadOnly))
+    {
+        emit error(tr("Error opening block map file"));
+        return false;
+    }
+    QString xml = f.readAll();
+    f.close();
+
+    QRegExp imageSizeRx("<ImageSize>\\s*(\\d+)\\s*</ImageSize>");
+    QRegExp blockSizeRx("<BlockSize>\\s*(\\d+)\\s*</BlockSize>");
+    QRegExp checksumTypeRx("<ChecksumType>\\s*(\\w+)\\s*</ChecksumType>");
+    QRegExp rangeRx("<Range(?:\\s+chksum=\"([0-9a-fA-F]+)\")?\\s*>\\s*(\\d+)(?:\\s*-\\s*(\\d+))?\\s*</Range>");
+
+    if (imageSizeRx.indexIn(xml) == -1 || blockSizeRx.indexIn(xml) == -1)
+    {
+        emit error(tr("Invalid block map file"));
+        return false;
+    }
+    _imageSize = imageSizeRx.cap(1).toULongLong();
+    _blockSize = blockSizeRx.cap(1).toInt();
+    /* Older bmap versions use SHA1, only verify SHA256 */
+    bool sha256 = checksumTypeRx.indexIn(xml) != -1 && checksumTypeRx.cap(1) == "sha256";
+
+    if (_blockSize <= 0)
+    {
+        emit error(tr("Invalid block map file"));
+        return false;
+    }
+
+    int pos = 0;
+    while ((pos = rangeRx.indexIn(xml, pos)) != -1)
+    {
+        quint64 first = rangeRx.cap(2).toULongLong();
+        quint64 last  = rangeRx.cap(3).isEmpty() ? first : rangeRx.cap(3).toULongLong();
+
+        _blocks.append(qMakePair(first, last));
+        _checksums.append(sha256 ? rangeRx.cap(1).toLower().toLatin1() : QByteArray());
+        pos += rangeRx.matchedLength();
+    }
+
+    return true;
+}
+
+bool DiskRestoreThread::writeImage()
+{
+    QFile dev("/dev/"+_drive);
+    if (!dev.open(dev.ReadWrite))
+    {
+        emit error(tr("Error opening drive '%1'").arg(_drive));
+        return false;
+    }
+
+    quint64 devSize = 0;
+    if (ioctl(dev.handle(), BLKGETSIZE64, &devSize) == 0 && _imageSize > devSize)
+    {
+        emit error(tr("Drive too small. Need %1 MB").arg(QString::number(_imageSize / 1024 / 1024)));
+        return false;
+    }
+
+    gzFile in = gzopen(QFile::encodeName(_imagefile).constData(), "rb");
+    if (!in)
+    {
+        emit error(tr("Error opening image file '%1'").arg(_imagefile));
+        return false;
+    }
+    gzbuffer(in, 1024 * 1024);
+
+    quint64 compressedSize = QFileInfo(_imagefile).size(), pos = 0;
+    QByteArray buf(CHUNK_SIZE, 0);
+    SHA256_CTX ctx;
+    unsigned char md[SHA256_DIGEST_LENGTH];
+    int range = 0, lastPercent = -1;
+    bool ok = true;
+
+    emit statusUpdate(tr("Writing image to drive '%1'").arg(_drive));
+
+    while (ok)
+    {
+        int len = gzread(in, buf.data(), buf.size());
+        if (len < 0)
+        {
+            emit error(tr("Error decompressing image file. File corrupt?"));
+            ok = false;
+            break;
+        }
+        if (len == 0)
+            break;
+
+        if (!_blockSize)
+        {
+            if (!dev.seek(pos) || dev.write(buf.constData(), len) != len)
+            {
+                emit error(tr("Error writing to drive '%1'").arg(_drive));
+                ok = false;
+            }
+        }
+
+        /* Only write the blocks listed in the block map */
+        while (ok && _blockSize && range < _blocks.count())
+        {
+            quint64 rangeStart = _blocks[range].first * _blockSize;
+            quint64 rangeEnd   = (_blocks[range].second+1) * _blockSize;
+            if (_imageSize)
+                rangeEnd = qMin(rangeEnd, _imageSize);
+            if (rangeStart >= pos+len)
+                break;
+
+            quint64 s = qMax(rangeStart, pos), e = qMin(rangeEnd, pos+len);
+            if (s == rangeStart)
+                SHA256_Init(&ctx);
+
+            if (!dev.seek(s) || dev.write(buf.constData() + (s-pos), e-s) != (qint64) (e-s))
+            {
+                emit error(tr("Error writing to drive '%1'").arg(_drive));
+                ok = false;
+                break;
+            }
+            SHA256_Update(&ctx, buf.constData() + (s-pos), e-s);
+
+            if (e != rangeEnd)
+                break;
+            SHA256_Final(md, &ctx);
+            if (!_checksums[range].isEmpty() && QByteArray((const char *) md, sizeof(md)).toHex() != _checksums[range])
+            {
+                emit error(tr("Checksum mismatch in blocks %1-%2. Image file corrupt?").arg(
+                               QString::number(_blocks[range].first), QString::number(_blocks[range].second)));
+                ok = false;
+                break;
+            }
+            range++;
+        }
+
+        pos += len;
+        if (compressedSize)
+        {
+            int percent = gzoffset(in) * 100 / compressedSize;
+            if (percent != lastPercent)
+            {
+                emit progress(percent);
+                lastPercent = percent;
+            }
+        }
+    }
+    gzclose(in);
+
+    if (ok && range < _blocks.count())
+    {
+        emit error(tr("Image file is truncated"));
+        ok = false;
+    }
+
+    emit statusUpdate(tr("Finish writing to disk (sync)"));
+    dev.flush();
+    fsync(dev.handle());
+
+    /* Let the kernel pick up the restored partition table */
+    ioctl(dev.handle(), BLKRRPART);
+    dev.close();
+
+    return ok;
+}
@@ -0,0 +1,73 @@
+#ifndef DISKRESTORETHREAD_H
+#define DISKRESTORETHREAD_H
+
+/* Berryboot -- thread writing a disk image back to a drive
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QThread>
+#include <QList>
+#include <QPair>
+
+class Installer;
+
+class DiskRestoreThread : public QThread
+{
+    Q_OBJECT
+public:
+    /*
+     * Constructor
+     *
+     * - imagefile: gzip compressed image created by DiskImageThread
+     * - drive: drive to write to, e.g. mmcblk0
+     * - Installer: reference to Installer object
+     *
+     * If a block map is present next to the image, only the blocks listed
+     * in it are written and verified
+     */
+    explicit DiskRestoreThread(const QString &imagefile, const QString &drive, Installer *i, QObject *parent = 0);
+    QString drive();
+
+signals:
+    void statusUpdate(const QString &msg);
+    void progress(int percent);
+    void error(const QString &msg);
+    void completed();
+
+protected:
+    QString _imagefile, _drive;
+    Installer *_i;
+    quint64 _imageSize;
+    int _blockSize;
+    /* Block ranges (first, last) and their SHA256 checksums */
+    QList<QPair<quint64,quint64> > _blocks;
+    QList<QByteArray> _checksums;
+
+    virtual void run();
+    bool readBmap();
+    bool writeImage();
+};
+
+#endif // DISKRESTORETHREAD_H
@@ -26,22 +26,32 @@
 
 
 #include "driveformatthread.h"
+#include "blockdevice.h"
+#include "partitiontable.h"
+#include "storageprofile.h"
+#include "cryptoprofile.h"
+#include "devicemonitor.h"
+#include "deviceindex.h"
+#include "mountmanager.h"
 #include <unistd.h>
 #include <QFile>
 #include <QDir>
+#include <QDebug>
+#include <QElapsedTimer>
 
 DriveFormatThread::DriveFormatThread(const QString &drive, const QString &filesystem, Installer *i, QObject *parent, const QString &bootdev, bool initializedata, bool password) :
-    QThread(parent), _dev(drive), _bootdev(bootdev), _fs(filesystem), _iscsi(false), _initializedata(initializedata), _password(password), _i(i)
+    QThread(parent), _dev(drive), _bootdev(bootdev), _fs(filesystem), _iscsi(false), _initializedata(initializedata), _password(password), _saveBootFiles(true), _discarded(false), _i(i)
 {
     if (_dev == "iscsi")
     {
         _iscsi = true;
-        for (int i=0; i<50; i++)
+        QElapsedTimer t;
+        t.start();
+
+        /* Wait up to 5 seconds for the iSCSI disk to show up */
+        while ((_dev = _i->iscsiDevice()).isEmpty() && t.elapsed() < 5000)
         {
-            _dev = _i->iscsiDevice();
-            if (!_dev.isEmpty())
-                break;
-            QThread::msleep(100);
+            _i->deviceMonitor()->waitFor(SIGNAL(blockDeviceAdded(QString)), 5000 - t.elapsed());
         }
         _datadev = _dev;
     }
@@ -66,7 +76,7 @@ DriveFormatThread::DriveFormatThread(const QString &drive, const QString &filesy
 
 void DriveFormatThread::run()
 {
-    if (_reformatBoot)
+    if (_reformatBoot && _saveBootFiles)
     {
         emit statusUpdate(tr("Saving boot files to memory"));
         _i->cleanupDrivers();
@@ -77,12 +87,6 @@ void DriveFormatThread::run()
             return;
         }
 
-        if (QFile::exists("/lib/modules"))
-        {
-            /* Delete extracted drivers to free up tmpfs space */
-            QProcess::execute("rm -rf /lib/modules");
-        }
-
         if (!_i->saveBootFiles() )
         {
             emit error(tr("Error saving boot files to memory. SD card may be damaged."));
@@ -98,9 +102,12 @@ void DriveFormatThread::run()
         }
     }
 
+    QElapsedTimer t;
+
     if (_fs != "existing")
     {
         emit statusUpdate(tr("Zeroing partition table"));
+        t.start();
 
         if (_iscsi && _dev.isEmpty())
         {
@@ -108,6 +115,8 @@ void DriveFormatThread::run()
             return;
         }
 
+        _discarded = discardDrive();
+
         if (!zeroMbr())
         {
             emit error(tr("Error zero'ing MBR/GPT of device '%1'. SD card may be broken or advertising wrong capacity.").arg(_dev) );
@@ -121,65 +130,72 @@ void DriveFormatThread::run()
             emit error(tr("Error partitioning"));
             return;
         }
+        stepCompleted(tr("Partitioning"), t);
     }
 
-    if (_reformatBoot)
+    /* Once partitioned, the boot and data partition are independent of each other.
+     * Run mkfs of the data partition in the background, while we format the boot partition
+     * and copy the boot files, and only wait for it before initializing the data partition.
+     */
+    QProcess mkfsData;
+    QElapsedTimer dataTimer;
+
+    if (_fs != "existing")
     {
-        /* A10 devices need to have u-boot written to the spare space before the first partition */
-        if (QFile::exists("/tmp/boot/u-boot.bin") && QFile::exists("/tmp/boot/sunxi-spl.bin"))
+        if (_password && !setupEncryption())
         {
-            emit statusUpdate(tr("Installing u-boot SPL"));
-            if (!installUbootSPL())
-            {
-                emit error(tr("Error writing u-boot to disk"));
-                return;
-            }
+            emit error(tr("Error setting up encryption"));
+            return;
         }
 
-        emit statusUpdate(tr("Formatting boot partition (fat)"));
-        if (!formatBootPartition())
+        emit statusUpdate(tr("Formatting data partition (%1)").arg(_fs));
+        dataTimer.start();
+        mkfsData.setProcessChannelMode(QProcess::ForwardedChannels);
+        mkfsData.start(dataPartitionMkfsCommand());
+        if (!mkfsData.waitForStarted())
         {
-            emit error(tr("Error formatting boot partition (vfat)"));
+            emit error(tr("Error Formatting data partition (%1)").arg(_fs));
             return;
         }
+    }
 
-        if (_initializedata)
-        {
-            emit statusUpdate(tr("Copying boot files to storage"));
-            //_i->mountSystemPartition();
-            QProcess::execute("mount /dev/"+_bootdev+" /boot");
-            _i->restoreBootFiles();
+    bool bootOk = setupBootPartition();
 
-            emit statusUpdate(tr("Finish writing boot files to disk (sync)"));
-            sync();
-        }
-    }
-    else
+    if (mkfsData.state() != QProcess::NotRunning)
     {
-        QProcess::execute("/sbin/fatlabel /dev/"+_bootdev+" boot");
+        emit statusUpdate(tr("Formatting data partition (%1)").arg(_fs));
+        mkfsData.waitForFinished(-1);
     }
+    if (!bootOk)
+        return;
 
     if (_fs != "existing")
     {
-        emit statusUpdate(tr("Formatting data partition (%1)").arg(_fs));
-        if (!formatDataPartition())
+        if (mkfsData.exitStatus() != QProcess::NormalExit || mkfsData.exitCode() != 0)
         {
             emit error(tr("Error Formatting data partition (%1)").arg(_fs));
             return;
         }
+        stepCompleted(tr("Formatting data partition"), dataTimer);
     }
 
     if (_initializedata)
     {
         emit statusUpdate(tr("Mounting and initializing data partition"));
+        t.start();
         _i->initializeDataPartition(_password ? "mapper/luks" : _datadev);
+        stepCompleted(tr("Initializing data partition"), t);
 
         emit statusUpdate(tr("Editing cmdline.txt"));
 
         /* Data dev setting */
         QByteArray param;
-        if (_fs == "btrfs" || (_fs == "existing" && isBtrfs()) )
-            param += " fstype=btrfs";
+        QByteArray fstype = (_fs == "existing" ? existingFilesystem() : _fs.toLatin1());
+        if (fstype == "btrfs" || fstype == "f2fs")
+            param += " fstype="+fstype;
+        else
+            fstype = "ext4";
+        param += " mountopts="+StorageProfile(_dev).mountOptions(fstype);
         if (_iscsi)
             param += " datadev=iscsi";
         else if (_datadev == "mmcblk0p2")
@@ -187,7 +203,7 @@ void DriveFormatThread::run()
         else
             param += " datadev="+_i->uuidOfDevice(_datadev.toLatin1());
         if (_password)
-            param += " luks";
+            param += " luks luks_cipher="+_cipher.toLatin1();
         if (_bootdev != "mmcblk0p1")
             param += " bootdev="+_i->uuidOfDevice(_bootdev.toLatin1());
 
@@ -279,7 +295,7 @@ void DriveFormatThread::run()
 
         emit statusUpdate(tr("Mounting boot partition again"));
         //_i->mountSystemPartition();
-        QProcess::execute("mount /dev/"+_bootdev+" /boot");
+        MountManager::mount("/dev/"+_bootdev.toLatin1(), "/boot");
 
         /* Verify that cmdline.txt was written correctly */
         f.setFileName("/boot/cmdline.txt");
@@ -296,49 +312,90 @@ void DriveFormatThread::run()
     emit completed();
 }
 
-bool DriveFormatThread::partitionDrive()
+bool DriveFormatThread::setupBootPartition()
 {
-    QByteArray partitionTable;
-    int size_boot_part_in_sectors = 2048 * SIZE_BOOT_PART;
-    int start_main_part = size_boot_part_in_sectors + 2048;
+    QElapsedTimer t;
 
-    QFile f("/sys/class/block/"+_dev+"/size");
-    f.open(f.ReadOnly);
-    qulonglong blocks = f.readAll().trimmed().toULongLong();
-    f.close();
-    bool gpt = (blocks > 4294967295ULL);
+    if (_reformatBoot)
+    {
+        t.start();
 
-    if (!_iscsi)
+        /* A10 devices need to have u-boot written to the spare space before the first partition */
+        if (_i->bootFiles()->contains("u-boot.bin") && _i->bootFiles()->contains("sunxi-spl.bin"))
+        {
+            emit statusUpdate(tr("Installing u-boot SPL"));
+            if (!installUbootSPL())
+            {
+                emit error(tr("Error writing u-boot to disk"));
+                return false;
+            }
+        }
+
+        emit statusUpdate(tr("Formatting boot partition (fat)"));
+        if (!formatBootPartition())
+        {
+            emit error(tr("Error formatting boot partition (vfat)"));
+            return false;
+        }
+        stepCompleted(tr("Formatting boot partition"), t);
+
+        if (_initializedata)
+        {
+            emit statusUpdate(tr("Copying boot files to storage"));
+            t.start();
+            //_i->mountSystemPartition();
+            MountManager::mount("/dev/"+_bootdev.toLatin1(), "/boot");
+            if (!_i->restoreBootFiles())
+            {
+                emit error(tr("Error writing boot files to disk. SD card may be damaged."));
+                return false;
+            }
+            /* No sync() here, as that would also wait for the data partition mkfs running in parallel.
+             * Boot files are flushed when the boot partition is unmounted at the end. */
+            stepCompleted(tr("Copying boot files"), t);
+        }
+    }
+    else
     {
-        partitionTable = "2048,"+QByteArray::number(size_boot_part_in_sectors);
+        QProcess::execute("/sbin/fatlabel /dev/"+_bootdev+" boot");
+    }
 
-        if (gpt)
-            partitionTable += ",U\n"; /* EFI system partition */
-        else
-            partitionTable += ",0E\n"; /* FAT partition LBA */
+    return true;
+}
+
+void DriveFormatThread::stepCompleted(const QString &step, const QElapsedTimer &t)
+{
+    QString msg = tr("%1 took %2 seconds").arg(step, QString::number(t.elapsed() / 1000.0, 'f', 1));
+
+    qDebug() << msg;
+    emit statusUpdate(msg);
+}
+
+bool DriveFormatThread::partitionDrive()
+{
+    BlockDevice dev(_dev);
+    PartitionTable pt(&dev);
+
+    if (!dev.open())
+    {
+        qDebug() << dev.errorString();
+        return false;
     }
 
-    partitionTable += QByteArray::number(start_main_part)+",,L\n"; /* Linux partition with all remaining space */
-    partitionTable += "0,0\n";
-    partitionTable += "0,0\n";
-    if (_iscsi)
-        partitionTable += "0,0\n";
+    if (!_iscsi)
+        pt.addPartition(pt.BootPartition, SIZE_BOOT_PART * 1024 * 1024);
+    pt.addPartition(pt.DataPartition); /* Linux partition with all remaining space */
 
-    //QString cmd = QString("/sbin/sfdisk -H 32 -S 32 /dev/")+_dev;
-    //QString cmd = QString("/sbin/sfdisk -H 255 -S 63 -u S /dev/")+_dev;
-    QString cmd = QString("/sbin/sfdisk -u S /dev/")+_dev;
-    if (gpt)
-        cmd += " --label gpt";
-    QProcess proc;
-    proc.setProcessChannelMode(proc.MergedChannels);
-    proc.start(cmd);
-    proc.write(partitionTable);
-    proc.closeWriteChannel();
-    proc.waitForFinished(-1);
-    //qDebug() << "partitioning" << cmd;
-    //qDebug() << partitionTable;
+    /* MBR cannot address more than 2^32 sectors */
+    bool gpt = (dev.size() / 512 > 4294967295ULL);
 
-    return proc.exitCode() == 0;
+    if (!pt.write(gpt))
+    {
+        qDebug() << "Error partitioning" << _dev << pt.errorString();
+        return false;
+    }
+
+    return true;
 }
 
 bool DriveFormatThread::formatBootPartition()
@@ -346,82 +403,130 @@ bool DriveFormatThread::formatBootPartition()
     return QProcess::execute(QString("/sbin/mkfs.fat -n boot /dev/")+_bootdev) == 0;
 }
 
-bool DriveFormatThread::formatDataPartition()
+bool DriveFormatThread::setupEncryption()
 {
-    QString cmd;
-    QString dev;
+    _i->loadCryptoModules();
+    _i->cleanupDrivers();
+
+    emit statusUpdate(tr("Selecting fastest encryption cipher"));
+    CryptoProfile profile;
+    profile.benchmark();
+    _cipher = profile.cipher();
 
-    if (!_password)
+    /* For added security, let the cryptsetup program ask for the password in a text console */
+    QProcess proc;
+    proc.start("openvt -c 5 -w /usr/sbin/cryptsetup -q luksFormat "+profile.luksFormatOptions()+" /dev/"+_datadev);
+    _i->switchConsole(5);
+    proc.waitForFinished();
+
+    if (proc.exitCode())
     {
-        dev = _datadev;
+        _i->switchConsole(1);
+        return false;
     }
-    else
-    {
-        dev = "mapper/luks";
-        _i->loadCryptoModules();
-        _i->cleanupDrivers();
 
-        /* For added security, let the cryptsetup program ask for the password in a text console */
-        QProcess proc;
-        proc.start(QByteArray("openvt -c 5 -w /usr/sbin/cryptsetup -q luksFormat /dev/")+_datadev);
-        _i->switchConsole(5);
-        proc.waitForFinished();
+    proc.start(QByteArray("openvt -c 5 -w /usr/sbin/cryptsetup luksOpen /dev/")+_datadev+" luks");
+    proc.waitForFinished();
+    _i->switchConsole(1);
 
-        if (proc.exitCode())
-        {
-            _i->switchConsole(1);
-            return false;
-        }
+    return proc.exitCode() == 0;
+}
 
-        proc.start(QByteArray("openvt -c 5 -w /usr/sbin/cryptsetup luksOpen /dev/")+_datadev+" luks");
-        proc.waitForFinished();
-        _i->switchConsole(1);
+QString DriveFormatThread::dataPartitionMkfsCommand()
+{
+    QString dev = (_password ? "mapper/luks" : _datadev);
+    StorageProfile profile(_dev);
+    QStringList extendedOptions;
 
-        if (proc.exitCode())
-            return false;
-    }
+    /* No need to let mkfs discard again, if the whole drive was discarded already */
+    if (_discarded || _fs == "ext4 nodiscard")
+        extendedOptions << "nodiscard";
 
     if (_fs == "btrfs")
-        cmd = QString("/usr/bin/mkfs.btrfs -f -L berryboot /dev/")+dev;
-    else if (_fs == "ext4")
-        cmd = QString("/sbin/mkfs.ext4 -O ^huge_file -L berryboot /dev/")+dev;
-    else if (_fs == "ext4 nolazy")
-        cmd = QString("/sbin/mkfs.ext4 -E lazy_itable_init=0,lazy_journal_init=0 -O ^huge_file -L berryboot /dev/")+dev;
+    {
+        return "/usr/bin/mkfs.btrfs -f "+profile.mkfsOptions(_fs)+(_discarded ? " -K" : "")+" -L berryboot /dev/"+dev;
+    }
+    else if (_fs == "f2fs")
+    {
+        return "/usr/sbin/mkfs.f2fs -f "+profile.mkfsOptions(_fs)+(_discarded ? " -t 0" : "")+" -l berryboot /dev/"+dev;
+    }
     else
-        cmd = QString("/sbin/mkfs.ext4 -E nodiscard -L berryboot /dev/")+dev;
+    {
+        QString features = (_fs == "ext4 nodiscard" ? "" : "-O ^huge_file ");
 
-    return QProcess::execute(cmd) == 0;
+        if (_fs == "ext4 nolazy")
+            extendedOptions << "lazy_itable_init=0" << "lazy_journal_init=0";
+
+        return "/sbin/mkfs.ext4 "+profile.mkfsOptions("ext4", extendedOptions)+" "+features+"-L berryboot /dev/"+dev;
+    }
+}
+
+bool DriveFormatThread::discardDrive()
+{
+    BlockDevice dev(_dev);
+
+    if (!dev.open() || !dev.supportsDiscard())
+        return false;
+
+    /* Telling the card all blocks are free lets its controller erase them in advance, which makes writing faster */
+    emit statusUpdate(tr("Erasing drive (discard)"));
+    if (!dev.discard(0, dev.size()))
+    {
+        qDebug() << dev.errorString();
+        return false;
+    }
+
+    return true;
 }
 
 bool DriveFormatThread::zeroMbr()
 {
-    if (QFile::exists("/tmp/boot/mbr.bin"))
-        return QProcess::execute("/bin/dd if=/tmp/boot/mbr.bin of=/dev/"+_dev) == 0;
+    BlockDevice dev(_dev);
+    bool ok;
+
+    if (!dev.open())
+    {
+        qDebug() << dev.errorString();
+        return false;
+    }
+
+    if (_i->bootFiles()->contains("mbr.bin"))
+    {
+        ok = dev.writeAt(0, _i->bootFiles()->file("mbr.bin")) && dev.flush();
+    }
     else
     {
         /* First 512 bytes should be enough to zero out the MBR, but we zero out 8 kb to make sure we also erase any
          * GPT primary header and get rid of any partitionless FAT headers.
          * Also zero out the last 4 kb of the card to get rid of any secondary GPT header
-         *
-         * Using conv=fsync to make sure we get notified of write errors
          */
-        QFile f("/sys/class/block/"+_dev+"/size");
-        f.open(f.ReadOnly);
-        qulonglong blocks = f.readAll().trimmed().toULongLong();
-        f.close();
+        quint64 size = dev.size();
 
-        if (blocks < 8)
+        if (size < 8192)
             return false;
 
-        return QProcess::execute("/bin/dd conv=fsync count=1 bs=8192 if=/dev/zero of=/dev/"+_dev) == 0
-            && QProcess::execute("/bin/dd conv=fsync count=8 bs=512 if=/dev/zero seek="+QString::number(blocks-8)+" of=/dev/"+_dev) == 0;
+        ok = dev.zeroOut(0, 8192) && dev.zeroOut(size-4096, 4096) && dev.flush();
     }
+
+    if (!ok)
+        qDebug() << dev.errorString();
+
+    return ok;
 }
 
 bool DriveFormatThread::installUbootSPL()
 {
-    return (QProcess::execute("/bin/dd bs=1024 seek=8 if=/tmp/boot/sunxi-spl.bin of=/dev/"+_dev) == 0)
-        && (QProcess::execute("/bin/dd bs=1024 seek=32 if=/tmp/boot/u-boot.bin of=/dev/"+_dev) == 0);
+    BlockDevice dev(_dev);
+
+    bool ok = dev.open()
+        && dev.writeAt(8*1024, _i->bootFiles()->file("sunxi-spl.bin"))
+        && dev.writeAt(32*1024, _i->bootFiles()->file("u-boot.bin"))
+        && dev.flush();
+
+    if (!ok)
+        qDebug() << dev.errorString();
+
+    return ok;
 }
 
 QString DriveFormatThread::drive()
@@ -439,19 +544,13 @@ QString DriveFormatThread::datadev()
     return _datadev;
 }
 
-bool DriveFormatThread::isBtrfs()
+void DriveFormatThread::setSaveBootFiles(bool save)
 {
-    QProcess proc;
-    proc.start("/sbin/blkid /dev/"+_datadev);
-    if (proc.waitForFinished() && proc.exitCode() == 0)
-    {
-        QByteArray res = proc.readAll();
-
-        if (res.contains("TYPE=\"btrfs\""))
-        {
-            return true;
-        }
-    }
+    _saveBootFiles = save;
+}
 
-    return false;
+QByteArray DriveFormatThread::existingFilesystem()
+{
+    _i->deviceIndex()->refresh(_datadev.toLatin1());
+    return _i->deviceIndex()->tag(_datadev.toLatin1(), "TYPE");
 }
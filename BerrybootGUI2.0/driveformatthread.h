@@ -28,6 +28,7 @@
  */
 
 #include <QThread>
+#include <QElapsedTimer>
 #include "installer.h"
 
 class DriveFormatThread : public QThread
@@ -45,6 +46,11 @@ public:
      */
     explicit DriveFormatThread(const QString &drive, const QString &filesystem, Installer *i, QObject *parent = 0, const QString &bootdev = "mmcblk0p1", bool initializedata = true, bool password = false);
     void setPassword(const QByteArray &password);
+    /*
+     * Whether to save the boot files to memory before formatting (defaults to true)
+     * Disable if the caller already did so, e.g. when formatting several drives at once
+     */
+    void setSaveBootFiles(bool save);
     QString drive();
     QString bootdev();
     QString datadev();
@@ -55,17 +61,37 @@ signals:
     void completed();
     
 protected:
-    QString _dev, _datadev, _bootdev, _fs;
-    bool _reformatBoot, _iscsi, _initializedata, _password;
+    QString _dev, _datadev, _bootdev, _fs, _cipher;
+    bool _reformatBoot, _iscsi, _initializedata, _password, _saveBootFiles, _discarded;
     Installer *_i;
 
     virtual void run();
+    bool discardDrive();
     bool zeroMbr();
     bool installUbootSPL();
     bool partitionDrive();
     bool formatBootPartition();
-    bool formatDataPartition();
-    bool isBtrfs();
+    /*
+     * Format boot partition and restore the boot files to it.
+     * Emits error() and returns false on failure
+     */
+    bool setupBootPartition();
+    /*
+     * Create LUKS container on data partition, asking for the password on tty5
+     */
+    bool setupEncryption();
+    /*
+     * mkfs command line for the data partition, run in parallel with setupBootPartition()
+     */
+    QString dataPartitionMkfsCommand();
+    /*
+     * Report how long a step of the installation took
+     */
+    void stepCompleted(const QString &step, const QElapsedTimer &t);
+    /*
+     * File system type of existing data partition (e.g. ext4, btrfs or f2fs)
+     */
+    QByteArray existingFilesystem();
 };
 
 #endif // DRIVEFORMATTHREAD_H
@@ -0,0 +1,174 @@
+/* Berryboot -- dialog for cloning to several SD cards at once
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "duplicatedialog.h"
+#include "ui_duplicatedialog.h"
+#include "duplicatethread.h"
+#include "installer.h"
+#include <QFile>
+#include <QIcon>
+#include <QMessageBox>
+#include <QPushButton>
+
+DuplicateDialog::DuplicateDialog(Installer *i, const QStringList &drives, QWidget *parent) :
+    QDialog(parent),
+    ui(new Ui::DuplicateDialog),
+    _i(i),
+    _thread(NULL)
+{
+    ui->setupUi(this);
+    ui->buttonBox->button(QDialogButtonBox::Ok)->setText(tr("Start"));
+
+    double diskspaceNeeded = _i->diskSpaceInUse()+(64*1024*1024);
+
+    foreach (QString drive, drives)
+    {
+        QFile f("/sys/class/block/"+drive+"/device/model");
+        f.open(f.ReadOnly);
+        QString label = drive+": "+f.readAll().trimmed();
+        f.close();
+
+        /* Check if SD card is large enough */
+        f.setFileName("/sys/block/"+drive+"/size");
+        f.open(f.ReadOnly);
+        double sizeofsd = f.readAll().trimmed().toDouble()*512;
+        f.close();
+
+        QListWidgetItem *item = new QListWidgetItem(QIcon(drive.startsWith("mmc") ? ":/icons/mmc.png" : ":/icons/hdd.png"), label, ui->targetList);
+        item->setData(Qt::UserRole, drive);
+
+        if (sizeofsd && diskspaceNeeded > sizeofsd)
+        {
+            item->setText(label+" - "+tr("Capacity too small. Need %1 MB").arg(QString::number(diskspaceNeeded/1024/1024)));
+            item->setFlags(Qt::NoItemFlags);
+        }
+        else
+        {
+            item->setFlags(Qt::ItemIsEnabled | Qt::ItemIsUserCheckable);
+            item->setCheckState(Qt::Checked);
+        }
+    }
+}
+
+DuplicateDialog::~DuplicateDialog()
+{
+    delete ui;
+}
+
+void DuplicateDialog::on_buttonBox_accepted()
+{
+    QStringList drives;
+
+    for (int n=0; n<ui->targetList->count(); n++)
+    {
+        QListWidgetItem *item = ui->targetList->item(n);
+
+        if (item->checkState() == Qt::Checked)
+        {
+            drives.append(item->data(Qt::UserRole).toString());
+            _labels.append(item->text());
+            _targetItems.append(item);
+        }
+        else
+        {
+            item->setHidden(true);
+        }
+    }
+
+    if (drives.isEmpty())
+    {
+        QMessageBox::critical(this, tr("Error"), tr("Select at least one SD card"), QMessageBox::Close);
+        return;
+    }
+
+    if (QMessageBox::question(this, tr("Confirm"), tr("Are you sure you want to clone to %1? WARNING: this will overwrite all existing files.").arg(drives.join(", ")), QMessageBox::Yes, QMessageBox::No) != QMessageBox::Yes)
+    {
+        for (int n=0; n<ui->targetList->count(); n++)
+            ui->targetList->item(n)->setHidden(false);
+        _labels.clear();
+        _targetItems.clear();
+        return;
+    }
+
+    ui->buttonBox->setEnabled(false);
+    foreach (QListWidgetItem *item, _targetItems)
+        item->setFlags(Qt::ItemIsEnabled);
+
+    _thread = new DuplicateThread(drives, _i, this);
+    connect(_thread, SIGNAL(statusUpdate(QString)), ui->statusLabel, SLOT(setText(QString)));
+    connect(_thread, SIGNAL(completed()), this, SLOT(onCompleted()));
+    foreach (DuplicateTarget *t, _thread->targets())
+    {
+        connect(t, SIGNAL(status(int,QString)), this, SLOT(onTargetStatus(int,QString)));
+        connect(t, SIGNAL(progress(int,int)), this, SLOT(onTargetProgress(int,int)));
+        connect(t, SIGNAL(failed(int,QString)), this, SLOT(onTargetFailed(int,QString)));
+        connect(t, SIGNAL(completed(int)), this, SLOT(onTargetCompleted(int)));
+    }
+    _thread->start();
+}
+
+void DuplicateDialog::setTargetText(int target, const QString &msg)
+{
+    if (target >= 0 && target < _targetItems.count())
+        _targetItems[target]->setText(_labels[target]+" - "+msg);
+}
+
+void DuplicateDialog::onTargetStatus(int target, const QString &msg)
+{
+    setTargetText(target, msg);
+}
+
+void DuplicateDialog::onTargetProgress(int target, int percent)
+{
+    setTargetText(target, tr("Copying data files... %1%").arg(percent));
+}
+
+void DuplicateDialog::onTargetFailed(int target, const QString &msg)
+{
+    setTargetText(target, tr("FAILED: %1").arg(msg));
+}
+
+void DuplicateDialog::onTargetCompleted(int target)
+{
+    setTargetText(target, tr("Finished and verified"));
+}
+
+void DuplicateDialog::onCompleted()
+{
+    ui->statusLabel->setText(tr("Finished. %1 of %2 SD cards cloned successfully.").arg(
+                                 QString::number(_thread->succeeded()), QString::number(_targetItems.count())));
+    ui->buttonBox->button(QDialogButtonBox::Ok)->setHidden(true);
+    ui->buttonBox->setEnabled(true);
+}
+
+void DuplicateDialog::reject()
+{
+    /* Do not allow closing the dialog while cloning */
+    if (_thread && _thread->isRunning())
+        return;
+
+    QDialog::reject();
+}
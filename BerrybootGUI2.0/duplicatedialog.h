@@ -0,0 +1,76 @@
+#ifndef DUPLICATEDIALOG_H
+#define DUPLICATEDIALOG_H
+
+/* Berryboot -- dialog for cloning to several SD cards at once
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QDialog>
+#include <QStringList>
+
+namespace Ui {
+class DuplicateDialog;
+}
+class Installer;
+class DuplicateThread;
+class QListWidgetItem;
+
+class DuplicateDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    /*
+     * Constructor
+     *
+     * - drives: external drives the user can select as target
+     */
+    explicit DuplicateDialog(Installer *i, const QStringList &drives, QWidget *parent = 0);
+    ~DuplicateDialog();
+
+public slots:
+    virtual void reject();
+
+protected:
+    Ui::DuplicateDialog *ui;
+    Installer *_i;
+    DuplicateThread *_thread;
+    QStringList _labels;
+    QList<QListWidgetItem *> _targetItems;
+
+    void setTargetText(int target, const QString &msg);
+
+protected slots:
+    void onTargetStatus(int target, const QString &msg);
+    void onTargetProgress(int target, int percent);
+    void onTargetFailed(int target, const QString &msg);
+    void onTargetCompleted(int target);
+    void onCompleted();
+
+private slots:
+    void on_buttonBox_accepted();
+};
+
+#endif // DUPLICATEDIALOG_H
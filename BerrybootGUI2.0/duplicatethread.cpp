@@ -0,0 +1,498 @@
+/* Berryboot -- threads cloning to several SD cards at once
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "duplicatethread.h"
+#include "driveformatthread.h"
+#include "installer.h"
+#include "mountmanager.h"
+#include "storageprofile.h"
+#include <QFile>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QProcess>
+#include <unistd.h>
+
+/* Data buffered per target, before the source has to wait for it */
+#define MAX_BUFFERED        (16 * 1024 * 1024)
+/* Targets that do not accept any data for this long are dropped */
+#define STALL_TIMEOUT_MS    60000
+#define READ_SIZE           (1024 * 1024)
+
+/* Counts entries and total file size below a directory, used to verify the copies
+ * lost+found is skipped, as it only exists if the file system created it */
+static void treeStats(const QString &dir, quint64 &files, quint64 &bytes)
+{
+    QDirIterator it(dir, QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    QString lostFound = dir+"/lost+found";
+
+    files = bytes = 0;
+    while (it.hasNext())
+    {
+        it.next();
+        QFileInfo fi = it.fileInfo();
+
+        if (it.filePath() == lostFound || it.filePath().startsWith(lostFound+"/"))
+            continue;
+
+        files++;
+        if (fi.isFile() && !fi.isSymLink())
+            bytes += fi.size();
+    }
+}
+
+/* Returns the value of a name=value parameter in cmdline.txt, or an empty string */
+static QByteArray paramValue(const QByteArray &cmdline, const QByteArray &name)
+{
+    int pos = cmdline.indexOf(" "+name+"=");
+    if (pos == -1)
+        return QByteArray();
+
+    pos += name.size()+2;
+    int end = cmdline.indexOf(' ', pos);
+    return cmdline.mid(pos, (end == -1 ? cmdline.size() : end) - pos).trimmed();
+}
+
+/* Removes a name=value parameter from cmdline.txt */
+static void removeParam(QByteArray &cmdline, const QByteArray &name)
+{
+    int pos = cmdline.indexOf(" "+name+"=");
+    if (pos != -1)
+    {
+        int end = cmdline.indexOf(' ', pos+1);
+        cmdline.remove(pos, (end == -1 ? cmdline.size() : end) - pos);
+    }
+}
+
+DuplicateThread::DuplicateThread(const QStringList &drives, Installer *i, QObject *parent) :
+    QThread(parent), _i(i)
+{
+    for (int n=0; n<drives.count(); n++)
+        _targets.append(new DuplicateTarget(n, drives[n], i, &_ready, this));
+}
+
+QList<DuplicateTarget *> DuplicateThread::targets()
+{
+    return _targets;
+}
+
+int DuplicateThread::succeeded()
+{
+    int count = 0;
+
+    foreach (DuplicateTarget *t, _targets)
+    {
+        if (!t->hasFailed())
+            count++;
+    }
+
+    return count;
+}
+
+void DuplicateThread::run()
+{
+    emit statusUpdate(tr("Saving boot files to memory"));
+    saveBootFiles();
+
+    /* Targets format in parallel, and release the semaphore once ready to receive data */
+    emit statusUpdate(tr("Formatting"));
+    foreach (DuplicateTarget *t, _targets)
+        t->start();
+    _ready.acquire(_targets.count());
+
+    emit statusUpdate(tr("Copying data files... Can take half an hour."));
+    copyData();
+
+    foreach (DuplicateTarget *t, _targets)
+        t->close();
+    foreach (DuplicateTarget *t, _targets)
+        t->wait();
+
+    _i->bootFiles()->clear();
+    sync();
+    emit completed();
+}
+
+bool DuplicateThread::saveBootFiles()
+{
+    QString error;
+
+    _i->cleanupDrivers();
+
+    if (_i->sizeofBootFilesInKB() > SIZE_BOOT_PART * 1000)
+    {
+        error = tr("SD card contains extra files that do not belong to Berryboot. Please copy them to another disk and delete them from card.");
+    }
+    else if (!_i->saveBootFiles())
+    {
+        error = tr("Error saving boot files to memory. SD card may be damaged.");
+    }
+
+    if (!error.isEmpty())
+    {
+        foreach (DuplicateTarget *t, _targets)
+            t->abort(error);
+        return false;
+    }
+
+    /* Targets get the same data partition file system as the source */
+    QByteArray fstype = paramValue(_i->bootFiles()->file("cmdline.txt"), "fstype");
+    if (fstype != "btrfs" && fstype != "f2fs")
+        fstype = "ext4";
+    foreach (DuplicateTarget *t, _targets)
+        t->setFilesystem(fstype);
+
+    /* Fix cmdline.txt and uEnv.txt to remove device specific options.
+     * Mount options are tuned to each target by DuplicateTarget::setMountOptions() */
+    QStringList files;
+    files << "cmdline.txt" << "uEnv.txt";
+
+    foreach (QString filename, files)
+    {
+        if (!_i->bootFiles()->contains(filename))
+            continue;
+        QByteArray data = _i->bootFiles()->file(filename);
+        removeParam(data, "luks_cipher");
+        removeParam(data, "mountopts");
+        data.replace(" luks", "");
+        data.replace("mac_addr", "orig_mac");
+        _i->bootFiles()->setFile(filename, data);
+    }
+
+    return true;
+}
+
+void DuplicateThread::copyData()
+{
+    quint64 files, bytes;
+    treeStats("/mnt", files, bytes);
+    foreach (DuplicateTarget *t, _targets)
+        t->setExpected(files, bytes);
+
+    QProcess tar;
+    tar.start("/bin/tar", QStringList() << "c" << "-f" << "-" << "-C" << "/mnt" << ".");
+    if (!tar.waitForStarted())
+    {
+        foreach (DuplicateTarget *t, _targets)
+            t->abort(tr("Error reading data partition"));
+        return;
+    }
+
+    /* Read data partition once, and hand every block to all targets */
+    while (tar.bytesAvailable() || tar.waitForReadyRead(-1))
+    {
+        QByteArray data = tar.read(READ_SIZE);
+        int alive = 0;
+
+        foreach (DuplicateTarget *t, _targets)
+        {
+            if (t->write(data))
+                alive++;
+        }
+
+        if (!alive)
+        {
+            tar.kill();
+            break;
+        }
+    }
+
+    tar.waitForFinished(-1);
+    if (tar.exitStatus() != QProcess::NormalExit || tar.exitCode() != 0)
+    {
+        foreach (DuplicateTarget *t, _targets)
+            t->abort(tr("Error reading data partition"));
+    }
+}
+
+DuplicateTarget::DuplicateTarget(int index, const QString &drive, Installer *i, QSemaphore *ready, QObject *parent) :
+    QThread(parent), _index(index), _drive(drive), _fs("ext4"), _i(i), _ready(ready),
+    _expectedFiles(0), _expectedBytes(0), _buffered(0), _written(0), _eof(false), _failed(false)
+{
+    _bootdev = _datadev = drive;
+    if (!drive.startsWith("sd") && !drive.startsWith("hd"))
+        _bootdev += "p";
+    _bootdev += "1";
+    _mountpoint = "/tmp/mnt_"+drive;
+}
+
+QString DuplicateTarget::drive()
+{
+    return _drive;
+}
+
+bool DuplicateTarget::hasFailed()
+{
+    QMutexLocker lock(&_mutex);
+    return _failed;
+}
+
+void DuplicateTarget::setExpected(quint64 files, quint64 bytes)
+{
+    QMutexLocker lock(&_mutex);
+    _expectedFiles = files;
+    _expectedBytes = bytes;
+}
+
+void DuplicateTarget::setFilesystem(const QString &fs)
+{
+    _fs = fs;
+}
+
+bool DuplicateTarget::write(const QByteArray &data)
+{
+    QMutexLocker lock(&_mutex);
+
+    while (!_failed && _buffered >= MAX_BUFFERED)
+    {
+        if (!_cond.wait(&_mutex, STALL_TIMEOUT_MS) && _buffered >= MAX_BUFFERED && !_failed)
+        {
+            _failed = true;
+            _error  = tr("Card stopped responding");
+            _cond.wakeAll();
+        }
+    }
+    if (_failed)
+        return false;
+
+    _queue.enqueue(data);
+    _buffered += data.size();
+    _cond.wakeAll();
+
+    return true;
+}
+
+void DuplicateTarget::close()
+{
+    QMutexLocker lock(&_mutex);
+    _eof = true;
+    _cond.wakeAll();
+}
+
+void DuplicateTarget::abort(const QString &msg)
+{
+    QMutexLocker lock(&_mutex);
+    if (!_failed)
+    {
+        _failed = true;
+        _error  = msg;
+    }
+    _cond.wakeAll();
+}
+
+bool DuplicateTarget::fail(const QString &msg)
+{
+    abort(msg);
+    return false;
+}
+
+void DuplicateTarget::run()
+{
+    bool ok = !hasFailed() && format() && copyBootFiles();
+    _ready->release();
+
+    if (ok)
+    {
+        ok = copyData() && verify();
+
+        /* Get rid of persistent-net.rules, as the cloned SD card may be intended for a different device */
+        QProcess::execute("sh -c 'rm "+_mountpoint+"/data/*/etc/udev/rules.d/70-persistent-net.rules'");
+        MountManager::umount(_mountpoint.toLatin1());
+        QDir().rmdir(_mountpoint);
+    }
+
+    if (ok)
+    {
+        emit status(_index, tr("Finished"));
+        emit completed(_index);
+    }
+    else
+    {
+        QMutexLocker lock(&_mutex);
+        emit failed(_index, _error);
+    }
+}
+
+bool DuplicateTarget::format()
+{
+    DriveFormatThread dft(_drive, _fs, _i, 0, _bootdev, false);
+    dft.setSaveBootFiles(false);
+    connect(&dft, SIGNAL(statusUpdate(QString)), this, SLOT(onFormatStatus(QString)), Qt::DirectConnection);
+    connect(&dft, SIGNAL(error(QString)), this, SLOT(onFormatError(QString)), Qt::DirectConnection);
+    dft.start();
+    dft.wait();
+    _datadev = dft.datadev();
+
+    return !hasFailed();
+}
+
+void DuplicateTarget::onFormatStatus(const QString &msg)
+{
+    emit status(_index, msg);
+}
+
+void DuplicateTarget::onFormatError(const QString &msg)
+{
+    abort(msg);
+}
+
+bool DuplicateTarget::copyBootFiles()
+{
+    emit status(_index, tr("Copying boot files..."));
+
+    QDir dir;
+    dir.mkdir(_mountpoint);
+    // Copy 512 KB from boot sector for devices that depend on u-boot SPL
+    QProcess::execute("dd bs=1024 seek=8 skip=8 count=512 if=/dev/mmcblk0p1 of=/dev/"+_drive);
+
+    if (!MountManager::mount("/dev/"+_bootdev.toLatin1(), _mountpoint.toLatin1()))
+        return fail(tr("Error mounting boot partition"));
+    QString error;
+    bool ok = _i->bootFiles()->restore(_mountpoint, &error);
+    if (ok)
+        setMountOptions();
+    MountManager::umount(_mountpoint.toLatin1());
+    if (!ok)
+        return fail(tr("Error copying boot files: %1").arg(error));
+
+    if (!MountManager::mount("/dev/"+_datadev.toLatin1(), _mountpoint.toLatin1()))
+        return fail(tr("Error mounting data partition"));
+
+    return true;
+}
+
+void DuplicateTarget::setMountOptions()
+{
+    QByteArray param = " mountopts="+StorageProfile(_drive).mountOptions(_fs);
+
+    QFile f(_mountpoint+"/cmdline.txt");
+    if (f.open(f.ReadOnly))
+    {
+        QByteArray line = f.readAll().trimmed();
+        f.close();
+        f.open(f.WriteOnly);
+        f.write(line+param);
+        f.close();
+    }
+
+    /* Data dev setting in uEnv.txt (for A10 devices) */
+    f.setFileName(_mountpoint+"/uEnv.txt");
+    if (f.open(f.ReadOnly))
+    {
+        QByteArray line = f.readAll().trimmed();
+        f.close();
+        f.open(f.WriteOnly);
+        f.write(line+param+"\n");
+        f.close();
+    }
+}
+
+bool DuplicateTarget::copyData()
+{
+    QProcess tar;
+    int lastPercent = -1;
+
+    emit status(_index, tr("Copying data files..."));
+    tar.setProcessChannelMode(tar.MergedChannels);
+    tar.start("/bin/tar", QStringList() << "x" << "-f" << "-" << "-C" << _mountpoint);
+    if (!tar.waitForStarted())
+        return fail(tr("Error starting tar"));
+
+    while (true)
+    {
+        QByteArray data;
+
+        _mutex.lock();
+        while (_queue.isEmpty() && !_eof && !_failed)
+            _cond.wait(&_mutex);
+        bool stop = _failed || _queue.isEmpty();
+        if (!stop)
+            data = _queue.dequeue();
+        _mutex.unlock();
+
+        if (stop)
+            break;
+
+        tar.write(data);
+        /* Poll, so that we notice if the reader gave up on us */
+        while (tar.bytesToWrite() > 0 && !hasFailed())
+        {
+            if (!tar.waitForBytesWritten(1000) && tar.state() != QProcess::Running)
+                fail(tr("Error writing data files: %1").arg(QString(tar.readAll())));
+        }
+
+        _mutex.lock();
+        _buffered -= data.size();
+        _written  += data.size();
+        int percent = _expectedBytes ? qMin(_written * 100 / _expectedBytes, (quint64) 100) : 0;
+        _cond.wakeAll();
+        _mutex.unlock();
+
+        if (percent != lastPercent)
+        {
+            emit progress(_index, percent);
+            lastPercent = percent;
+        }
+    }
+
+    if (hasFailed())
+    {
+        tar.kill();
+        tar.waitForFinished(5000);
+        return false;
+    }
+
+    tar.closeWriteChannel();
+    tar.waitForFinished(-1);
+    if (tar.exitStatus() != QProcess::NormalExit || tar.exitCode() != 0)
+        return fail(tr("Error writing data files: %1").arg(QString(tar.readAll())));
+
+    return true;
+}
+
+bool DuplicateTarget::verify()
+{
+    quint64 files, bytes;
+
+    emit status(_index, tr("Verifying..."));
+    sync();
+
+    /* Drop page cache, so we see what actually ended up on the card */
+    QFile f("/proc/sys/vm/drop_caches");
+    f.open(f.WriteOnly);
+    f.write("3\n");
+    f.close();
+
+    treeStats(_mountpoint, files, bytes);
+    if (files != _expectedFiles || bytes != _expectedBytes)
+    {
+        return fail(tr("Verification failed. %1 of %2 files, %3 of %4 MB copied").arg(
+                        QString::number(files), QString::number(_expectedFiles),
+                        QString::number(bytes / 1024 / 1024), QString::number(_expectedBytes / 1024 / 1024)));
+    }
+
+    return true;
+}
@@ -0,0 +1,146 @@
+#ifndef DUPLICATETHREAD_H
+#define DUPLICATETHREAD_H
+
+/* Berryboot -- threads cloning to several SD cards at once
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QThread>
+#include <QStringList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSemaphore>
+#include <QQueue>
+
+class Installer;
+class DuplicateTarget;
+
+class DuplicateThread : public QThread
+{
+    Q_OBJECT
+public:
+    /*
+     * Constructor
+     *
+     * - drives: target drives, e.g. sda, sdb
+     * - Installer: reference to Installer object
+     *
+     * All targets are formatted in parallel. The data partition is then read
+     * once and the stream is fanned out to the writer thread of each target.
+     * A target that fails or stops responding is dropped without affecting the others.
+     */
+    explicit DuplicateThread(const QStringList &drives, Installer *i, QObject *parent = 0);
+
+    /*
+     * Per target threads, connect to their signals for progress information
+     */
+    QList<DuplicateTarget *> targets();
+
+    /*
+     * Number of targets that were cloned and verified successfully
+     */
+    int succeeded();
+
+signals:
+    void statusUpdate(const QString &msg);
+    void completed();
+
+protected:
+    Installer *_i;
+    QList<DuplicateTarget *> _targets;
+    QSemaphore _ready;
+
+    virtual void run();
+    bool saveBootFiles();
+    void copyData();
+};
+
+class DuplicateTarget : public QThread
+{
+    Q_OBJECT
+public:
+    DuplicateTarget(int index, const QString &drive, Installer *i, QSemaphore *ready, QObject *parent = 0);
+    QString drive();
+    bool hasFailed();
+
+    /*
+     * Called by DuplicateThread when the target is formatted, with the file count
+     * and size of the data to be copied, which is used for progress and verification
+     */
+    void setExpected(quint64 files, quint64 bytes);
+
+    /*
+     * File system to format the data partition with, same as the source (default: ext4)
+     * Must be called before the thread is started
+     */
+    void setFilesystem(const QString &fs);
+
+    /*
+     * Queue part of the data stream. Blocks if the target is too far behind.
+     * Returns false if the target failed
+     */
+    bool write(const QByteArray &data);
+
+    /*
+     * Signal end of data stream
+     */
+    void close();
+
+    /*
+     * Stop processing after an error elsewhere
+     */
+    void abort(const QString &msg);
+
+signals:
+    void status(int target, const QString &msg);
+    void progress(int target, int percent);
+    void failed(int target, const QString &msg);
+    void completed(int target);
+
+protected slots:
+    void onFormatStatus(const QString &msg);
+    void onFormatError(const QString &msg);
+
+protected:
+    int _index;
+    QString _drive, _bootdev, _datadev, _mountpoint, _error, _fs;
+    Installer *_i;
+    QSemaphore *_ready;
+    QMutex _mutex;
+    QWaitCondition _cond;
+    QQueue<QByteArray> _queue;
+    quint64 _expectedFiles, _expectedBytes, _buffered, _written;
+    bool _eof, _failed;
+
+    virtual void run();
+    bool format();
+    bool copyBootFiles();
+    void setMountOptions();
+    bool copyData();
+    bool verify();
+    bool fail(const QString &msg);
+};
+
+#endif // DUPLICATETHREAD_H
@@ -29,7 +29,7 @@
 #include "ui_editdialog.h"
 #include <QRegExp>
 
-EditDialog::EditDialog(const QString &filename, bool usingMemsplits, QWidget *parent) :
+EditDialog::EditDialog(const QString &filename, bool usingMemsplits, bool copyToRam, QWidget *parent) :
     QDialog(parent),
     ui(new Ui::EditDialog)
 {
@@ -61,6 +61,7 @@ EditDialog::EditDialog(const QString &filename, bool usingMemsplits, QWidget *pa
 
     if (usingMemsplits)
         ui->cmaLabel->setHidden(true);
+    ui->ramCheck->setChecked(copyToRam);
 }
 
 EditDialog::~EditDialog()
@@ -101,3 +102,8 @@ QString EditDialog::filename() const
 
     return f;
 }
+
+bool EditDialog::copyToRam() const
+{
+    return ui->ramCheck->isChecked();
+}
@@ -43,14 +43,20 @@ public:
      *
      * filename: OS image file name
      * usingMemsplits: if false display notice that memsplits are not being used
+     * copyToRam: image is copied to RAM before booting
      */
-    explicit EditDialog(const QString &filename, bool usingMemsplits, QWidget *parent = 0);
+    explicit EditDialog(const QString &filename, bool usingMemsplits, bool copyToRam, QWidget *parent = 0);
     ~EditDialog();
 
     /*
      * Returns new file name as edited by the user
      */
     QString filename() const;
+
+    /*
+     * Returns true if the user wants the image copied to RAM before booting
+     */
+    bool copyToRam() const;
     
 private:
     Ui::EditDialog *ui;
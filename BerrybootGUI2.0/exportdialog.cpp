@@ -26,18 +26,34 @@
 
 #include "exportdialog.h"
 #include "ui_exportdialog.h"
+#include "installer.h"
+#include <QSettings>
+#include <QMessageBox>
+#include <QThread>
 
-ExportDialog::ExportDialog(bool allowSingleImage, QWidget *parent) :
+ExportDialog::ExportDialog(Installer *i, bool allowSingleImage, QWidget *parent) :
     QDialog(parent),
-    ui(new Ui::ExportDialog)
+    ui(new Ui::ExportDialog),
+    _i(i)
 {
     ui->setupUi(this);
+    ui->processorsSpin->setMaximum(qMax(QThread::idealThreadCount(), 1));
+    ui->processorsSpin->setValue(ui->processorsSpin->maximum());
+
+    QSettings *s = _i->settings();
+    s->beginGroup("export");
+    ui->shareEdit->setText(s->value("url").toString());
+    ui->shareUserEdit->setText(s->value("user").toString());
+    ui->shareGroupbox->setChecked(!ui->shareEdit->text().isEmpty());
+    s->endGroup();
 
     if (!allowSingleImage)
     {
         ui->origRadio->setEnabled(false);
         ui->dataRadio->setEnabled(false);
         ui->compressCheck->setEnabled(false);
+        ui->compressionCombo->setEnabled(false);
+        ui->processorsSpin->setEnabled(false);
     }
 }
 
@@ -56,11 +72,26 @@ bool ExportDialog::compress() const
     return ui->compressCheck->isChecked();
 }
 
+QString ExportDialog::compressor() const
+{
+    return ui->compressionCombo->currentText();
+}
+
+int ExportDialog::processors() const
+{
+    return ui->processorsSpin->value();
+}
+
 bool ExportDialog::backupEverything() const
 {
     return ui->backupRadio->isChecked();
 }
 
+bool ExportDialog::diskImage() const
+{
+    return ui->imageRadio->isChecked();
+}
+
 bool ExportDialog::restore() const
 {
     return ui->restoreRadio->isChecked();
@@ -74,7 +105,54 @@ QStringList ExportDialog::excludeList() const
     return txt.split("\n", QString::SkipEmptyParts);
 }
 
+bool ExportDialog::networkShare() const
+{
+    return ui->shareGroupbox->isChecked() && !ui->restoreRadio->isChecked() && !ui->backupRadio->isChecked();
+}
+
+QByteArray ExportDialog::sharePassword() const
+{
+    return ui->sharePassEdit->text().toLatin1();
+}
+
+void ExportDialog::accept()
+{
+    QSettings *s = _i->settings();
+    QString url = ui->shareEdit->text().trimmed();
+
+    if (ui->shareGroupbox->isChecked() && !url.startsWith("cifs:") && !url.startsWith("nfs:"))
+    {
+        QMessageBox::critical(this, tr("Error"), tr("Network share URL must start with cifs: or nfs:"));
+        return;
+    }
+
+    s->beginGroup("export");
+    if (url.isEmpty())
+    {
+        s->remove("");
+    }
+    else
+    {
+        s->setValue("url", url);
+        if (ui->shareUserEdit->text().isEmpty())
+            s->remove("user");
+        else
+            s->setValue("user", ui->shareUserEdit->text());
+        /* Passwords saved by earlier versions */
+        s->remove("password");
+    }
+    s->endGroup();
+    s->sync();
+
+    QDialog::accept();
+}
+
 void ExportDialog::on_dataRadio_toggled(bool checked)
 {
     ui->excludeGroupbox->setEnabled(checked);
 }
+
+void ExportDialog::on_compressCheck_toggled(bool checked)
+{
+    ui->compressionCombo->setEnabled(checked);
+}
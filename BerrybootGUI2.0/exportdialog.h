@@ -34,13 +34,14 @@
 namespace Ui {
 class ExportDialog;
 }
+class Installer;
 
 class ExportDialog : public QDialog
 {
     Q_OBJECT
     
 public:
-    explicit ExportDialog(bool allowSingleImage, QWidget *parent = 0);
+    explicit ExportDialog(Installer *i, bool allowSingleImage, QWidget *parent = 0);
     ~ExportDialog();
 
     /*
@@ -48,6 +49,11 @@ public:
      */
     bool backupEverything() const;
 
+    /*
+     * True if the user wants a disk image of everything, instead of cloning to SD card
+     */
+    bool diskImage() const;
+
     /*
      * True if the file system modifications made by the user have to be exported as well
      */
@@ -58,6 +64,16 @@ public:
      */
     bool compress() const;
 
+    /*
+     * Returns the squashfs compressor to use (lzo, lz4, zstd or xz)
+     */
+    QString compressor() const;
+
+    /*
+     * Returns the number of processors mksquashfs may use
+     */
+    int processors() const;
+
     /*
      * True if import from USB stick is selected
      */
@@ -67,12 +83,26 @@ public:
      * Returns list of files to exclude from export
      */
     QStringList excludeList() const;
+
+    /*
+     * True if the export should be saved to the network share stored in the [export] section of berryboot.ini
+     */
+    bool networkShare() const;
+
+    /*
+     * Password for the network share. Only kept in memory, berryboot.ini is world-readable on the FAT partition
+     */
+    QByteArray sharePassword() const;
+
+    virtual void accept();
     
 private slots:
     void on_dataRadio_toggled(bool checked);
+    void on_compressCheck_toggled(bool checked);
 
 private:
     Ui::ExportDialog *ui;
+    Installer *_i;
 };
 
 #endif // EXPORTDIALOG_H
@@ -0,0 +1,323 @@
+/* Berryboot -- boot default image without starting the GUI
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fastboot.h"
+#include "boottrace.h"
+#include "mountmanager.h"
+#include "readaheadprofile.h"
+#include <QFile>
+#include <QDir>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QDebug>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <linux/netlink.h>
+#include <linux/input.h>
+#include <blkid/blkid.h>
+
+#define runonce_file  "/mnt/data/runonce"
+#define default_file  "/mnt/data/default"
+
+/* Time given to press a key to get the boot menu */
+#define KEY_WINDOW_MS  1000
+
+/* Returns a netlink socket receiving kernel uevents, or -1 */
+static int openUeventSocket()
+{
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;
+    int fd = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd != -1 && ::bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+/* Opens /dev/input/event* devices that are not in opened yet, and adds them to fds */
+static void openInputDevices(QStringList &opened, QVector<struct pollfd> &fds)
+{
+    QDir dir("/dev/input");
+    QStringList events = dir.entryList(QStringList("event*"), QDir::System);
+
+    foreach (QString event, events)
+    {
+        if (opened.contains(event))
+            continue;
+
+        int fd = ::open(QFile::encodeName("/dev/input/"+event).constData(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd != -1)
+        {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            fds.append(pfd);
+            opened.append(event);
+        }
+    }
+}
+
+FastBoot::FastBoot()
+{
+    QFile f("/proc/cmdline");
+    f.open(f.ReadOnly);
+    _cmdline = " "+f.readAll().trimmed()+" ";
+    f.close();
+}
+
+QByteArray FastBoot::bootParam(const QByteArray &name)
+{
+    QByteArray searchFor = " "+name+"=";
+    int pos = _cmdline.indexOf(searchFor);
+    if (pos == -1)
+        return "";
+
+    pos += searchFor.length();
+    return _cmdline.mid(pos, _cmdline.indexOf(' ', pos)-pos);
+}
+
+bool FastBoot::supported()
+{
+    if (bootParam("datadev").isEmpty() || bootParam("datadev") == "iscsi")
+        return false;
+
+    QStringList needGui;
+    needGui << " luks" << " reconfigure" << " ssh_authorized_key=" << " sound=" << " nofastboot";
+    foreach (QString option, needGui)
+    {
+        if (_cmdline.contains(option.toLatin1()))
+            return false;
+    }
+    if (bootParam("ipv4").endsWith("/wlan0"))
+        return false;
+
+    /* Memsplit handling (old Pi kernels) and A10 driver loading are done by the boot menu */
+    QFile f("/proc/cpuinfo");
+    f.open(f.ReadOnly);
+    QByteArray cpuinfo = f.readAll();
+    f.close();
+
+    return !cpuinfo.contains("BCM2708") && !cpuinfo.contains("sun4i") && !cpuinfo.contains("sun5i");
+}
+
+QByteArray FastBoot::waitForDataDevice(int timeout)
+{
+    QByteArray datadev = bootParam("datadev");
+    QElapsedTimer t;
+    t.start();
+
+    /* Listen for kernel uevents, so we notice as soon as a (USB) drive shows up */
+    int fd = openUeventSocket();
+
+    QByteArray dev;
+    while (true)
+    {
+        if (datadev.contains('='))
+        {
+            char *cstr = blkid_get_devname(NULL, datadev.constData(), NULL);
+            if (cstr)
+            {
+                dev = cstr;
+                free(cstr);
+            }
+        }
+        else if (QFile::exists("/dev/"+datadev))
+        {
+            dev = "/dev/"+datadev;
+        }
+
+        if (!dev.isEmpty() || fd == -1 || t.elapsed() >= timeout)
+            break;
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (::poll(&pfd, 1, (int) (timeout - t.elapsed())) > 0)
+        {
+            char buf[4096];
+            if (::recv(fd, buf, sizeof(buf), 0)) { }
+        }
+    }
+
+    if (fd != -1)
+        ::close(fd);
+
+    return dev;
+}
+
+bool FastBoot::mountDataPartition(const QByteArray &dev)
+{
+    /* Same options as BootMenuDialog::mountDataPartition(), but read-write straight away */
+    QByteArray options = bootParam("mountopts");
+    QByteArray fstype  = bootParam("fstype");
+    if (fstype.isEmpty())
+        fstype = "ext4";
+    if (options.isEmpty())
+        options = (fstype == "btrfs" ? "noatime,compress=lzo" : "noatime");
+
+    if (!QFile::exists("/mnt"))
+        ::mkdir("/mnt", 0755);
+
+    if (!MountManager::mount(dev, "/mnt", fstype, options))
+        return false;
+
+    if (!QFile::exists("/mnt/images"))
+    {
+        MountManager::umount("/mnt");
+        return false;
+    }
+
+    return true;
+}
+
+bool FastBoot::keyPressed(int window)
+{
+    QVector<struct pollfd> fds;
+    QStringList opened;
+
+    /* USB keyboards often show up during the window, so watch for new input devices as well.
+     * devtmpfs creates the device node before the uevent is sent */
+    int ueventfd = openUeventSocket();
+    if (ueventfd != -1)
+    {
+        struct pollfd pfd = { ueventfd, POLLIN, 0 };
+        fds.append(pfd);
+    }
+    openInputDevices(opened, fds);
+
+    bool pressed = false;
+    QElapsedTimer t;
+    t.start();
+
+    while (!pressed && !fds.isEmpty() && t.elapsed() < window)
+    {
+        if (::poll(fds.data(), fds.count(), (int) (window - t.elapsed())) <= 0)
+            break;
+
+        bool rescan = false;
+        for (int i=0; i<fds.count(); i++)
+        {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+
+            if (fds[i].fd == ueventfd)
+            {
+                char buf[4096];
+                while (::recv(ueventfd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+                    rescan = true;
+                continue;
+            }
+
+            struct input_event ev;
+            while (::read(fds[i].fd, &ev, sizeof(ev)) == sizeof(ev))
+            {
+                /* Key or mouse/touch button press */
+                if (ev.type == EV_KEY && ev.value == 1)
+                    pressed = true;
+            }
+        }
+
+        if (rescan)
+            openInputDevices(opened, fds);
+    }
+
+    for (int i=0; i<fds.count(); i++)
+        ::close(fds[i].fd);
+
+    return pressed;
+}
+
+bool FastBoot::run()
+{
+    if (!supported())
+        return false;
+
+    BootTraceScope trace("fast boot");
+
+    QByteArray dev = waitForDataDevice(10000);
+    if (dev.isEmpty() || !mountDataPartition(dev))
+        return false;
+
+    QByteArray answer;
+    QFile f(runonce_file);
+
+    if (f.exists())
+    {
+        f.open(f.ReadOnly);
+        answer = f.readAll();
+        f.close();
+        f.remove();
+        sync();
+        if (!answer.isEmpty())
+            ReadaheadProfile::prefetch(answer);
+    }
+    else if (bootParam("bootmenutimeout") == "0" && !_cmdline.contains(" nobootmenutimeout"))
+    {
+        f.setFileName(default_file);
+        if (f.open(f.ReadOnly))
+        {
+            answer = f.readAll();
+            f.close();
+        }
+        if (answer.isEmpty() || !QFile::exists("/mnt/images/"+answer))
+        {
+            /* No default set, boot menu would pick the first image */
+            QStringList images = QDir("/mnt/images").entryList(QDir::Files, QDir::Name);
+            answer = images.isEmpty() ? QByteArray() : images.first().toLatin1();
+        }
+
+        /* Let the readahead run while waiting for a key press */
+        if (!answer.isEmpty())
+            ReadaheadProfile::prefetch(answer);
+
+        if (!answer.isEmpty() && keyPressed(KEY_WINDOW_MS))
+        {
+            qDebug() << "Key pressed, showing boot menu";
+            answer.clear();
+        }
+    }
+
+    /* Copying the image to RAM shows progress in the GUI */
+    if (answer.isEmpty() || QFile::exists("/mnt/data/"+answer+"/copy_to_ram"))
+    {
+        MountManager::umount("/mnt");
+        return false;
+    }
+
+    f.setFileName("/tmp/answer");
+    f.open(f.WriteOnly);
+    f.write(answer);
+    f.close();
+
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef FASTBOOT_H
+#define FASTBOOT_H
+
+/* Berryboot -- boot default image without starting the GUI
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QByteArray>
+
+/*
+ * Boots the default image (with bootmenutimeout=0), or the runonce image,
+ * before QApplication and any widgets are constructed.
+ * Uses plain system calls only, as there is no event loop yet.
+ */
+class FastBoot
+{
+public:
+    FastBoot();
+
+    /*
+     * Returns true if /tmp/answer was written and the GUI does not need to be started.
+     * Returns false if the full boot menu is needed, e.g. because a key was pressed
+     */
+    bool run();
+
+protected:
+    QByteArray _cmdline;
+
+    QByteArray bootParam(const QByteArray &name);
+    /*
+     * False if any boot option needs the GUI (LUKS password, iSCSI, SSH, reconfigure, etc.)
+     */
+    bool supported();
+    /*
+     * Resolve datadev (e.g. sda1 or UUID=...) and wait for it to appear
+     */
+    QByteArray waitForDataDevice(int timeout);
+    bool mountDataPartition(const QByteArray &dev);
+    /*
+     * Watch evdev input devices for a key press during window (ms),
+     * including devices that are added during the window
+     */
+    bool keyPressed(int window);
+};
+
+#endif // FASTBOOT_H
@@ -0,0 +1,182 @@
+/* Berryboot -- firmware loader
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "firmwareloader.h"
+#include <QFile>
+#include <QDebug>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#define UEVENT_GROUP_KERNEL  1
+/* How often the thread checks if it should stop */
+#define POLL_INTERVAL_MS  500
+
+FirmwareLoader::FirmwareLoader(QObject *parent) :
+    QThread(parent), _fd(-1), _stop(false)
+{
+    struct sockaddr_nl addr;
+
+    /* Open the socket right away, so no request gets lost before the thread runs */
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = UEVENT_GROUP_KERNEL;
+    _fd = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (_fd != -1 && ::bind(_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        ::close(_fd);
+        _fd = -1;
+    }
+    if (_fd == -1)
+        qDebug() << "Error opening uevent socket for firmware loader";
+}
+
+FirmwareLoader::~FirmwareLoader()
+{
+    stop();
+    if (_fd != -1)
+        ::close(_fd);
+}
+
+void FirmwareLoader::stop()
+{
+    _stop = true;
+    wait();
+}
+
+void FirmwareLoader::run()
+{
+    char buf[4096];
+    struct pollfd pfd;
+
+    pfd.fd = _fd;
+    pfd.events = POLLIN;
+
+    while (!_stop && _fd != -1)
+    {
+        if (::poll(&pfd, 1, POLL_INTERVAL_MS) <= 0)
+            continue;
+
+        ssize_t len = ::recv(_fd, buf, sizeof(buf)-1, 0);
+        if (len <= 0)
+            continue;
+        buf[len] = 0;
+
+        /* Message is "action@devpath", followed by KEY=value pairs, all null terminated */
+        QByteArray action, devpath, firmware;
+        for (ssize_t pos = strlen(buf)+1; pos < len; pos += strlen(buf+pos)+1)
+        {
+            QByteArray var(buf+pos);
+
+            if (var.startsWith("ACTION="))
+                action = var.mid(7);
+            else if (var.startsWith("DEVPATH="))
+                devpath = var.mid(8);
+            else if (var.startsWith("FIRMWARE="))
+                firmware = var.mid(9);
+        }
+
+        if (action == "add" && !firmware.isEmpty() && !devpath.isEmpty())
+            loadFirmware(devpath, firmware);
+    }
+}
+
+bool FirmwareLoader::loadFirmware(const QByteArray &devpath, const QByteArray &firmware)
+{
+    static const char *searchPath[] = {
+        "/lib/firmware/updates", "/lib/firmware", "/mnt_shared_img/lib/firmware", "/mnt/shared/lib/firmware", NULL
+    };
+    QByteArray sysdir = "/sys"+devpath;
+    int fd = -1;
+
+    if (firmware.contains(".."))
+    {
+        writeSysfs(sysdir+"/loading", "-1");
+        return false;
+    }
+
+    for (int i = 0; searchPath[i] && fd == -1; i++)
+    {
+        fd = ::open((QByteArray(searchPath[i])+"/"+firmware).constData(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd == -1)
+    {
+        qDebug() << "Firmware not found:" << firmware;
+        /* Tell the driver right away, instead of letting it wait for the timeout */
+        writeSysfs(sysdir+"/loading", "-1");
+        return false;
+    }
+
+    bool ok = writeSysfs(sysdir+"/loading", "1");
+    int datafd = ok ? ::open((sysdir+"/data").constData(), O_WRONLY | O_CLOEXEC) : -1;
+    ok = (datafd != -1);
+
+    char buf[65536];
+    ssize_t len = 0;
+    while (ok && (len = ::read(fd, buf, sizeof(buf))) > 0)
+    {
+        for (ssize_t pos = 0; pos < len; )
+        {
+            ssize_t written = ::write(datafd, buf+pos, len-pos);
+            if (written <= 0)
+            {
+                if (written == -1 && errno == EINTR)
+                    continue;
+                ok = false;
+                break;
+            }
+            pos += written;
+        }
+    }
+    if (len < 0)
+        ok = false;
+
+    if (datafd != -1)
+        ::close(datafd);
+    ::close(fd);
+
+    writeSysfs(sysdir+"/loading", ok ? "0" : "-1");
+    if (!ok)
+        qDebug() << "Error loading firmware" << firmware << "for" << devpath;
+
+    return ok;
+}
+
+bool FirmwareLoader::writeSysfs(const QByteArray &file, const QByteArray &value)
+{
+    int fd = ::open(file.constData(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    bool ok = ::write(fd, value.constData(), value.size()) == value.size();
+    ::close(fd);
+
+    return ok;
+}
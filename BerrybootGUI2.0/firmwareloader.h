@@ -0,0 +1,62 @@
+#ifndef FIRMWARELOADER_H
+#define FIRMWARELOADER_H
+
+/* Berryboot -- firmware loader
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QThread>
+#include <QByteArray>
+
+/*
+ * Answers firmware requests of drivers when udevd is not running
+ *
+ * Listens for "add" uevents carrying FIRMWARE=, and streams the file from
+ * /lib/firmware (or shared.img) into the sysfs loading/data interface.
+ * Runs in its own thread, so a driver loaded from the GUI thread
+ * waiting for its firmware cannot block the request.
+ */
+class FirmwareLoader : public QThread
+{
+    Q_OBJECT
+public:
+    explicit FirmwareLoader(QObject *parent = 0);
+    virtual ~FirmwareLoader();
+
+    /*
+     * Stop listening and wait for thread to finish
+     */
+    void stop();
+
+protected:
+    int _fd;
+    volatile bool _stop;
+
+    virtual void run();
+    static bool loadFirmware(const QByteArray &devpath, const QByteArray &firmware);
+    static bool writeSysfs(const QByteArray &file, const QByteArray &value);
+};
+
+#endif // FIRMWARELOADER_H
@@ -0,0 +1,449 @@
+/* Berryboot -- file system probe
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fsprobe.h"
+#include <QFile>
+#include <QRegExp>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QThread>
+#include <QtEndian>
+#include <QDebug>
+
+/* Root directories are small. Stop reading on corrupted or huge ones */
+#define MAX_DIR_SIZE        (1024*1024)
+#define EXT4_SUPERBLOCK_OFFSET  1024
+#define EXT4_SUPER_MAGIC        0xEF53
+#define EXT4_ROOT_INO           2
+#define EXT4_EXTENTS_FL         0x80000
+#define EXT4_INLINE_DATA_FL     0x10000000
+#define EXT4_EXTENT_MAGIC       0xF30A
+#define EXT4_FEATURE_INCOMPAT_64BIT  0x80
+
+static inline quint16 le16(const char *p)
+{
+    return qFromLittleEndian<quint16>((const uchar *) p);
+}
+
+static inline quint32 le32(const char *p)
+{
+    return qFromLittleEndian<quint32>((const uchar *) p);
+}
+
+/* UTF-16 name, terminated by 0x0000 or padded with 0xFFFF */
+static QString utf16name(const char *p, int chars)
+{
+    QString s;
+
+    for (int i=0; i<chars; i++)
+    {
+        ushort c = le16(p+i*2);
+        if (c == 0x0000 || c == 0xFFFF)
+            break;
+        s += QChar(c);
+    }
+
+    return s;
+}
+
+class FsProbeRunnable : public QRunnable
+{
+public:
+    FsProbeRunnable(FsProbe *probe) : _probe(probe)
+    {
+    }
+
+    virtual void run()
+    {
+        _probe->probe();
+    }
+
+protected:
+    FsProbe *_probe;
+};
+
+FsProbe::FsProbe(const QByteArray &device) : _device(device), _type(Unknown)
+{
+}
+
+QByteArray FsProbe::device() const
+{
+    return _device;
+}
+
+FsProbe::Type FsProbe::type() const
+{
+    return _type;
+}
+
+QByteArray FsProbe::typeName() const
+{
+    switch (_type)
+    {
+    case Fat:
+        return "vfat";
+    case ExFat:
+        return "exfat";
+    case Ext4:
+        return "ext4";
+    default:
+        return "";
+    }
+}
+
+QStringList FsProbe::rootDirectory() const
+{
+    return _rootDirectory;
+}
+
+bool FsProbe::hasFile(const QString &pattern) const
+{
+    QRegExp rx(pattern, Qt::CaseInsensitive, QRegExp::Wildcard);
+
+    foreach (QString name, _rootDirectory)
+    {
+        if (rx.exactMatch(name))
+            return true;
+    }
+
+    return false;
+}
+
+QList<FsProbe> FsProbe::probeAll(const QList<QByteArray> &devices)
+{
+    QList<FsProbe> probes;
+    foreach (QByteArray dev, devices)
+        probes.append(FsProbe(dev));
+
+    /* Probes spend their time waiting for the devices, not the CPU */
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(probes.count(), 1));
+    for (int i=0; i<probes.count(); i++)
+        pool.start(new FsProbeRunnable(&probes[i]));
+    pool.waitForDone();
+
+    return probes;
+}
+
+QByteArray FsProbe::readAt(QFile &f, qint64 pos, qint64 len)
+{
+    if (pos < 0 || len <= 0 || len > MAX_DIR_SIZE || !f.seek(pos))
+        return QByteArray();
+
+    QByteArray data = f.read(len);
+    if (data.size() != len)
+        data.clear();
+
+    return data;
+}
+
+bool FsProbe::probe()
+{
+    QFile f("/dev/"+_device);
+    _type = Unknown;
+    _rootDirectory.clear();
+
+    if (!f.open(f.ReadOnly))
+        return false;
+
+    QByteArray bootSector = readAt(f, 0, 512);
+    QByteArray superBlock = readAt(f, EXT4_SUPERBLOCK_OFFSET, 1024);
+    if (bootSector.isEmpty())
+        return false;
+
+    if (superBlock.size() == 1024 && le16(superBlock.constData()+56) == EXT4_SUPER_MAGIC)
+        return probeExt4(f, superBlock);
+    if (bootSector.mid(3, 8) == "EXFAT   ")
+        return probeExFat(f, bootSector);
+    if ((uchar) bootSector[510] == 0x55 && (uchar) bootSector[511] == 0xAA)
+        return probeFat(f, bootSector);
+
+    return false;
+}
+
+bool FsProbe::probeFat(QFile &f, const QByteArray &bootSector)
+{
+    const char *b = bootSector.constData();
+    quint32 bytesPerSector    = le16(b+11);
+    quint32 sectorsPerCluster = (uchar) b[13];
+    quint32 reservedSectors   = le16(b+14);
+    quint32 numFats           = (uchar) b[16];
+    quint32 rootEntries       = le16(b+17);
+    quint32 fatSize           = le16(b+22);
+
+    /* Not a FAT boot sector, e.g. MBR of a partitioned disk */
+    if ((bytesPerSector != 512 && bytesPerSector != 1024 && bytesPerSector != 2048 && bytesPerSector != 4096)
+            || sectorsPerCluster == 0 || (sectorsPerCluster & (sectorsPerCluster-1))
+            || reservedSectors == 0 || numFats == 0)
+        return false;
+
+    QByteArray dir;
+    if (fatSize == 0 && rootEntries == 0)
+    {
+        /* FAT32: root directory is a cluster chain */
+        fatSize = le32(b+36);
+        quint32 cluster = le32(b+44);
+        qint64 fatOffset = qint64(reservedSectors) * bytesPerSector;
+        qint64 dataOffset = fatOffset + qint64(numFats) * fatSize * bytesPerSector;
+        qint64 clusterSize = qint64(sectorsPerCluster) * bytesPerSector;
+
+        while (cluster >= 2 && cluster < 0x0FFFFFF8 && dir.size() < MAX_DIR_SIZE)
+        {
+            QByteArray data = readAt(f, dataOffset + (cluster-2) * clusterSize, clusterSize);
+            QByteArray next = readAt(f, fatOffset + cluster * 4, 4);
+            if (data.isEmpty() || next.isEmpty())
+                return false;
+
+            dir += data;
+            cluster = le32(next.constData()) & 0x0FFFFFFF;
+        }
+    }
+    else
+    {
+        /* FAT12/16: fixed size root directory after the FATs */
+        dir = readAt(f, qint64(reservedSectors + numFats * fatSize) * bytesPerSector, qMin(rootEntries * 32, (quint32) MAX_DIR_SIZE));
+        if (dir.isEmpty())
+            return false;
+    }
+
+    QString longName;
+    for (int pos = 0; pos+32 <= dir.size(); pos += 32)
+    {
+        const char *e = dir.constData()+pos;
+        uchar first = e[0], attr = e[11];
+
+        if (first == 0x00)
+            break;
+        if (first == 0xE5)
+        {
+            longName.clear();
+            continue;
+        }
+
+        if (attr == 0x0F)
+        {
+            /* Long file name entry. These come before the 8.3 entry, last part first */
+            QString part = utf16name(e+1, 5);
+            if (part.size() == 5)
+                part += utf16name(e+14, 6);
+            if (part.size() == 11)
+                part += utf16name(e+28, 2);
+
+            longName = (first & 0x40) ? part : part+longName;
+            continue;
+        }
+
+        /* Skip volume label */
+        if (!(attr & 0x08))
+        {
+            if (!longName.isEmpty())
+            {
+                _rootDirectory.append(longName);
+            }
+            else
+            {
+                QString name = QString::fromLatin1(e, 8).trimmed(), ext = QString::fromLatin1(e+8, 3).trimmed();
+                _rootDirectory.append(ext.isEmpty() ? name : name+"."+ext);
+            }
+        }
+        longName.clear();
+    }
+
+    _type = Fat;
+    return true;
+}
+
+bool FsProbe::probeExFat(QFile &f, const QByteArray &bootSector)
+{
+    const char *b = bootSector.constData();
+    quint32 fatOffset         = le32(b+80);
+    quint32 clusterHeapOffset = le32(b+88);
+    quint32 cluster           = le32(b+96);
+    int bytesPerSectorShift   = (uchar) b[108];
+    int sectorsPerClusterShift = (uchar) b[109];
+
+    if (bytesPerSectorShift < 9 || bytesPerSectorShift > 12 || bytesPerSectorShift+sectorsPerClusterShift > 25)
+        return false;
+
+    qint64 clusterSize = qint64(1) << (bytesPerSectorShift+sectorsPerClusterShift);
+    QByteArray dir;
+
+    while (cluster >= 2 && cluster < 0xFFFFFFF7 && dir.size() < MAX_DIR_SIZE)
+    {
+        QByteArray data = readAt(f, (qint64(clusterHeapOffset) << bytesPerSectorShift) + (cluster-2) * clusterSize, clusterSize);
+        QByteArray next = readAt(f, (qint64(fatOffset) << bytesPerSectorShift) + qint64(cluster) * 4, 4);
+        if (data.isEmpty() || next.isEmpty())
+            return false;
+
+        dir += data;
+        cluster = le32(next.constData());
+    }
+
+    /* File entry (0x85), followed by stream extension (0xC0) and file name entries (0xC1) */
+    for (int pos = 0; pos+32 <= dir.size(); pos += 32)
+    {
+        const char *e = dir.constData()+pos;
+        uchar entryType = e[0];
+
+        if (entryType == 0x00)
+            break;
+        if (entryType != 0x85)
+            continue;
+
+        int secondaryCount = (uchar) e[1];
+        if (pos + (secondaryCount+1)*32 > dir.size() || secondaryCount < 2 || (uchar) e[32] != 0xC0)
+            continue;
+
+        int nameLength = (uchar) e[32+3];
+        QString name;
+        for (int i=2; i<=secondaryCount && name.size() < nameLength; i++)
+        {
+            const char *n = e+i*32;
+            if ((uchar) n[0] != 0xC1)
+                break;
+            name += utf16name(n+2, qMin(15, nameLength-name.size()));
+        }
+
+        _rootDirectory.append(name);
+        pos += secondaryCount*32;
+    }
+
+    _type = ExFat;
+    return true;
+}
+
+bool FsProbe::readExtents(QFile &f, const QByteArray &node, quint32 blockSize, int depth, QByteArray &data)
+{
+    const char *h = node.constData();
+    if (node.size() < 12 || le16(h) != EXT4_EXTENT_MAGIC || depth > 5)
+        return false;
+
+    int entries = le16(h+2);
+    bool leaf = (le16(h+6) == 0);
+
+    for (int i=0; i<entries && 12+(i+1)*12 <= node.size(); i++)
+    {
+        const char *e = h+12+i*12;
+
+        if (leaf)
+        {
+            quint32 len = le16(e+4);
+            if (len > 32768) /* Uninitialized extent */
+                continue;
+            qint64 start = (qint64(le16(e+6)) << 32) | le32(e+8);
+            QByteArray blocks = readAt(f, start*blockSize, qint64(len)*blockSize);
+            if (blocks.isEmpty())
+                return false;
+            data += blocks;
+        }
+        else
+        {
+            qint64 leafBlock = (qint64(le16(e+8)) << 32) | le32(e+4);
+            if (!readExtents(f, readAt(f, leafBlock*blockSize, blockSize), blockSize, depth+1, data))
+                return false;
+        }
+
+        if (data.size() >= MAX_DIR_SIZE)
+            break;
+    }
+
+    return true;
+}
+
+bool FsProbe::probeExt4(QFile &f, const QByteArray &superBlock)
+{
+    const char *s = superBlock.constData();
+    quint32 firstDataBlock = le32(s+20);
+    quint32 logBlockSize   = le32(s+24);
+    quint32 inodesPerGroup = le32(s+40);
+    quint32 revLevel       = le32(s+76);
+    quint32 inodeSize      = (revLevel >= 1 ? le16(s+88) : 128);
+    quint32 incompat       = le32(s+96);
+    quint32 descSize       = ((incompat & EXT4_FEATURE_INCOMPAT_64BIT) ? le16(s+254) : 32);
+
+    if (logBlockSize > 6 || inodesPerGroup == 0 || inodeSize < 128 || descSize < 32)
+        return false;
+    quint32 blockSize = 1024 << logBlockSize;
+
+    /* Root directory inode is the second inode of group 0 */
+    QByteArray desc = readAt(f, qint64(firstDataBlock+1) * blockSize, descSize);
+    if (desc.isEmpty())
+        return false;
+    qint64 inodeTable = le32(desc.constData()+8);
+    if (descSize >= 64)
+        inodeTable |= qint64(le32(desc.constData()+0x28)) << 32;
+
+    QByteArray inode = readAt(f, inodeTable*blockSize + (EXT4_ROOT_INO-1)*inodeSize, inodeSize);
+    if (inode.isEmpty())
+        return false;
+
+    quint32 flags = le32(inode.constData()+0x20);
+    QByteArray iblock = inode.mid(0x28, 60);
+    QByteArray dir;
+
+    if (flags & EXT4_INLINE_DATA_FL)
+    {
+        return false;
+    }
+    else if (flags & EXT4_EXTENTS_FL)
+    {
+        if (!readExtents(f, iblock, blockSize, 0, dir))
+            return false;
+    }
+    else
+    {
+        /* ext2/3 block map. Root directory fits in the direct blocks */
+        for (int i=0; i<12; i++)
+        {
+            quint32 block = le32(iblock.constData()+i*4);
+            if (!block)
+                break;
+            dir += readAt(f, qint64(block)*blockSize, blockSize);
+        }
+    }
+
+    for (int pos = 0; pos+8 <= dir.size(); )
+    {
+        const char *e = dir.constData()+pos;
+        quint32 ino     = le32(e);
+        quint16 recLen  = le16(e+4);
+        int nameLen     = (uchar) e[6];
+
+        if (recLen < 8 || pos+recLen > dir.size())
+            break;
+
+        if (ino && nameLen && 8+nameLen <= recLen)
+        {
+            QString name = QString::fromUtf8(e+8, nameLen);
+            if (name != "." && name != "..")
+                _rootDirectory.append(name);
+        }
+        pos += recLen;
+    }
+
+    _type = Ext4;
+    return true;
+}
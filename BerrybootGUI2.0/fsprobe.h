@@ -0,0 +1,81 @@
+#ifndef FSPROBE_H
+#define FSPROBE_H
+
+/* Berryboot -- file system probe
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+class QFile;
+
+/*
+ * Reads the root directory of a FAT, exFAT or ext2/3/4 file system straight from the device,
+ * to find out if it has files of interest without mounting it
+ */
+class FsProbe
+{
+public:
+    enum Type { Unknown, Fat, ExFat, Ext4 };
+
+    explicit FsProbe(const QByteArray &device = QByteArray());
+
+    /*
+     * Detect file system and read root directory. Returns false if not supported
+     */
+    bool probe();
+    QByteArray device() const;
+    Type type() const;
+    /*
+     * File system type as passed to mount -t, empty if unknown
+     */
+    QByteArray typeName() const;
+    QStringList rootDirectory() const;
+    /*
+     * True if root directory has a file matching wildcard (e.g. "*.img*"), case-insensitive
+     */
+    bool hasFile(const QString &pattern) const;
+
+    /*
+     * Probe devices (e.g. sda1) in parallel
+     */
+    static QList<FsProbe> probeAll(const QList<QByteArray> &devices);
+
+protected:
+    QByteArray _device;
+    Type _type;
+    QStringList _rootDirectory;
+
+    bool probeFat(QFile &f, const QByteArray &bootSector);
+    bool probeExFat(QFile &f, const QByteArray &bootSector);
+    bool probeExt4(QFile &f, const QByteArray &superBlock);
+    bool readExtents(QFile &f, const QByteArray &node, quint32 blockSize, int depth, QByteArray &data);
+    static QByteArray readAt(QFile &f, qint64 pos, qint64 len);
+};
+
+#endif // FSPROBE_H
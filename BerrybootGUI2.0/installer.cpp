@@ -27,13 +27,18 @@
 
 #include "installer.h"
 #include "ceclistener.h"
+#include "cryptoprofile.h"
+#include "devicemonitor.h"
+#include "deviceindex.h"
+#include "fsprobe.h"
+#include "moduleloader.h"
+#include "mountmanager.h"
 #include <QProcess>
 #include <QFile>
 #include <QDir>
 #include <QDebug>
 #include <QMessageBox>
 #include <QSettings>
-#include <QTimer>
 #include <QTime>
 #include <QApplication>
 
@@ -41,11 +46,11 @@
 #define HAVE_STATVFS 1
 #include <sys/statvfs.h>
 #include <sys/stat.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <sys/reboot.h>
 #include <sys/ioctl.h>
 #include <linux/vt.h>
-#include <blkid/blkid.h>
 
 #ifdef Q_WS_QWS
 #include <QWSServer>
@@ -59,20 +64,54 @@
 Installer::Installer(QObject *parent) :
     QObject(parent), _ethup(false), _skipConfig(false), _settings(NULL)
 {
+    _deviceMonitor = new DeviceMonitor(this);
+    _deviceIndex   = new DeviceIndex(_deviceMonitor, this);
+    _moduleLoader  = new ModuleLoader(this);
 }
 
 bool Installer::saveBootFiles()
 {
-    return QProcess::execute("cp -a /boot /tmp") == 0;
+    if (!_bootFiles.save("/boot"))
+    {
+        qDebug() << _bootFiles.errorString();
+        return false;
+    }
+
+    return true;
 }
 
 bool Installer::restoreBootFiles()
 {
-    bool status = QProcess::execute("cp -a /tmp/boot /") == 0;
-    QProcess::execute("rm -rf /tmp/boot");
+    QString error;
+    bool status = _bootFiles.restore("/boot", &error);
+
+    if (!status)
+        qDebug() << error;
+    _bootFiles.clear();
+
     return status;
 }
 
+BootFileSnapshot *Installer::bootFiles()
+{
+    return &_bootFiles;
+}
+
+DeviceMonitor *Installer::deviceMonitor()
+{
+    return _deviceMonitor;
+}
+
+DeviceIndex *Installer::deviceIndex()
+{
+    return _deviceIndex;
+}
+
+ModuleLoader *Installer::moduleLoader()
+{
+    return _moduleLoader;
+}
+
 int Installer::sizeofBootFilesInKB()
 {
     QProcess proc;
@@ -170,7 +209,7 @@ QByteArray Installer::bootdev()
 QByteArray Installer::findBootPart()
 {
     /* Search for partition with berryboot.img */
-    QByteArray part;
+    QList<QByteArray> candidates;
     QString dirname  = "/sys/class/block";
     QDir    dir(dirname);
     QStringList list = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
@@ -182,27 +221,25 @@ QByteArray Installer::findBootPart()
                 || QFile::symLinkTarget("/sys/class/block/"+devname).contains("/devices/virtual/"))
             continue;
 
-        if (QProcess::execute("mount -t vfat -o ro /dev/"+devname+" /boot") == 0)
-        {
-            if (QFile::exists("/boot/berryboot.img"))
-            {
-                qDebug() << "Found berryboot.img at" << devname;
-                part = devname.toLatin1();
-            }
+        candidates.append(devname.toLatin1());
+    }
 
-            QProcess::execute("umount /boot");
+    /* Read the FAT root directories straight from the devices, instead of mounting each one */
+    foreach (const FsProbe &probe, FsProbe::probeAll(candidates))
+    {
+        if (probe.type() == FsProbe::Fat && probe.hasFile("berryboot.img"))
+        {
+            qDebug() << "Found berryboot.img at" << probe.device();
+            return probe.device();
         }
-
-        if (!part.isEmpty())
-            break;
     }
 
-    return part;
+    return QByteArray();
 }
 
 void Installer::initializeDataPartition(const QString &dev)
 {
-    if (QProcess::execute("mount /dev/"+dev+" /mnt") != 0)
+    if (!MountManager::mount("/dev/"+dev.toLatin1(), "/mnt"))
     {
         log_error(tr("Error mounting data partition"));
         return;
@@ -222,13 +259,8 @@ void Installer::initializeDataPartition(const QString &dev)
         if (result != 0)
             log_error(tr("Error extracting shared.tgz ")+QString::number(result) );
     }
-    fi.setFile("/boot/shared.img");
-    if (fi.exists())
-    {
-        int result = system("/usr/bin/unsquashfs -d /mnt/shared -f /boot/shared.img");
-        if (result != 0)
-            log_error(tr("Error extracting shared.img ")+QString::number(result) );
-    }
+    if (QFile::exists("/boot/shared.img") && !installSharedImage())
+        log_error(tr("Error copying shared.img to data partition"));
 
     if (!_timezone.isEmpty())
     {
@@ -297,12 +329,22 @@ void Installer::initializeDataPartition(const QString &dev)
     s->endGroup();
 }
 
+bool Installer::installSharedImage()
+{
+    /* Copy to temporary name first, so a running system never sees a partial image */
+    QFile::remove("/mnt/shared.img.new");
+    if (!QFile::copy("/boot/shared.img", "/mnt/shared.img.new"))
+        return false;
+
+    return ::rename("/mnt/shared.img.new", "/mnt/shared.img") == 0;
+}
+
 bool Installer::mountSystemPartition()
 {
     if (isPxeBoot())
         return true;
 
-    return QProcess::execute("mount /dev/"+bootdev()+" /boot") == 0;
+    return MountManager::mount("/dev/"+bootdev(), "/boot");
 }
 
 void Installer::startNetworking()
@@ -312,8 +354,8 @@ void Installer::startNetworking()
 
     if (!f.exists())
     {
-        /* eth0 not available yet, check back in a tenth of a second */
-        QTimer::singleShot(100, this, SLOT(startNetworking()));
+        /* eth0 not available yet, check back when it shows up */
+        connect(_deviceMonitor, SIGNAL(linkChanged(QString)), this, SLOT(startNetworking()), Qt::UniqueConnection);
         return;
     }
 
@@ -327,11 +369,12 @@ void Installer::startNetworking()
     }
     if (carrier != "1")
     {
-        /* check back in a tenth of a second */
-        QTimer::singleShot(100, this, SLOT(startNetworking()));
+        /* check back when the cable is plugged in */
+        connect(_deviceMonitor, SIGNAL(linkChanged(QString)), this, SLOT(startNetworking()), Qt::UniqueConnection);
         return;
     }
 
+    disconnect(_deviceMonitor, SIGNAL(linkChanged(QString)), this, SLOT(startNetworking()));
     QProcess *proc = new QProcess(this);
     connect(proc, SIGNAL(finished(int)), SLOT(ifupFinished(int)));
     proc->start("/sbin/ifup eth0");
@@ -347,11 +390,12 @@ void Installer::startNetworkInterface()
 
     if (!f.exists())
     {
-        /* eth0 not available yet, check back in a tenth of a second */
-        QTimer::singleShot(100, this, SLOT(startNetworkInterface()));
+        /* eth0 not available yet, check back when it shows up */
+        connect(_deviceMonitor, SIGNAL(linkChanged(QString)), this, SLOT(startNetworkInterface()), Qt::UniqueConnection);
         return;
     }
 
+    disconnect(_deviceMonitor, SIGNAL(linkChanged(QString)), this, SLOT(startNetworkInterface()));
     QProcess::startDetached("/sbin/ifconfig eth0 up");
     _ethup = true;
 }
@@ -373,7 +417,8 @@ bool Installer::umountSystemPartition()
     if (isPxeBoot())
         return true;
 
-    if ( QProcess::execute("umount /boot") != 0)
+    /* Callers depend on it really being unmounted, e.g. before repartitioning */
+    if (!MountManager::umount("/boot", MountManager::AllReferences))
     {
         log_error(tr("Error unmounting system partition"));
         return false;
@@ -435,7 +480,7 @@ void Installer::reboot()
 {
     QProcess::execute("killall udevd");
     ::usleep(100000);
-    QProcess::execute("umount -ar");
+    MountManager::umountAll();
     sync();
     QProcess::execute("ifdown -a");
     ::reboot(RB_AUTOBOOT);
@@ -552,9 +597,46 @@ void Installer::deleteUserChanges(const QString &name)
     if (name.isEmpty())
         return;
 
+    /* The copy to RAM setting is not a change made by the OS, keep it */
+    bool copyToRam = isCopyToRamEnabled(name);
+
     QStringList param;
     param << "-rf" << "/mnt/data/"+name;
     QProcess::execute("rm", param); /* TODO write proper Qt function for recursive delete*/
+
+    if (copyToRam)
+        setCopyToRam(name, true);
+}
+
+bool Installer::isCopyToRamEnabled(const QString &name)
+{
+    return !name.isEmpty() && QFile::exists("/mnt/data/"+name+"/copy_to_ram");
+}
+
+void Installer::setCopyToRam(const QString &name, bool enable)
+{
+    if (name.isEmpty())
+        return;
+
+    if (enable)
+    {
+        /* If the data directory is new, create the work directory as well, or init would fall back to aufs.
+           An existing data directory without one was created under aufs, and must stay on aufs */
+        QDir dir;
+        if (!dir.exists("/mnt/data/"+name))
+        {
+            dir.mkpath("/mnt/data/"+name);
+            dir.mkpath("/mnt/data/"+name+".work");
+        }
+
+        QFile f("/mnt/data/"+name+"/copy_to_ram");
+        f.open(f.WriteOnly);
+        f.close();
+    }
+    else
+    {
+        QFile::remove("/mnt/data/"+name+"/copy_to_ram");
+    }
 }
 
 void Installer::cloneImage(const QString &oldname, const QString &newname, bool clonedata)
@@ -694,12 +776,14 @@ void Installer::prepareDrivers()
                 // show error?
             }
         }
-        else if (QFile::exists("/boot/shared.img"))
+        else if (QFile::exists("/mnt/shared.img") || QFile::exists("/boot/shared.img"))
         {
-            /* Not yet installed, but shared.img squahsfs file with drivers available */
+            /* shared.img squashfs file with drivers available, either installed on the data partition,
+               or on the boot partition if not yet installed */
+            QString image = QFile::exists("/mnt/shared.img") ? "/mnt/shared.img" : "/boot/shared.img";
             QDir dir;
             dir.mkdir("/mnt_shared_img");
-            QProcess::execute("mount -o loop,ro /boot/shared.img /mnt_shared_img");
+            MountManager::mountImage(image.toLatin1(), "/mnt_shared_img", "squashfs");
             if (symlink("/mnt_shared_img/lib/modules", "/lib/modules")
              || symlink("/mnt_shared_img/lib/firmware", "/lib/firmware"))
             {
@@ -720,9 +804,11 @@ void Installer::cleanupDrivers()
 
     if (dir.exists("/mnt_shared_img"))
     {
+        /* libkmod keeps the module index files open */
+        _moduleLoader->close();
         QProcess::execute("killall udevd");
         ::usleep(100000);
-        QProcess::execute("umount /mnt_shared_img");
+        MountManager::umount("/mnt_shared_img", MountManager::AllReferences);
         dir.rmdir("/mnt_shared_img");
         dir.rmdir("/lib/modules");
         dir.rmdir("/lib/firmware");
@@ -739,7 +825,7 @@ void Installer::loadDrivers()
         {
             QFile f("/proc/sys/kernel/hotplug");
             f.open(f.WriteOnly);
-            f.write("\0\0\0\0");
+            f.write("\n");
             f.close();
 
             QProcess::execute("/sbin/udevd --daemon");
@@ -748,17 +834,19 @@ void Installer::loadDrivers()
     }
     else
     {
-        /* Tell the kernel to contact our /sbin/hotplug helper script,
-           if a module wants firmware to be loaded */
+        /* Answer firmware requests from the uevent socket,
+           instead of having the kernel fork a helper for every event */
         QFile f("/proc/sys/kernel/hotplug");
         f.open(f.WriteOnly);
-        f.write("/sbin/hotplug\n");
+        f.write("\n");
         f.close();
+        _deviceMonitor->startFirmwareLoader();
 
-        /* Load drivers for USB devices found */
+        /* Load drivers for USB devices found, resolving all modaliases in one go */
         QString dirname  = "/sys/bus/usb/devices";
         QDir    dir(dirname);
         QStringList list = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+        QStringList aliases;
 
         foreach (QString dev, list)
         {
@@ -767,27 +855,22 @@ void Installer::loadDrivers()
             {
                 f.setFileName(modalias_file);
                 f.open(f.ReadOnly);
-                QString module = f.readAll().trimmed();
+                aliases.append(f.readAll().trimmed());
                 f.close();
-                QProcess::execute("/sbin/modprobe "+module);
             }
         }
+        aliases.removeDuplicates();
+        if (!aliases.isEmpty())
+            _moduleLoader->load(aliases, "usb");
     }
 }
 
-void Installer::loadCryptoModules()
+void Installer::loadCryptoModules(const QByteArray &cipher)
 {
     prepareDrivers();
 
-    QProcess::execute("/sbin/modprobe dm_crypt");
-    QProcess::execute("/sbin/modprobe aes");
-    QProcess::execute("/sbin/modprobe sha256");
-    QProcess::execute("/sbin/modprobe aes_arm_bs");
-    QProcess::execute("/sbin/modprobe aes_arm");
-    QProcess::execute("/sbin/modprobe xts");
-    QProcess::execute("/sbin/modprobe hmac");
-    QProcess::execute("/sbin/modprobe algif_hash");
-    QProcess::execute("/sbin/modprobe algif_skcipher");
+    QStringList modules = _moduleLoader->available(CryptoProfile::modulesForCipher(cipher));
+    _moduleLoader->load(modules, "crypto");
 }
 
 void Installer::loadSoundModule(const QByteArray &channel)
@@ -796,7 +879,7 @@ void Installer::loadSoundModule(const QByteArray &channel)
     {
         /* Raspberry Pi */
         prepareDrivers();
-        QProcess::execute("/sbin/modprobe snd-bcm2835");
+        _moduleLoader->load(QStringList("snd-bcm2835"), "sound");
 
         if (channel == "headphones")
         {
@@ -820,10 +903,75 @@ void Installer::loadFilesystemModule(const QByteArray &fs)
     if (!fsSupported.contains(fs))
     {
         prepareDrivers();
-        QProcess::execute("/sbin/modprobe "+fs);
+        _moduleLoader->load(QStringList(fs), "fs");
     }
 }
 
+void Installer::preloadModules()
+{
+    QStringList modules = _moduleLoader->recorded();
+
+    if (!modules.isEmpty())
+    {
+        prepareDrivers();
+        _moduleLoader->load(modules);
+    }
+}
+
+/* Mount cifs://server/share or nfs:server:/path share */
+bool Installer::mountNetworkShare(const QByteArray &url, QByteArray username, const QByteArray &password, const QString &mountpoint)
+{
+    QByteArray shareType, share;
+    QStringList args;
+
+    if (url.startsWith("cifs:"))
+    {
+        shareType = "cifs";
+        share = url.mid(5);
+        if (username.isEmpty())
+            username = "guest";
+    }
+    else if (url.startsWith("nfs:"))
+    {
+        shareType = "nfs";
+        share = url.mid(4);
+        /* Ask for the largest transfer size, server negotiates it down if needed */
+        args << "-o" << "nolock,rsize=1048576,wsize=1048576";
+    }
+    else
+    {
+        return false;
+    }
+
+    loadFilesystemModule(shareType);
+
+    QDir dir(mountpoint);
+    if (dir.exists())
+    {
+        MountManager::umount(mountpoint.toLatin1(), MountManager::AllReferences);
+    }
+    else
+    {
+        dir.mkdir(mountpoint);
+    }
+
+    args << "-t" << shareType << share << mountpoint;
+
+    if (!username.isEmpty())
+    {
+        args << "-o" << "username="+username;
+        if (!password.isEmpty())
+            args << "-o" << "password="+password;
+    }
+    if (QProcess::execute("mount", args) != 0)
+    {
+        dir.rmdir(mountpoint);
+        return false;
+    }
+
+    return true;
+}
+
 void Installer::startWifi()
 {
     loadDrivers();
@@ -1043,51 +1191,30 @@ QByteArray Installer::uuidOfDevice(QByteArray device)
 {
     QByteArray uuid = device;
 
-    if (!device.startsWith("/dev/"))
-        device = "/dev/"+device;
-
-    char *uuid_cstr = blkid_get_tag_value(NULL, "UUID", device.constData());
+    if (device.startsWith("/dev/"))
+        device = device.mid(5);
 
-    if (uuid_cstr)
-    {
-        uuid = QByteArray("UUID=")+QByteArray(uuid_cstr);
-        free(uuid_cstr);
-    }
+    /* Probe again, as this is typically asked right after creating the file system */
+    _deviceIndex->refresh(device);
+    QByteArray value = _deviceIndex->tag(device, "UUID");
+    if (!value.isEmpty())
+        uuid = "UUID="+value;
 
     return uuid;
 }
 
 QByteArray Installer::getDeviceByLabel(const QByteArray &label)
 {
-    QByteArray dev;
-    char *cstr = blkid_get_devname(NULL, "LABEL", label.constData());
-
-    if (cstr)
-    {
-        dev = cstr;
-        free(cstr);
-    }
+    QByteArray dev = _deviceIndex->find("LABEL="+label);
 
-    return dev;
+    return dev.isEmpty() ? dev : "/dev/"+dev;
 }
 
 QByteArray Installer::getDeviceByUuid(const QByteArray &uuid)
 {
-    QByteArray dev;
-    char *cstr;
-
-    if (uuid.contains('='))
-        cstr = blkid_get_devname(NULL, uuid.constData(), NULL);
-    else
-        cstr = blkid_get_devname(NULL, "UUID", uuid.constData());
-
-    if (cstr)
-    {
-        dev = cstr;
-        free(cstr);
-    }
+    QByteArray dev = _deviceIndex->find(uuid);
 
-    return dev;
+    return dev.isEmpty() ? dev : "/dev/"+dev;
 }
 
 QByteArray Installer::getPartitionByLabel(const QByteArray &label)
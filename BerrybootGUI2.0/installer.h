@@ -32,11 +32,15 @@
 #include <QProcess>
 #include <QMap>
 #include <QFile>
+#include "bootfilesnapshot.h"
 
 #define BERRYBOOT_VERSION  "v2.908"
 #define SIZE_BOOT_PART  /* 63 */ 127
 
 class QSettings;
+class DeviceMonitor;
+class DeviceIndex;
+class ModuleLoader;
 
 class Installer : public QObject
 {
@@ -44,10 +48,19 @@ class Installer : public QObject
 public:
     explicit Installer(QObject *parent = 0);
     
+    /*
+     * Keep a compressed copy of the boot partition in memory while it is being reformatted
+     */
     bool saveBootFiles();
     bool restoreBootFiles();
+    BootFileSnapshot *bootFiles();
     int sizeofBootFilesInKB();
     void initializeDataPartition(const QString &dev);
+    /*
+     * Copy /boot/shared.img to the data partition, where the init script mounts it
+     * as read-only layer underneath /mnt/shared, instead of extracting it
+     */
+    bool installSharedImage();
     bool mountSystemPartition();
     bool umountSystemPartition();
     bool networkReady();
@@ -60,9 +73,17 @@ public:
     void reboot();
     void prepareDrivers();
     void cleanupDrivers();
-    void loadCryptoModules();
+    /*
+     * Load the modules needed for cipher (luks_cipher= in cmdline.txt), or for all supported ciphers if empty
+     */
+    void loadCryptoModules(const QByteArray &cipher = QByteArray());
     void loadSoundModule(const QByteArray &channel);
     void loadFilesystemModule(const QByteArray &fs);
+    /*
+     * Load the modules that sound, file system, etc. support needed during the previous boot
+     */
+    void preloadModules();
+    bool mountNetworkShare(const QByteArray &url, QByteArray username, const QByteArray &password, const QString &mountpoint);
 
     void setSkipConfig(bool skip);
     void setKeyboardLayout(const QString &layout);
@@ -86,6 +107,11 @@ public:
     void deleteImage(const QString &name);
     void deleteUserChanges(const QString &name);
     void cloneImage(const QString &oldname, const QString &newName, bool clonedata);
+    /*
+     * Copy image to RAM before booting it (copy_to_ram marker in its data directory)
+     */
+    bool isCopyToRamEnabled(const QString &name);
+    void setCopyToRam(const QString &name, bool enable);
 
     bool isSquashFSimage(QFile &f);
     void enableCEC();
@@ -109,6 +135,18 @@ public:
     QByteArray getDeviceByUuid(const QByteArray &uuid);
     QByteArray getPartitionByLabel(const QByteArray &label);
     QByteArray getPartitionByUuid(const QByteArray &uuid);
+    /*
+     * Kernel device and network events
+     */
+    DeviceMonitor *deviceMonitor();
+    /*
+     * UUID/LABEL lookups of block devices
+     */
+    DeviceIndex *deviceIndex();
+    /*
+     * In-process kernel module loading. Call prepareDrivers() first
+     */
+    ModuleLoader *moduleLoader();
 
 public slots:
     void startNetworking();
@@ -121,6 +159,10 @@ protected:
     bool _disableOverscan, _fixMAC, _ethup, _skipConfig;
     QSettings *_settings;
     QByteArray _bootoptions, _sound, _bootdev;
+    BootFileSnapshot _bootFiles;
+    DeviceMonitor *_deviceMonitor;
+    DeviceIndex *_deviceIndex;
+    ModuleLoader *_moduleLoader;
 
     void log_error(const QString &msg);
 
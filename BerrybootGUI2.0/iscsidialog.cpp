@@ -27,6 +27,7 @@
 #include "iscsidialog.h"
 #include "ui_iscsidialog.h"
 #include "networksettingsdialog.h"
+#include "moduleloader.h"
 #include <QProgressDialog>
 #include <QApplication>
 #include <QFile>
@@ -68,7 +69,7 @@ void iSCSIDialog::accept()
     if (!QFile::exists("/sys/module/iscsi_tcp"))
     {
         _i->prepareDrivers();
-        QProcess::execute("/sbin/modprobe iscsi_tcp");
+        _i->moduleLoader()->load(QStringList("iscsi_tcp"));
     }
 
     qpd.setLabelText(tr("Connecting to iSCSI server..."));
@@ -29,6 +29,19 @@
 #include "ui_logviewer.h"
 #include <QFileSystemWatcher>
 #include <QFile>
+#include <QRegExp>
+#include <QStringList>
+#include <QMap>
+
+#define BOOTTRACE_DIR   "/mnt/boottrace"
+#define BOOTTRACE_KEEP  5
+
+struct BootTraceSpan
+{
+    QString name;
+    int track, depth;
+    qint64 start, duration;
+};
 
 LogViewer::LogViewer(QString logfilename, QWidget *parent) :
     QDialog(parent),
@@ -40,6 +53,17 @@ LogViewer::LogViewer(QString logfilename, QWidget *parent) :
     connect(_fsw, SIGNAL(fileChanged(QString)), this, SLOT(reloadLog()));
     _fsw->addPath(logfilename);
     reloadLog();
+
+    /* boot.json is the last boot, boot.1.json the one before, etc. */
+    for (int i=0; i<BOOTTRACE_KEEP; i++)
+    {
+        QString filename = (i == 0 ? QString(BOOTTRACE_DIR"/boot.json") : QString(BOOTTRACE_DIR"/boot.%1.json").arg(i));
+        if (!QFile::exists(filename))
+            break;
+        ui->bootTraceCombo->addItem(i == 0 ? tr("Last boot") : tr("%1 boot(s) before").arg(i), QVariant(filename));
+    }
+    if (!ui->bootTraceCombo->count())
+        ui->bootTraceEdit->setPlainText(tr("No boot traces found in %1").arg(BOOTTRACE_DIR));
 }
 
 LogViewer::~LogViewer()
@@ -55,3 +79,70 @@ void LogViewer::reloadLog()
     f.close();
     ui->textedit->setPlainText(txt);
 }
+
+void LogViewer::on_bootTraceCombo_currentIndexChanged(int index)
+{
+    if (index != -1)
+        loadBootTrace(ui->bootTraceCombo->itemData(index).toString());
+}
+
+void LogViewer::loadBootTrace(const QString &filename)
+{
+    QFile f(filename);
+    if (!f.open(f.ReadOnly))
+    {
+        ui->bootTraceEdit->setPlainText(tr("Error opening %1").arg(filename));
+        return;
+    }
+
+    /* Init writes one event per line */
+    QRegExp eventRx("\"name\":\"([^\"]*)\",\"ph\":\"([BEi])\",\"ts\":(\\d+),\"pid\":\\d+,\"tid\":(\\d+)");
+    QList<BootTraceSpan> spans;
+    QMap<int, QList<int> > unfinished; /* track -> indexes of spans not ended yet */
+
+    while (!f.atEnd())
+    {
+        QString line = f.readLine();
+        if (eventRx.indexIn(line) == -1)
+            continue;
+
+        QString phase = eventRx.cap(2);
+        qint64 ts = eventRx.cap(3).toLongLong();
+        int track = eventRx.cap(4).toInt();
+
+        if (phase == "E")
+        {
+            if (!unfinished[track].isEmpty())
+            {
+                BootTraceSpan &s = spans[unfinished[track].takeLast()];
+                s.duration = ts - s.start;
+            }
+            continue;
+        }
+
+        BootTraceSpan s;
+        s.name = eventRx.cap(1);
+        s.track = track;
+        s.depth = unfinished[track].count();
+        s.start = ts;
+        s.duration = (phase == "i" ? 0 : -1);
+        spans.append(s);
+
+        if (phase == "B")
+            unfinished[track].append(spans.count()-1);
+    }
+    f.close();
+
+    QStringList trackNames;
+    trackNames << "" << "init" << "GUI" << "background";
+    QString txt = tr("Start (s)\tDuration (s)\tPhase\n");
+
+    foreach (const BootTraceSpan &s, spans)
+    {
+        QString duration = (s.duration == -1 ? QString("?") : QString::number(s.duration / 1000000.0, 'f', 2));
+        txt += QString::number(s.start / 1000000.0, 'f', 2)+"\t"+duration+"\t"
+                +QString(s.depth * 2, ' ')+trackNames.value(s.track)+": "+s.name+"\n";
+    }
+
+    ui->bootTraceEdit->setPlainText(txt);
+}
@@ -45,8 +45,14 @@ public:
 
 protected slots:
     void reloadLog();
-    
+    void on_bootTraceCombo_currentIndexChanged(int index);
+
 protected:
+    /*
+     * Show Chrome trace JSON written by the init script as list of phases with their duration
+     */
+    void loadBootTrace(const QString &filename);
+
     Ui::LogViewer *ui;
     QString _logfilename;
     QFileSystemWatcher *_fsw;
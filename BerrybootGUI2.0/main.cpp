@@ -34,6 +34,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "bootmenudialog.h"
 #include "networksettingsdialog.h"
 #include "statusdialog.h"
+#include "boottrace.h"
+#include "fastboot.h"
+#include "mountmanager.h"
+#include "readaheadprofile.h"
 #include <QDebug>
 #include <QStyle>
 #include <QDesktopWidget>
@@ -52,12 +56,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 #define MINIMUM_TMPFS_SIZE 110
+/* How long an OS is given to boot before its readahead profile is taken */
+#define READAHEAD_RECORD_SECONDS 30
 
 #include <QMessageBox>
 
 /* KMS framebuffer devices may take some time to show up... */
 void waitForFb(QString fbdevice = "/dev/fb0", int timeout = 10000)
 {
+    BootTraceScope trace("wait for framebuffer");
     QTime t1;
     t1.start();
 
@@ -77,8 +84,20 @@ void waitForFb(QString fbdevice = "/dev/fb0", int timeout = 10000)
 
 int main(int argc, char *argv[])
 {
+    /* Started by init in the background after switching root to the chosen OS */
+    if (argc == 3 && qstrcmp(argv[1], "--record-readahead") == 0)
+        return ReadaheadProfile::record(argv[2], READAHEAD_RECORD_SECONDS) ? 0 : 1;
+
+    BootTrace::instant("BerrybootGUI started");
+
+    /* Boot the default OS straight away, if nothing needs the GUI */
+    FastBoot fastBoot;
+    if (fastBoot.run())
+        return 0;
+
     if (!QFile::exists("/dev/fb0"))
         waitForFb();
+    BootTrace::begin("QApplication init");
     QApplication a(argc, argv);
     bool staticWifi = false;
 
@@ -103,8 +122,11 @@ int main(int argc, char *argv[])
 
     a.setWindowIcon(QIcon(":/icons/icon.png"));
 #endif
+    BootTrace::end("QApplication init");
     Installer i;
+    BootTrace::begin("CEC init");
     i.enableCEC();
+    BootTrace::end("CEC init");
 
 #ifdef MINIMUM_TMPFS_SIZE
     /* Make sure we have enough tmpfs space */
@@ -112,8 +134,7 @@ int main(int argc, char *argv[])
     qDebug() << "Available tmpfs space:" << tmpfsSpace << "MB";
     if (tmpfsSpace < MINIMUM_TMPFS_SIZE)
     {
-        QString resizeCMD = QString("mount -o remount,size=%1M /").arg(MINIMUM_TMPFS_SIZE);
-        QProcess::execute(resizeCMD);
+        MountManager::remount("/", "size="+QByteArray::number(MINIMUM_TMPFS_SIZE)+"M");
         tmpfsSpace = i.availableDiskSpace("/") / 1024 / 1024;
         qDebug() << "Resized tmpfs space, now available:" << tmpfsSpace << "MB";
     }
@@ -163,7 +184,10 @@ int main(int argc, char *argv[])
 #endif
 
     BootMenuDialog menu(&i);
-    if (menu.exec() == menu.Rejected)
+    BootTrace::begin("boot menu");
+    int menuResult = menu.exec();
+    BootTrace::end("boot menu");
+    if (menuResult == menu.Rejected)
     {
         /* If menu.exec() returns rejected exit, otherwise show OS installer */
         return 0;
@@ -36,15 +36,22 @@
 #include "confeditdialog.h"
 #include "berrybootsettingsdialog.h"
 #include "copythread.h"
-#include "driveformatthread.h"
+#include "diskimagethread.h"
+#include "duplicatedialog.h"
 #include "wifidialog.h"
+#include "deviceindex.h"
+#include "fsprobe.h"
+#include "mountmanager.h"
 
 #include <QDateTime>
+#include <QTime>
+#include <QSettings>
 #include <QMenu>
 #include <QMessageBox>
 #include <QFile>
 #include <QDir>
 #include <QProgressDialog>
+#include <QRegExp>
 #include <QFileDialog>
 #include <QListWidgetItem>
 #include <QLabel>
@@ -56,7 +63,8 @@
 MainWindow::MainWindow(Installer *i, QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
-    _i(i)
+    _i(i),
+    _exportProgress(NULL)
 {
     ui->setupUi(this);
 
@@ -195,25 +203,42 @@ bool MainWindow::scanUSBdevices(bool mountrw)
     qpd.show();
     QApplication::processEvents(); // risk of recursion?
 
+    QList<QByteArray> candidates, toMount;
     foreach (QString devname, list)
     {
         if (!devname.startsWith("mmcblk0") && !QFile::symLinkTarget("/sys/class/block/"+devname).contains("/devices/virtual/")  /*&& QFile::exists(dirname+"/"+devname+"/partition")*/ )
+            candidates.append(devname.toLatin1());
+    }
+
+    /* Look at the devices without mounting them, and only mount the ones of interest:
+       the ones with images in their root directory if importing, otherwise all that have a file system */
+    QList<FsProbe> probes = FsProbe::probeAll(candidates);
+    if (!mountrw)
+    {
+        foreach (const FsProbe &probe, probes)
+        {
+            if (probe.hasFile("*.img*"))
+                toMount.append(probe.device());
+        }
+    }
+    if (toMount.isEmpty())
+    {
+        foreach (const FsProbe &probe, probes)
         {
-            QString mntdir = "/media/"+devname;
-            dir.mkdir(mntdir);
-            QString cmd;
-
-            if (mountrw)
-                cmd = "mount /dev/"+devname+" "+mntdir;
-            else
-                cmd = "mount -o ro /dev/"+devname+" "+mntdir;
-
-            if ( QProcess::execute(cmd) == 0 )
-                partlist.append(devname);
-            else
-                dir.rmdir(mntdir);
+            if (probe.type() != FsProbe::Unknown || !_i->deviceIndex()->tag(probe.device(), "TYPE").isEmpty())
+                toMount.append(probe.device());
         }
     }
+
+    foreach (QString devname, toMount)
+    {
+        QString mntdir = "/media/"+devname;
+        dir.mkdir(mntdir);
+        if (MountManager::mount("/dev/"+devname.toLatin1(), mntdir.toLatin1(), QByteArray(), mountrw ? "" : "ro"))
+            partlist.append(devname);
+        else
+            dir.rmdir(mntdir);
+    }
     qpd.hide();
     setEnabled(true);
 
@@ -226,6 +251,49 @@ bool MainWindow::scanUSBdevices(bool mountrw)
     return true;
 }
 
+/* Mount the network share configured in the export dialog as /media/share */
+bool MainWindow::mountExportShare()
+{
+    QSettings *s = _i->settings();
+    s->beginGroup("export");
+    QByteArray url = s->value("url").toByteArray();
+    QByteArray user = s->value("user").toByteArray();
+    s->endGroup();
+
+    QProgressDialog qpd(tr("Enabling network interface"), QString(), 0, 0, this);
+    setEnabled(false);
+    qpd.show();
+    QApplication::processEvents();
+
+    if (!_i->networkReady())
+    {
+        _i->startNetworking();
+
+        /* Wait up to 30 seconds for a DHCP lease */
+        QTime t;
+        t.start();
+        while (t.elapsed() < 30000 && !_i->networkReady())
+        {
+            QApplication::processEvents(QEventLoop::WaitForMoreEvents, 250);
+        }
+    }
+
+    qpd.setLabelText(tr("Mounting network share..."));
+    QApplication::processEvents();
+    bool mounted = _i->mountNetworkShare(url, user, _sharePassword, "/media/share");
+    qpd.hide();
+    setEnabled(true);
+
+    if (!mounted)
+    {
+        QMessageBox::critical(this, tr("Mount error"), tr("Error mounting network share %1").arg(QString(url)), QMessageBox::Close);
+        return false;
+    }
+
+    partlist.append("share");
+    return true;
+}
+
 void MainWindow::cleanupUSBdevices()
 {
     QDir dir;
@@ -233,20 +301,21 @@ void MainWindow::cleanupUSBdevices()
     /* Clean up */
     foreach (QString devname, partlist)
     {
-        QProcess::execute("umount /media/"+devname);
+        MountManager::umount("/media/"+devname.toLatin1());
         dir.rmdir("/media/"+devname);
     }
 
     populate();
 }
 
-/* Find an external SD card device to backup to */
-QString MainWindow::externalSDcardDevice()
+/* Find external SD card devices to backup to */
+QStringList MainWindow::externalSDcardDevices()
 {
     /* Scan for storage devices */
     QString dirname  = "/sys/class/block";
     QDir    dir(dirname);
     QStringList list = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    QStringList devices;
     /* we want to make sure not to overwrite the datadev currently in use. so exclude it as backup destination */
     /* datadev partition can be like sda1 or mmcblk0p2, get rid of digit and p, as we want to know the drive */
     QString datadev = _i->datadev();
@@ -262,21 +331,25 @@ QString MainWindow::externalSDcardDevice()
             continue;
 
         if (devname != "mmcblk0" && devname != datadev)
-            return devname;
+            devices.append(devname);
     }
 
-    return QString(); // not found
+    return devices;
 }
 
 void MainWindow::on_actionEdit_triggered()
 {
     QString currentname = ui->list->currentItem()->data(Qt::UserRole).toString();
 
-    EditDialog ed(currentname, _i->isMemsplitHandlingEnabled(), this);
+    bool copyToRam = _i->isCopyToRamEnabled(currentname);
+    EditDialog ed(currentname, _i->isMemsplitHandlingEnabled(), copyToRam, this);
     if ( ed.exec() == QDialog::Accepted)
     {
         QString newname = ed.filename();
 
+        if (ed.copyToRam() != copyToRam)
+            _i->setCopyToRam(currentname, ed.copyToRam());
+
         if (newname != currentname && !newname.isEmpty())
         {
             if (QFile::exists("/mnt/image/"+newname) || QFile::exists("/mnt/data/"+newname))
@@ -368,61 +441,37 @@ void MainWindow::on_actionExport_triggered()
 {
     bool isImageSelected = (ui->list->currentRow() != -1);
 
-    ExportDialog ed(isImageSelected, this);
+    ExportDialog ed(_i, isImageSelected, this);
     if (ed.exec() == QDialog::Accepted)
     {
+        _sharePassword = ed.sharePassword();
         if (ed.restore() )
         {
             copyOSfromUSB();
         }
+        else if (ed.diskImage() )
+        {
+            exportDiskImage(ed.networkShare());
+        }
         else if (ed.backupEverything() )
         {
-            /* Clone entire SD card */
-
-            QString sdcardDevice = externalSDcardDevice();
-            if (sdcardDevice.isEmpty())
+            /* Clone entire SD card, to all external SD card readers attached */
+            QStringList sdcardDevices = externalSDcardDevices();
+            if (sdcardDevices.isEmpty())
             {
                 QMessageBox::critical(this, tr("Error"), tr("Connect an external USB SD card reader first!"));
                 return;
             }
 
-            QFile f("/sys/class/block/"+sdcardDevice+"/device/model");
-            f.open(f.ReadOnly);
-            QString model = f.readAll().trimmed();
-            f.close();
-
-            if (QMessageBox::question(this, tr("Confirm"), tr("Are you you want to clone to device '%1' (%2)? WARNING: this will overwrite all existing files.").arg(sdcardDevice, model), QMessageBox::Yes, QMessageBox::No) != QMessageBox::Yes)
-                return;
-
-            /* Check if SD card is large enough */
-            double diskspaceNeeded = _i->diskSpaceInUse()+(64*1024*1024);
-            f.setFileName("/sys/block/"+sdcardDevice+"/size");
-            f.open(f.ReadOnly);
-            double sizeofsd = f.readAll().trimmed().toDouble()*512;
-            f.close();
-
-            if (sizeofsd && diskspaceNeeded > sizeofsd)
-            {
-                QMessageBox::critical(this, tr("Error"), tr("Capacity too small. Need %1 MB").arg(QString::number(diskspaceNeeded/1024/1024)));
-                return;
-            }
-
-            QProgressDialog *qpd = new QProgressDialog("", QString(), 0, 0, this);
-            qpd->show();
-            DriveFormatThread *dft = new DriveFormatThread(sdcardDevice, "ext4", _i, this, sdcardDevice+"1", false);
-            connect(dft, SIGNAL(statusUpdate(QString)), qpd, SLOT(setLabelText(QString)));
-            connect(dft, SIGNAL(error(QString)), this, SLOT(onCopyFailed()));
-            connect(dft, SIGNAL(completed()), this, SLOT(onFormattingComplete()));
-            connect(dft, SIGNAL(finished()), qpd, SLOT(deleteLater()));
-            dft->start();
-
+            DuplicateDialog dd(_i, sdcardDevices, this);
+            dd.exec();
         }
         else
         {
             /* Export single image */
             QString imagename = ui->list->currentItem()->data(Qt::UserRole).toString();
 
-            if (!scanUSBdevices(true) )
+            if (ed.networkShare() ? !mountExportShare() : !scanUSBdevices(true) )
                 return;
 
             /* Prompt for image file */
@@ -443,7 +492,7 @@ void MainWindow::on_actionExport_triggered()
             {
                 if (ed.exportData() && QFile::exists("/mnt/data/"+imagename))
                 {
-                    mksquashfs(imagename, fileName, ed.excludeList(), ed.compress());
+                    mksquashfs(imagename, fileName, ed.excludeList(), ed.compress(), ed.compressor(), ed.processors());
                 }
                 else
                 {
@@ -464,7 +513,82 @@ void MainWindow::on_actionExport_triggered()
     }
 }
 
-void MainWindow::mksquashfs(QString imagename, QString destfileName, QStringList exclList, bool compress)
+void MainWindow::exportDiskImage(bool networkShare)
+{
+    QString datadev = _i->datadev();
+
+    if (datadev == "iscsi" || _i->isPxeBoot())
+    {
+        QMessageBox::critical(this, tr("Error"), tr("Disk images of networked storage are not supported"));
+        return;
+    }
+    if (datadev.contains('='))
+        datadev = _i->getPartitionByUuid(datadev.toLatin1());
+
+    /* sysfs entry of a partition lives in the directory of the drive it belongs to */
+    QString drive = QFileInfo(QFile::symLinkTarget("/sys/class/block/"+datadev)).dir().dirName();
+    if (drive.isEmpty() || !QString(_i->bootdev()).startsWith(drive))
+    {
+        QMessageBox::critical(this, tr("Error"), tr("Disk images are only supported if boot and data partition are on the same drive"));
+        return;
+    }
+
+    if (networkShare ? !mountExportShare() : !scanUSBdevices(true) )
+        return;
+
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Select image file"), "/media/"+partlist.first()+"/berryboot.img.gz", tr("Compressed disk images (*.img.gz)"));
+    if (!fileName.startsWith("/media/") || fileName.startsWith("/media/"+drive))
+    {
+        cleanupUSBdevices();
+        return;
+    }
+    if (!fileName.endsWith(".gz"))
+    {
+        if (!fileName.endsWith(".img"))
+            fileName += ".img";
+        fileName += ".gz";
+    }
+
+    QProgressDialog *qpd = new QProgressDialog(tr("Preparing disk image"), QString(), 0, 100, this);
+    qpd->show();
+    DiskImageThread *dit = new DiskImageThread(drive, fileName, this);
+    connect(dit, SIGNAL(statusUpdate(QString)), qpd, SLOT(setLabelText(QString)));
+    connect(dit, SIGNAL(progress(int)), qpd, SLOT(setValue(int)));
+    connect(dit, SIGNAL(error(QString)), this, SLOT(onDiskImageError(QString)));
+    connect(dit, SIGNAL(finished()), qpd, SLOT(deleteLater()));
+    connect(dit, SIGNAL(finished()), this, SLOT(cleanupUSBdevices()));
+    connect(dit, SIGNAL(finished()), dit, SLOT(deleteLater()));
+    dit->start();
+}
+
+void MainWindow::onDiskImageError(const QString &msg)
+{
+    QMessageBox::critical(this, tr("Error"), msg, QMessageBox::Close);
+}
+
+/* Size mksquashfs' queues to the memory that is actually available */
+static int mksquashfsQueueSize()
+{
+    int availableMB = 0;
+    QFile f("/proc/meminfo");
+    f.open(f.ReadOnly);
+    QByteArray line;
+
+    while ( !(line = f.readLine()).isEmpty() )
+    {
+        if (line.startsWith("MemAvailable:"))
+        {
+            availableMB = line.mid(13).trimmed().split(' ').first().toInt() / 1024;
+            break;
+        }
+    }
+    f.close();
+
+    /* mksquashfs allocates all three queues, so leave plenty for everything else */
+    return qBound(16, availableMB / 16, 64);
+}
+
+void MainWindow::mksquashfs(QString imagename, QString destfileName, QStringList exclList, bool compress, QString compressor, int processors)
 {
     QProgressDialog *qpd = new QProgressDialog(tr("Mounting image..."), QString(),0,0,this);
     qpd->show();
@@ -472,9 +596,9 @@ void MainWindow::mksquashfs(QString imagename, QString destfileName, QStringList
 
     QDir dir;
     dir.mkdir("/squashfs");
-    dir.mkdir("/aufs");
+    dir.mkdir("/merged");
 
-    if ( QProcess::execute("/bin/mount -o loop \"/mnt/images/"+imagename+"\" /squashfs") != 0)
+    if (!MountManager::mountImage("/mnt/images/"+imagename.toLatin1(), "/squashfs", "squashfs"))
     {
         qpd->deleteLater();
         QMessageBox::critical(this, tr("mksquashfs error"), tr("Error mounting original image"));
@@ -482,18 +606,29 @@ void MainWindow::mksquashfs(QString imagename, QString destfileName, QStringList
         return;
     }
 
+    /* Data dirs that have a work dir were written through overlayfs (see init script), and contain
+       overlayfs style whiteouts and redirects that only overlayfs itself can interpret */
+    QString datadir = "/mnt/data/"+imagename;
+    bool merged = false;
 
-    if (QProcess::execute("/bin/mount -t aufs -o br:/mnt/data/"+imagename+":/squashfs none /aufs") != 0)
+    if (QFile::exists(datadir+".work"))
+        merged = MountManager::mount("none", "/merged", "overlay", "ro,redirect_dir=follow,lowerdir="+datadir.toLatin1()+":/squashfs");
+    if (!merged)
+        merged = MountManager::mount("none", "/merged", "aufs", "br:"+datadir.toLatin1()+":/squashfs");
+
+    if (!merged)
     {
         qpd->deleteLater();
         QMessageBox::critical(this, tr("mksquashfs error"), tr("Error mounting data dir on top"));
-        QProcess::execute("/bin/umount /squashfs");
+        MountManager::umount("/squashfs");
         cleanupUSBdevices();
         return;
     }
 
+    QString queue = QString::number(mksquashfsQueueSize());
     QStringList args;
-    args << "/aufs" << destfileName << "-comp" << "lzo" << "-no-progress" << "-read-queue" << "16" << "-write-queue" << "16" << "-fragment-queue" << "16";
+    args << "/merged" << destfileName << "-comp" << compressor << "-processors" << QString::number(processors)
+         << "-read-queue" << queue << "-write-queue" << queue << "-fragment-queue" << queue;
     if (!compress)
         args << "-noF" << "-noD";
 
@@ -507,97 +642,66 @@ void MainWindow::mksquashfs(QString imagename, QString destfileName, QStringList
 
     QProcess *proc = new QProcess();
     proc->setProcessChannelMode(proc->MergedChannels);
+    connect(proc, SIGNAL(readyRead()), this, SLOT(mksquashfsOutput()));
     connect(proc, SIGNAL(finished(int)), this, SLOT(mksquashfsFinished(int)));
     connect(proc, SIGNAL(finished(int)), qpd, SLOT(deleteLater()));
 
-    qpd->setLabelText(tr("Exporting your image... Can take half an hour."));
+    qpd->setMaximum(100);
+    qpd->setLabelText(tr("Exporting your image..."));
+    _exportProgress = qpd;
+    _mksquashfsOutput.clear();
+    _exportTimer.start();
     proc->start("/usr/bin/mksquashfs", args);
 }
 
-void MainWindow::mksquashfsFinished(int code)
+void MainWindow::mksquashfsOutput()
 {
     QProcess *proc = qobject_cast<QProcess *>(sender());
+    QString output = proc->readAll();
+    /* Progress bar looks like: [=======/        ] 1234/5678  21% */
+    QRegExp progressRx("(\\d+)/(\\d+)\\s+(\\d+)%");
+    int percent = -1;
 
-    QProcess::execute("/bin/umount /aufs");
-    QProcess::execute("/bin/umount /squashfs");
-    sync();
-    cleanupUSBdevices();
-
-    if (code != 0)
+    output.replace('\r', '\n');
+    foreach (QString line, output.split('\n', QString::SkipEmptyParts))
     {
-        QMessageBox::critical(this, tr("mksquashfs error"), tr("Error creating image.\n\n%1").arg( QString(proc->readAll()) ), QMessageBox::Close);
+        if (progressRx.indexIn(line) != -1)
+            percent = progressRx.cap(3).toInt();
+        else
+            _mksquashfsOutput += line+"\n";
     }
 
-    proc->deleteLater();
-}
-
-void MainWindow::onFormattingComplete()
-{
-    /* Formatting complete, proceed with copying files to SD card */
-    DriveFormatThread *dft = qobject_cast<DriveFormatThread *>(sender());
-    QString drive   = dft->drive();
-    QString bootdev = dft->bootdev();
-    QString datadev = dft->datadev();
-    dft->deleteLater();
-
-    QProgressDialog *qpd = new QProgressDialog(tr("Copying boot files..."), QString(),0,0,this);
-    qpd->show();
-    QApplication::processEvents();
-
-    QDir dir;
-    dir.mkdir("/tmp/mnt_sd");
-    // Copy 512 KB from boot sector for devices that depend on u-boot SPL
-    QProcess::execute("dd bs=1024 seek=8 skip=8 count=512 if=/dev/mmcblk0p1 of=/dev/"+drive);
-
-    // Fix cmdline.txt and uEnv.txt to remove device specific options
-    QFile f("/tmp/boot/cmdline.txt");
-    f.open(f.ReadOnly);
-    QByteArray data = f.readAll();
-    f.close();
-    data.replace(" luks", "");
-    data.replace("mac_addr", "orig_mac");
-    f.open(f.WriteOnly);
-    f.write(data);
-    f.close();
-    f.setFileName("/tmp/boot/uEnv.txt");
-    f.open(f.ReadOnly);
-    data = f.readAll();
-    f.close();
-    data.replace(" luks", "");
-    data.replace("mac_addr", "orig_mac");
-    f.open(f.WriteOnly);
-    f.write(data);
-    f.close();
+    if (percent < 0 || !_exportProgress)
+        return;
 
-    // Copy boot partition files
-    QProcess::execute("mount /dev/"+bootdev+" /tmp/mnt_sd");
-    QProcess::execute("cp -a /tmp/boot/. /tmp/mnt_sd");
-    QProcess::execute("rm -rf /tmp/boot");
-    QProcess::execute("umount /tmp/mnt_sd");
-    // Mount data partition
-    QProcess::execute("mount /dev/"+datadev+" /tmp/mnt_sd");
+    _exportProgress->setValue(percent);
+    if (percent > 0 && percent < 100)
+    {
+        int minutesLeft = _exportTimer.elapsed() * (100 - percent) / percent / 60000;
 
-    qpd->setLabelText(tr("Copying data files... Can take half an hour."));
-    QProcess *proc = new QProcess(this);
-    connect(proc, SIGNAL(finished(int)), qpd, SLOT(deleteLater()));
-    connect(proc, SIGNAL(finished(int)), this, SLOT(onBackupComplete(int)));
-    proc->start("cp -a /mnt/. /tmp/mnt_sd");
+        if (minutesLeft)
+            _exportProgress->setLabelText(tr("Exporting your image... About %1 minute(s) remaining.").arg(minutesLeft));
+        else
+            _exportProgress->setLabelText(tr("Exporting your image... Less than a minute remaining."));
+    }
 }
 
-void MainWindow::onBackupComplete(int code)
+void MainWindow::mksquashfsFinished(int code)
 {
     QProcess *proc = qobject_cast<QProcess *>(sender());
 
-    /* Get rid of persistent-net.rules, as the cloned SD card may be intended for a different device */
-    QProcess::execute("sh -c 'rm /tmp/mnt_sd/data/*/etc/udev/rules.d/70-persistent-net.rules'");
-
-    /* Unmount & sync */
-    QProcess::execute("umount /tmp/mnt_sd");
+    _exportProgress = NULL;
+    MountManager::umount("/merged");
+    MountManager::umount("/squashfs");
     sync();
+    cleanupUSBdevices();
 
     if (code != 0)
-        QMessageBox::critical(this, tr("Error"), tr("Error copying files"), QMessageBox::Close);
+    {
+        QMessageBox::critical(this, tr("mksquashfs error"), tr("Error creating image.\n\n%1").arg( _mksquashfsOutput+proc->readAll() ), QMessageBox::Close);
+    }
 
+    _mksquashfsOutput.clear();
     proc->deleteLater();
 }
 
@@ -646,6 +750,11 @@ void MainWindow::on_actionRepair_file_system_triggered()
         cmd = "/usr/sbin/fsck.btrfs -y "+datadev;
         fstype = "btrfs";
     }
+    else if (_i->bootoptions().contains("fstype=f2fs"))
+    {
+        cmd = "/usr/sbin/fsck.f2fs -f -y "+datadev;
+        fstype = "f2fs";
+    }
     else
     {
         cmd = "/sbin/fsck.ext4 -yf "+datadev;
@@ -658,7 +767,7 @@ void MainWindow::on_actionRepair_file_system_triggered()
     {
         QProcess::execute("killall udevd");
         _i->umountSystemPartition();
-        QProcess::execute("umount /mnt");
+        MountManager::umount("/mnt", MountManager::AllReferences);
 
         QProcess proc;
         _i->switchConsole(5);
@@ -670,7 +779,7 @@ void MainWindow::on_actionRepair_file_system_triggered()
         proc.waitForFinished(-1);
 
         _i->mountSystemPartition();
-        QProcess::execute("mount -t "+fstype+" "+datadev+" /mnt");
+        MountManager::mount(datadev.toLatin1(), "/mnt", fstype.toLatin1());
         _i->switchConsole(1);
     }
 }
@@ -31,11 +31,13 @@
 #include <QMainWindow>
 #include <QStringList>
 #include <QModelIndex>
+#include <QElapsedTimer>
 
 namespace Ui {
 class MainWindow;
 }
 class Installer;
+class QProgressDialog;
 
 class MainWindow : public QMainWindow
 {
@@ -51,10 +53,10 @@ private slots:
 
     void copyOSfromUSB();
     void onCopyFailed();
-    void onFormattingComplete();
-    void onBackupComplete(int code);
     void cleanupUSBdevices();
+    void mksquashfsOutput();
     void mksquashfsFinished(int code);
+    void onDiskImageError(const QString &msg);
 
     void on_actionEdit_triggered();
     void on_actionClone_triggered();
@@ -82,11 +84,17 @@ protected:
     Ui::MainWindow *ui;
     Installer *_i;
     QStringList partlist;
+    QProgressDialog *_exportProgress;
+    QElapsedTimer _exportTimer;
+    QString _mksquashfsOutput;
+    QByteArray _sharePassword;
 
     bool scanUSBdevices(bool mountrw = false);
-    QString externalSDcardDevice();
+    bool mountExportShare();
+    QStringList externalSDcardDevices();
     void populate();
-    void mksquashfs(QString imagename, QString destfileName, QStringList exclList, bool compress);
+    void mksquashfs(QString imagename, QString destfileName, QStringList exclList, bool compress, QString compressor, int processors);
+    void exportDiskImage(bool networkShare);
 
     virtual void closeEvent(QCloseEvent *event);
     void setButtonsEnabled(bool enable);
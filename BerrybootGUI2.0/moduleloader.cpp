@@ -0,0 +1,430 @@
+/* Berryboot -- kernel module loader
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "moduleloader.h"
+#include <QFile>
+#include <QSettings>
+#include <QSet>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutexLocker>
+#include <QDebug>
+#include <libkmod.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define MODULES_PRELOAD_FILE  "/mnt/modules.preload"
+#define MAX_INSERT_THREADS  4
+
+/*
+ * Inserts a single plain .ko file with finit_module()
+ * libkmod itself is not thread-safe, so the worker threads only use the kernel interface
+ */
+class InsertModule : public QRunnable
+{
+public:
+    InsertModule(const QByteArray &path, const QByteArray &options, int *result)
+        : _path(path), _options(options), _result(result)
+    {
+    }
+
+    virtual void run()
+    {
+        int fd = ::open(_path.constData(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            *_result = -errno;
+            return;
+        }
+        if (syscall(__NR_finit_module, fd, _options.constData(), 0) == 0 || errno == EEXIST)
+            *_result = 0;
+        else
+            *_result = -errno;
+        ::close(fd);
+    }
+
+protected:
+    QByteArray _path, _options;
+    int *_result;
+};
+
+ModuleLoader::ModuleLoader(QObject *parent) :
+    QObject(parent), _ctx(NULL)
+{
+}
+
+ModuleLoader::~ModuleLoader()
+{
+    close();
+}
+
+bool ModuleLoader::open()
+{
+    if (_ctx)
+        return true;
+
+    /* Default location: /lib/modules/`uname -r` */
+    _ctx = kmod_new(NULL, NULL);
+    if (!_ctx)
+    {
+        qDebug() << "Error initializing libkmod";
+        return false;
+    }
+    if (kmod_load_resources(_ctx) < 0)
+    {
+        /* Not fatal, libkmod falls back to reading the index files on every lookup */
+        qDebug() << "Error loading module index";
+    }
+    return true;
+}
+
+void ModuleLoader::close()
+{
+    QMutexLocker lock(&_mutex);
+
+    if (_ctx)
+    {
+        kmod_unref(_ctx);
+        _ctx = NULL;
+    }
+}
+
+bool ModuleLoader::load(const QStringList &names, const QByteArray &feature)
+{
+    QMutexLocker lock(&_mutex);
+    QMap<QByteArray, Module> modules;
+
+    if (names.isEmpty() || !open())
+        return false;
+
+    bool ok = resolve(names, modules);
+    ok = insert(modules) && ok;
+    if (!feature.isEmpty())
+        record(feature, modules);
+
+    return ok;
+}
+
+QStringList ModuleLoader::available(const QStringList &names)
+{
+    QMutexLocker lock(&_mutex);
+    QStringList found;
+
+    if (!open())
+        return found;
+
+    foreach (QString name, names)
+    {
+        QByteArray n = name.toLatin1();
+        struct kmod_list *list = NULL;
+
+        if (kmod_module_new_from_lookup(_ctx, n.constData(), &list) >= 0 && list)
+        {
+            found.append(name);
+            kmod_module_unref_list(list);
+        }
+    }
+
+    return found;
+}
+
+QStringList ModuleLoader::recorded()
+{
+    QStringList names;
+
+    if (!QFile::exists(MODULES_PRELOAD_FILE))
+        return names;
+
+    QSettings s(MODULES_PRELOAD_FILE, QSettings::IniFormat);
+    s.beginGroup("modules");
+    foreach (QString feature, s.childKeys())
+    {
+        names.append(s.value(feature).toStringList());
+    }
+    s.endGroup();
+    names.removeDuplicates();
+
+    return names;
+}
+
+bool ModuleLoader::resolve(const QStringList &names, QMap<QByteArray, Module> &modules)
+{
+    bool ok = true;
+
+    foreach (QString name, names)
+    {
+        QByteArray n = name.toLatin1();
+        struct kmod_list *list = NULL, *itr;
+
+        if (kmod_module_new_from_lookup(_ctx, n.constData(), &list) < 0 || !list)
+        {
+            qDebug() << "Module not found:" << n;
+            ok = false;
+            continue;
+        }
+
+        /* Like modprobe, the blacklist only applies to modules requested by alias */
+        QByteArray normalized = n;
+        normalized.replace('-', '_');
+        bool isAlias = false;
+        kmod_list_foreach(itr, list)
+        {
+            struct kmod_module *mod = kmod_module_get_module(itr);
+            if (normalized != kmod_module_get_name(mod))
+                isAlias = true;
+            kmod_module_unref(mod);
+        }
+        if (isAlias)
+        {
+            struct kmod_list *filtered = NULL;
+            if (kmod_module_apply_filter(_ctx, KMOD_FILTER_BLACKLIST, list, &filtered) >= 0)
+            {
+                kmod_module_unref_list(list);
+                list = filtered;
+            }
+        }
+
+        kmod_list_foreach(itr, list)
+        {
+            struct kmod_module *mod = kmod_module_get_module(itr);
+            addModule(mod, modules);
+            kmod_module_unref(mod);
+        }
+        kmod_module_unref_list(list);
+    }
+
+    return ok;
+}
+
+void ModuleLoader::addModule(struct kmod_module *mod, QMap<QByteArray, Module> &modules)
+{
+    QByteArray name = kmod_module_get_name(mod);
+    if (modules.contains(name))
+        return;
+
+    Module m;
+    m.name = name;
+    m.path = kmod_module_get_path(mod);
+    m.options = kmod_module_get_options(mod);
+
+    int state = kmod_module_get_initstate(mod);
+    if (state == KMOD_MODULE_BUILTIN || (state != KMOD_MODULE_LIVE && state != KMOD_MODULE_COMING && m.path.isEmpty()))
+    {
+        /* Compiled into the kernel */
+        return;
+    }
+    m.loaded = (state == KMOD_MODULE_LIVE || state == KMOD_MODULE_COMING);
+
+    struct kmod_list *pre = NULL, *post = NULL;
+    if (kmod_module_get_softdeps(mod, &pre, &post) == 0 && (pre || post))
+        m.viaKmod = true;
+    kmod_module_unref_list(pre);
+    kmod_module_unref_list(post);
+    if (kmod_module_get_install_commands(mod) || !m.path.endsWith(".ko"))
+        m.viaKmod = true;
+
+    /* Insert before recursing, so that dependency cycles terminate */
+    modules.insert(name, m);
+
+    struct kmod_list *deps = kmod_module_get_dependencies(mod), *itr;
+    QList<QByteArray> depNames;
+    kmod_list_foreach(itr, deps)
+    {
+        struct kmod_module *dep = kmod_module_get_module(itr);
+        QByteArray depName = kmod_module_get_name(dep);
+        addModule(dep, modules);
+        if (modules.contains(depName))
+            depNames.append(depName);
+        kmod_module_unref(dep);
+    }
+    kmod_module_unref_list(deps);
+    modules[name].dependencies = depNames;
+}
+
+bool ModuleLoader::insert(QMap<QByteArray, Module> &modules)
+{
+    QSet<QByteArray> done, failed;
+    QList<QByteArray> pending;
+
+    foreach (const Module &m, modules)
+    {
+        if (m.loaded)
+            done.insert(m.name);
+        else
+            pending.append(m.name);
+    }
+
+    /* Insert in waves: every module whose dependencies are all loaded goes into the current wave */
+    while (!pending.isEmpty())
+    {
+        QList<QByteArray> wave;
+
+        foreach (QByteArray name, pending)
+        {
+            bool ready = true;
+
+            foreach (QByteArray dep, modules[name].dependencies)
+            {
+                if (failed.contains(dep))
+                {
+                    qDebug() << "Not loading" << name << "dependency" << dep << "failed";
+                    failed.insert(name);
+                    ready = false;
+                    break;
+                }
+                if (!done.contains(dep))
+                    ready = false;
+            }
+            if (ready)
+                wave.append(name);
+        }
+        foreach (QByteArray name, failed)
+            pending.removeAll(name);
+
+        if (wave.isEmpty())
+        {
+            if (!pending.isEmpty())
+            {
+                qDebug() << "Unresolvable module dependencies:" << pending;
+                foreach (QByteArray name, pending)
+                    failed.insert(name);
+            }
+            break;
+        }
+
+        QThreadPool pool;
+        pool.setMaxThreadCount(qMin(wave.size(), MAX_INSERT_THREADS));
+        foreach (QByteArray name, wave)
+        {
+            Module &m = modules[name];
+            if (!m.viaKmod)
+                pool.start(new InsertModule(m.path, m.options, &m.result));
+        }
+        /* libkmod is not thread-safe, modules that need it are handled by this thread meanwhile */
+        foreach (QByteArray name, wave)
+        {
+            Module &m = modules[name];
+            if (m.viaKmod && !insertViaKmod(m))
+                failed.insert(name);
+        }
+        pool.waitForDone();
+
+        foreach (QByteArray name, wave)
+        {
+            Module &m = modules[name];
+            pending.removeAll(name);
+
+            /* Kernels without finit_module() */
+            if (!m.viaKmod && m.result == -ENOSYS && insertViaKmod(m))
+                m.result = 0;
+
+            if (m.viaKmod || m.result == 0)
+            {
+                if (!failed.contains(name))
+                    done.insert(name);
+            }
+            else
+            {
+                qDebug() << "Error inserting module" << name << strerror(-m.result);
+                failed.insert(name);
+            }
+        }
+    }
+
+    return failed.isEmpty();
+}
+
+bool ModuleLoader::insertViaKmod(Module &m)
+{
+    struct kmod_module *mod = NULL;
+
+    if (kmod_module_new_from_name(_ctx, m.name.constData(), &mod) < 0)
+        return false;
+
+    /* Runs install commands from modprobe.d, and loads soft dependencies */
+    int err = kmod_module_probe_insert_module(mod, 0, NULL, NULL, NULL, NULL);
+    kmod_module_unref(mod);
+
+    if (err < 0)
+    {
+        qDebug() << "Error inserting module" << m.name << strerror(-err);
+        return false;
+    }
+    return true;
+}
+
+void ModuleLoader::record(const QByteArray &feature, const QMap<QByteArray, Module> &modules)
+{
+    QStringList names;
+    foreach (const Module &m, modules)
+    {
+        names.append(m.name);
+    }
+    names.sort();
+
+    _unsaved.insert(feature, names);
+    writeRecorded();
+}
+
+void ModuleLoader::saveRecorded()
+{
+    QMutexLocker lock(&_mutex);
+    writeRecorded();
+}
+
+bool ModuleLoader::writeRecorded()
+{
+    if (_unsaved.isEmpty())
+        return true;
+
+    /* Only when the data partition is mounted, and not read-only (e.g. before the background remount) */
+    if (!QFile::exists("/mnt/images") || access("/mnt", W_OK) != 0)
+        return false;
+
+    QSettings s(MODULES_PRELOAD_FILE, QSettings::IniFormat);
+    s.beginGroup("modules");
+    foreach (QByteArray feature, _unsaved.keys())
+    {
+        QStringList previous = s.value(feature).toStringList();
+        previous.sort();
+        if (previous != _unsaved.value(feature))
+            s.setValue(feature, _unsaved.value(feature));
+    }
+    s.endGroup();
+    s.sync();
+
+    if (s.status() != QSettings::NoError)
+    {
+        qDebug() << "Error saving" << MODULES_PRELOAD_FILE;
+        return false;
+    }
+
+    _unsaved.clear();
+    return true;
+}
@@ -0,0 +1,109 @@
+#ifndef MODULELOADER_H
+#define MODULELOADER_H
+
+/* Berryboot -- kernel module loader
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QObject>
+#include <QMap>
+#include <QByteArray>
+#include <QStringList>
+#include <QMutex>
+
+struct kmod_ctx;
+struct kmod_module;
+
+/*
+ * Loads kernel modules in-process with libkmod, instead of forking modprobe
+ *
+ * modules.dep and modules.alias are loaded once, all names and aliases
+ * of a request are resolved in a single pass, and modules that do not
+ * depend on each other are inserted concurrently.
+ * The modules each feature needed are recorded on the data partition,
+ * so the next boot can preload that set before anyone asks for it.
+ * While the data partition is not mounted read-write, records are kept in memory.
+ * Methods are thread-safe.
+ */
+class ModuleLoader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ModuleLoader(QObject *parent = 0);
+    virtual ~ModuleLoader();
+
+    /*
+     * Load modules by name or alias (e.g. a USB modalias), including their dependencies
+     * Names that do not resolve to a module are skipped.
+     * If feature is not empty, the resolved set is recorded under that name.
+     * Returns false if any module could not be found or inserted
+     */
+    bool load(const QStringList &names, const QByteArray &feature = QByteArray());
+    /*
+     * Returns the names that resolve to a module on this kernel, for optional modules
+     */
+    QStringList available(const QStringList &names);
+    /*
+     * Modules recorded for all features during previous boots
+     */
+    QStringList recorded();
+    /*
+     * Write records kept in memory, once the data partition is mounted read-write
+     */
+    void saveRecorded();
+    /*
+     * Release the module index, so that the file system holding /lib/modules can be unmounted
+     */
+    void close();
+
+protected:
+    struct Module
+    {
+        QByteArray name, path, options;
+        QList<QByteArray> dependencies;
+        /* Has install commands, soft dependencies or is compressed, leave it to libkmod */
+        bool viaKmod;
+        bool loaded;
+        int result;
+
+        Module() : viaKmod(false), loaded(false), result(0) { }
+    };
+
+    QMutex _mutex;
+    struct kmod_ctx *_ctx;
+    /* Records not written to the data partition yet */
+    QMap<QByteArray, QStringList> _unsaved;
+
+    /* Must be called with mutex held */
+    bool open();
+    bool resolve(const QStringList &names, QMap<QByteArray, Module> &modules);
+    void addModule(struct kmod_module *mod, QMap<QByteArray, Module> &modules);
+    bool insert(QMap<QByteArray, Module> &modules);
+    bool insertViaKmod(Module &m);
+    void record(const QByteArray &feature, const QMap<QByteArray, Module> &modules);
+    bool writeRecorded();
+};
+
+#endif // MODULELOADER_H
@@ -0,0 +1,386 @@
+/* Berryboot -- mount manager
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mountmanager.h"
+#include <QFile>
+#include <QList>
+#include <QMutexLocker>
+#include <QDebug>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <linux/loop.h>
+#include <blkid/blkid.h>
+
+/* LOOP_CONFIGURE sets up a loop device in a single call (Linux 5.8+).
+ * Not in the kernel headers of our toolchain, and not supported by all kernels we run on */
+#ifndef LOOP_CONFIGURE
+#define LOOP_CONFIGURE  0x4C0A
+struct loop_config
+{
+    __u32 fd;
+    __u32 block_size;
+    struct loop_info64 info;
+    __u64 __reserved[8];
+};
+#endif
+
+QMutex MountManager::_mutex;
+QWaitCondition MountManager::_mountDone;
+QMap<QByteArray, MountManager::Mount> MountManager::_mounts;
+
+/* Options that are mount flags rather than file system specific data */
+static const struct
+{
+    const char *name;
+    unsigned long flag;
+    bool clear;
+} mountFlags[] = {
+    { "ro",         MS_RDONLY,      false },
+    { "rw",         MS_RDONLY,      true },
+    { "noatime",    MS_NOATIME,     false },
+    { "nodiratime", MS_NODIRATIME,  false },
+    { "relatime",   MS_RELATIME,    false },
+    { "nosuid",     MS_NOSUID,      false },
+    { "nodev",      MS_NODEV,       false },
+    { "noexec",     MS_NOEXEC,      false },
+    { "sync",       MS_SYNCHRONOUS, false },
+    { "bind",       MS_BIND,        false },
+    { "defaults",   0,              false },
+    { NULL, 0, false }
+};
+
+unsigned long MountManager::parseOptions(const QByteArray &options, QByteArray &data, unsigned long flags)
+{
+    QList<QByteArray> dataOptions;
+
+    foreach (QByteArray option, options.split(','))
+    {
+        bool isFlag = false;
+
+        if (option.isEmpty())
+            continue;
+
+        for (int i=0; mountFlags[i].name; i++)
+        {
+            if (option == mountFlags[i].name)
+            {
+                if (mountFlags[i].clear)
+                    flags &= ~mountFlags[i].flag;
+                else
+                    flags |= mountFlags[i].flag;
+                isFlag = true;
+                break;
+            }
+        }
+
+        if (!isFlag)
+            dataOptions.append(option);
+    }
+
+    data = dataOptions.isEmpty() ? QByteArray() : dataOptions[0];
+    for (int i=1; i<dataOptions.count(); i++)
+        data += ","+dataOptions[i];
+
+    return flags;
+}
+
+QByteArray MountManager::probeType(const QByteArray &device)
+{
+    QByteArray type;
+    char *cstr = blkid_get_tag_value(NULL, "TYPE", device.constData());
+
+    if (cstr)
+    {
+        type = cstr;
+        free(cstr);
+    }
+
+    return type;
+}
+
+QByteArray MountManager::attachLoop(const QByteArray &image, bool readOnly)
+{
+    int ctl = ::open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (ctl == -1)
+        return QByteArray();
+    int nr = ::ioctl(ctl, LOOP_CTL_GET_FREE);
+    ::close(ctl);
+    if (nr < 0)
+        return QByteArray();
+
+    QByteArray loopdev = "/dev/loop"+QByteArray::number(nr);
+    int mode  = (readOnly ? O_RDONLY : O_RDWR) | O_CLOEXEC;
+    int fd    = ::open(image.constData(), mode);
+    int loopfd = ::open(loopdev.constData(), mode);
+    bool ok = false;
+
+    if (fd != -1 && loopfd != -1)
+    {
+        struct loop_config config;
+        memset(&config, 0, sizeof(config));
+        config.fd = fd;
+        /* Detach automatically on umount */
+        config.info.lo_flags = LO_FLAGS_AUTOCLEAR | (readOnly ? LO_FLAGS_READ_ONLY : 0);
+        strncpy((char *) config.info.lo_file_name, image.constData(), LO_NAME_SIZE-1);
+
+        if (::ioctl(loopfd, LOOP_CONFIGURE, &config) == 0)
+        {
+            ok = true;
+        }
+        else if (::ioctl(loopfd, LOOP_SET_FD, fd) == 0)
+        {
+            /* Older kernel */
+            ok = (::ioctl(loopfd, LOOP_SET_STATUS64, &config.info) == 0);
+            if (!ok)
+                ::ioctl(loopfd, LOOP_CLR_FD, 0);
+        }
+    }
+
+    if (fd != -1)
+        ::close(fd);
+    if (loopfd != -1)
+        ::close(loopfd);
+
+    if (!ok)
+    {
+        qDebug() << "Error setting up loop device for" << image << strerror(errno);
+        return QByteArray();
+    }
+
+    return loopdev;
+}
+
+MountManager::Reservation MountManager::reserve(const QByteArray &mountpoint, const Mount &wanted)
+{
+    QMutexLocker lock(&_mutex);
+
+    /* Another thread is mounting something there, wait for the outcome */
+    while (_mounts.contains(mountpoint) && _mounts[mountpoint].pending)
+        _mountDone.wait(&_mutex);
+
+    if (!_mounts.contains(mountpoint))
+    {
+        Mount m = wanted;
+        m.pending = true;
+        _mounts.insert(mountpoint, m);
+        return Reserved;
+    }
+
+    Mount &m = _mounts[mountpoint];
+    if (m.device != wanted.device)
+    {
+        qDebug() << "Cannot mount" << wanted.device << "on" << mountpoint << "already in use by" << m.device;
+        return InUse;
+    }
+    /* Read-only or not must always match, other options only if the caller asks for any */
+    unsigned long otherFlags = wanted.flags & ~MS_RDONLY;
+    bool checkOther = otherFlags || !wanted.data.isEmpty();
+    if (((m.flags ^ wanted.flags) & MS_RDONLY)
+            || (checkOther && (otherFlags != (m.flags & ~MS_RDONLY) || wanted.data != m.data))
+            || (!wanted.fstype.isEmpty() && wanted.fstype != m.fstype))
+    {
+        qDebug() << "Cannot mount" << wanted.device << "on" << mountpoint << "already mounted with different options";
+        return InUse;
+    }
+
+    m.references++;
+    return Referenced;
+}
+
+void MountManager::finishReservation(const QByteArray &mountpoint, bool mounted, const QByteArray &fstype)
+{
+    QMutexLocker lock(&_mutex);
+
+    if (mounted && _mounts.contains(mountpoint))
+    {
+        Mount &m = _mounts[mountpoint];
+        m.fstype = fstype;
+        m.references = 1;
+        m.pending = false;
+    }
+    else
+    {
+        _mounts.remove(mountpoint);
+    }
+    _mountDone.wakeAll();
+}
+
+bool MountManager::mount(const QByteArray &device, const QByteArray &mountpoint, const QByteArray &fstype, const QByteArray &options)
+{
+    Mount wanted;
+    wanted.device = device;
+    wanted.fstype = fstype;
+    wanted.flags  = parseOptions(options, wanted.data);
+
+    Reservation r = reserve(mountpoint, wanted);
+    if (r != Reserved)
+        return r == Referenced;
+
+    QByteArray type = fstype;
+    if (type.isEmpty())
+        type = probeType(device);
+
+    bool ok = (::mount(device.constData(), mountpoint.constData(), type.constData(), wanted.flags, wanted.data.isEmpty() ? NULL : wanted.data.constData()) == 0);
+    if (!ok)
+        qDebug() << "Error mounting" << device << "on" << mountpoint << strerror(errno);
+
+    finishReservation(mountpoint, ok, type);
+    return ok;
+}
+
+bool MountManager::mountImage(const QByteArray &image, const QByteArray &mountpoint, const QByteArray &fstype, const QByteArray &options)
+{
+    /* Tracked by image file name, so mounting the same image again is recognized */
+    Mount wanted;
+    wanted.device = image;
+    wanted.fstype = fstype;
+    wanted.flags  = parseOptions(options, wanted.data);
+
+    Reservation r = reserve(mountpoint, wanted);
+    if (r != Reserved)
+        return r == Referenced;
+
+    QByteArray loopdev = attachLoop(image, wanted.flags & MS_RDONLY);
+    if (loopdev.isEmpty())
+    {
+        finishReservation(mountpoint, false, fstype);
+        return false;
+    }
+
+    QByteArray type = fstype;
+    if (type.isEmpty())
+        type = probeType(loopdev);
+
+    bool ok = (::mount(loopdev.constData(), mountpoint.constData(), type.constData(), wanted.flags, wanted.data.isEmpty() ? NULL : wanted.data.constData()) == 0);
+    if (!ok)
+    {
+        qDebug() << "Error mounting" << image << "on" << mountpoint << strerror(errno);
+        /* Mount failed, so autoclear does not kick in */
+        int loopfd = ::open(loopdev.constData(), O_RDONLY | O_CLOEXEC);
+        if (loopfd != -1)
+        {
+            ::ioctl(loopfd, LOOP_CLR_FD, 0);
+            ::close(loopfd);
+        }
+    }
+
+    finishReservation(mountpoint, ok, type);
+    return ok;
+}
+
+bool MountManager::umount(const QByteArray &mountpoint, int flags)
+{
+    QMutexLocker lock(&_mutex);
+
+    while (_mounts.contains(mountpoint) && _mounts[mountpoint].pending)
+        _mountDone.wait(&_mutex);
+
+    if (_mounts.contains(mountpoint) && !(flags & AllReferences))
+    {
+        if (--_mounts[mountpoint].references > 0)
+            return true;
+    }
+
+    /* Not mounted through us (e.g. by the init script) is unmounted as well */
+    if (::umount2(mountpoint.constData(), (flags & Force) ? MNT_FORCE : 0) != 0)
+    {
+        qDebug() << "Error unmounting" << mountpoint << strerror(errno);
+        if (_mounts.contains(mountpoint))
+            _mounts[mountpoint].references++;
+        return false;
+    }
+    _mounts.remove(mountpoint);
+
+    return true;
+}
+
+bool MountManager::remount(const QByteArray &mountpoint, const QByteArray &options)
+{
+    QByteArray data, currentData, currentOptions;
+
+    /* Keep the flags it is currently mounted with (e.g. noatime) */
+    QFile f("/proc/mounts");
+    f.open(f.ReadOnly);
+    QList<QByteArray> lines = f.readAll().split('\n');
+    f.close();
+    foreach (QByteArray line, lines)
+    {
+        QList<QByteArray> fields = line.split(' ');
+        if (fields.count() > 3 && fields[1] == mountpoint)
+            currentOptions = fields[3];
+    }
+
+    unsigned long flags = parseOptions(options, data, parseOptions(currentOptions, currentData));
+
+    if (::mount(NULL, mountpoint.constData(), NULL, MS_REMOUNT | flags, data.isEmpty() ? NULL : data.constData()) != 0)
+    {
+        qDebug() << "Error remounting" << mountpoint << options << strerror(errno);
+        return false;
+    }
+
+    /* Keep track of read-only state, which mount() checks */
+    QMutexLocker lock(&_mutex);
+    if (_mounts.contains(mountpoint))
+    {
+        Mount &m = _mounts[mountpoint];
+        m.flags = (m.flags & ~MS_RDONLY) | (flags & MS_RDONLY);
+    }
+
+    return true;
+}
+
+void MountManager::umountAll()
+{
+    QFile f("/proc/mounts");
+    f.open(f.ReadOnly);
+    QList<QByteArray> lines = f.readAll().split('\n');
+    f.close();
+
+    QMutexLocker lock(&_mutex);
+
+    /* Last mounted first */
+    for (int i=lines.count()-1; i>=0; i--)
+    {
+        QList<QByteArray> fields = lines[i].split(' ');
+        if (fields.count() < 2)
+            continue;
+
+        if (::umount2(fields[1].constData(), 0) != 0)
+            ::mount(NULL, fields[1].constData(), NULL, MS_REMOUNT | MS_RDONLY, NULL);
+    }
+    _mounts.clear();
+}
+
+int MountManager::references(const QByteArray &mountpoint)
+{
+    QMutexLocker lock(&_mutex);
+    return _mounts.value(mountpoint).references;
+}
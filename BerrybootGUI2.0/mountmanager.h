@@ -0,0 +1,114 @@
+#ifndef MOUNTMANAGER_H
+#define MOUNTMANAGER_H
+
+/* Berryboot -- mount manager
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QByteArray>
+#include <QMap>
+#include <QMutex>
+#include <QWaitCondition>
+
+/*
+ * Mounts file systems with mount(2) instead of running the mount binary,
+ * and keeps track of what is mounted where.
+ *
+ * Mounting something that is already mounted at the same place with compatible options only adds a reference,
+ * and it is not unmounted until the last reference is released.
+ * Can be used from any thread. Mounts on different mountpoints do not wait for each other.
+ */
+class MountManager
+{
+public:
+    enum UmountFlags { AllReferences = 1, Force = 2 };
+
+    /*
+     * Mount device (e.g. /dev/sda1) on mountpoint
+     * Options are like those of the mount command, e.g. "ro,noatime,compress=lzo"
+     * File system type is probed if not specified
+     * If it is already mounted there, fails if read-only differs, or if other options are given and differ
+     */
+    static bool mount(const QByteArray &device, const QByteArray &mountpoint,
+                      const QByteArray &fstype = QByteArray(), const QByteArray &options = QByteArray());
+    /*
+     * Attach image file to a free loop device and mount it
+     */
+    static bool mountImage(const QByteArray &image, const QByteArray &mountpoint,
+                           const QByteArray &fstype = QByteArray(), const QByteArray &options = "ro");
+    /*
+     * Release a reference, and unmount if it was the last one
+     * With AllReferences it is unmounted regardless, e.g. before repartitioning
+     */
+    static bool umount(const QByteArray &mountpoint, int flags = 0);
+    /*
+     * Change mount options (e.g. "rw") of mounted file system
+     */
+    static bool remount(const QByteArray &mountpoint, const QByteArray &options);
+    /*
+     * Unmount everything in /proc/mounts, or remount read-only if busy. Before reboot
+     */
+    static void umountAll();
+    /*
+     * Number of references to mountpoint, 0 if not mounted through MountManager
+     */
+    static int references(const QByteArray &mountpoint);
+
+protected:
+    struct Mount
+    {
+        Mount() : flags(0), references(0), pending(false) {}
+
+        QByteArray device, fstype, data;
+        unsigned long flags;
+        int references;
+        /* mount(2) in progress, without holding the mutex */
+        bool pending;
+    };
+    enum Reservation { Reserved, Referenced, InUse };
+
+    static QMutex _mutex;
+    static QWaitCondition _mountDone;
+    static QMap<QByteArray, Mount> _mounts;
+
+    /*
+     * Reference the mount if wanted is already mounted there with the same options,
+     * otherwise reserve the mountpoint so the caller can mount it without holding the mutex
+     */
+    static Reservation reserve(const QByteArray &mountpoint, const Mount &wanted);
+    /*
+     * Called after mounting a reserved mountpoint
+     */
+    static void finishReservation(const QByteArray &mountpoint, bool mounted, const QByteArray &fstype);
+
+    /*
+     * Apply mount options to flags. Returns new flags, and the file system specific options in data
+     */
+    static unsigned long parseOptions(const QByteArray &options, QByteArray &data, unsigned long flags = 0);
+    static QByteArray probeType(const QByteArray &device);
+    static QByteArray attachLoop(const QByteArray &image, bool readOnly);
+};
+
+#endif // MOUNTMANAGER_H
@@ -0,0 +1,279 @@
+/* Berryboot -- MBR and GPT partition table writer
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "partitiontable.h"
+#include "blockdevice.h"
+#include <QFile>
+#include <QtEndian>
+#include <string.h>
+#include <zlib.h>
+
+#define MBR_TYPE_FAT32_LBA  0x0E
+#define MBR_TYPE_LINUX      0x83
+#define MBR_TYPE_GPT        0xEE
+
+#define GPT_ENTRIES         128
+#define GPT_ENTRY_SIZE      128
+#define GPT_HEADER_SIZE     92
+
+#define GPT_TYPE_EFI_SYSTEM "C12A7328-F81F-11D2-BA4B-00A0C93EC93B"
+#define GPT_TYPE_LINUX      "0FC63DAF-8483-4772-8E79-3D69D8477DE4"
+
+static QByteArray randomBytes(int len)
+{
+    QFile f("/dev/urandom");
+    f.open(f.ReadOnly);
+    QByteArray data = f.read(len);
+    f.close();
+
+    if (data.size() != len)
+        data = QByteArray(len, 0);
+
+    return data;
+}
+
+/* GUIDs are stored with the first three fields in little endian */
+static QByteArray guidFromString(const char *str)
+{
+    QByteArray guid = QByteArray::fromHex(QByteArray(str).replace("-", ""));
+    const int order[16] = {3,2,1,0, 5,4, 7,6, 8,9,10,11,12,13,14,15};
+    QByteArray result(16, 0);
+
+    for (int i=0; i<16; i++)
+        result[i] = guid[order[i]];
+
+    return result;
+}
+
+static QByteArray randomGuid()
+{
+    QByteArray guid = randomBytes(16);
+
+    /* Version 4, variant 1 */
+    guid[7] = (guid[7] & 0x0F) | 0x40;
+    guid[8] = (guid[8] & 0x3F) | 0x80;
+
+    return guid;
+}
+
+/* Cylinder/head/sector address of a LBA sector, using the usual 255 heads, 63 sectors translation */
+static void lbaToChs(quint64 lba, uchar *chs)
+{
+    quint64 cylinder = lba / (255*63);
+
+    if (cylinder > 1023)
+    {
+        chs[0] = 0xFE;
+        chs[1] = 0xFF;
+        chs[2] = 0xFF;
+    }
+    else
+    {
+        chs[0] = (lba / 63) % 255;
+        chs[1] = ((lba % 63) + 1) | ((cylinder >> 2) & 0xC0);
+        chs[2] = cylinder & 0xFF;
+    }
+}
+
+static void setMbrEntry(uchar *entry, uchar type, quint64 start, quint64 sectors)
+{
+    entry[0] = 0;
+    lbaToChs(start, entry+1);
+    entry[4] = type;
+    lbaToChs(start+sectors-1, entry+5);
+    qToLittleEndian<quint32>(start, entry+8);
+    qToLittleEndian<quint32>(qMin(sectors, (quint64) 0xFFFFFFFF), entry+12);
+}
+
+PartitionTable::PartitionTable(BlockDevice *dev)
+    : _dev(dev), _sectorSize(512), _firstUsable(0), _lastUsable(0)
+{
+}
+
+void PartitionTable::addPartition(PartitionType type, quint64 size)
+{
+    Partition p;
+    p.type = type;
+    p.size = size;
+    p.start = p.sectors = 0;
+    _partitions.append(p);
+}
+
+bool PartitionTable::write(bool gpt)
+{
+    _sectorSize = _dev->sectorSize();
+    quint64 totalSectors = _dev->size() / _sectorSize;
+    quint64 entrySectors = GPT_ENTRIES * GPT_ENTRY_SIZE / _sectorSize;
+
+    if (gpt)
+    {
+        _firstUsable = 2 + entrySectors;
+        _lastUsable  = totalSectors - 2 - entrySectors;
+    }
+    else
+    {
+        _firstUsable = 1;
+        _lastUsable  = qMin(totalSectors - 1, (quint64) 0xFFFFFFFF);
+    }
+
+    if (totalSectors < 2 * (2 + entrySectors) || !layout())
+    {
+        if (_error.isEmpty())
+            _error = "Drive is too small";
+        return false;
+    }
+
+    if (!writeMbr(gpt, totalSectors)
+            || (gpt && !writeGpt(totalSectors))
+            || !_dev->flush())
+    {
+        _error = _dev->errorString();
+        return false;
+    }
+
+    /* Like sfdisk, not fatal if the kernel refuses because the drive is in use */
+    _dev->rereadPartitionTable();
+
+    return true;
+}
+
+bool PartitionTable::layout()
+{
+    quint64 alignment = _dev->optimalAlignment() / _sectorSize;
+    quint64 next = qMax(alignment, _firstUsable);
+
+    for (int i=0; i<_partitions.count(); i++)
+    {
+        Partition &p = _partitions[i];
+
+        p.start = (next + alignment - 1) / alignment * alignment;
+
+        if (p.size)
+        {
+            quint64 sectors = (p.size + _sectorSize - 1) / _sectorSize;
+            p.sectors = (sectors + alignment - 1) / alignment * alignment;
+        }
+        else
+        {
+            /* Remaining space, rounded down to a whole erase block */
+            quint64 end = (_lastUsable + 1) / alignment * alignment;
+            if (end <= p.start)
+                return false;
+            p.sectors = end - p.start;
+        }
+
+        if (p.start + p.sectors - 1 > _lastUsable)
+            return false;
+
+        next = p.start + p.sectors;
+    }
+
+    return true;
+}
+
+bool PartitionTable::writeMbr(bool protective, quint64 totalSectors)
+{
+    /* Preserve any boot code already in the first 440 bytes (e.g. from mbr.bin) */
+    QByteArray mbr = _dev->readAt(0, 512);
+    if (mbr.isEmpty())
+        return false;
+
+    uchar *d = (uchar *) mbr.data();
+    memset(d+440, 0, 512-440);
+
+    if (protective)
+    {
+        setMbrEntry(d+446, MBR_TYPE_GPT, 1, totalSectors-1);
+    }
+    else
+    {
+        /* Disk identifier */
+        memcpy(d+440, randomBytes(4).constData(), 4);
+
+        for (int i=0; i<_partitions.count() && i<4; i++)
+        {
+            const Partition &p = _partitions.at(i);
+            setMbrEntry(d+446+i*16, p.type == BootPartition ? MBR_TYPE_FAT32_LBA : MBR_TYPE_LINUX, p.start, p.sectors);
+        }
+    }
+
+    d[510] = 0x55;
+    d[511] = 0xAA;
+
+    return _dev->writeAt(0, mbr);
+}
+
+bool PartitionTable::writeGpt(quint64 totalSectors)
+{
+    QByteArray entries(GPT_ENTRIES * GPT_ENTRY_SIZE, 0);
+    QByteArray diskGuid = randomGuid();
+    quint64 lastLba = totalSectors - 1;
+    quint64 backupEntriesLba = lastLba - entries.size() / _sectorSize;
+
+    for (int i=0; i<_partitions.count(); i++)
+    {
+        const Partition &p = _partitions.at(i);
+        uchar *e = (uchar *) entries.data() + i*GPT_ENTRY_SIZE;
+
+        memcpy(e, guidFromString(p.type == BootPartition ? GPT_TYPE_EFI_SYSTEM : GPT_TYPE_LINUX).constData(), 16);
+        memcpy(e+16, randomGuid().constData(), 16);
+        qToLittleEndian<quint64>(p.start, e+32);
+        qToLittleEndian<quint64>(p.start + p.sectors - 1, e+40);
+    }
+
+    return _dev->writeAt(2 * _sectorSize, entries)
+        && _dev->writeAt(_sectorSize, gptHeader(1, lastLba, 2, diskGuid, entries))
+        && _dev->writeAt(backupEntriesLba * _sectorSize, entries)
+        && _dev->writeAt(lastLba * _sectorSize, gptHeader(lastLba, 1, backupEntriesLba, diskGuid, entries));
+}
+
+QByteArray PartitionTable::gptHeader(quint64 currentLba, quint64 backupLba, quint64 entriesLba, const QByteArray &diskGuid, const QByteArray &entries)
+{
+    QByteArray header(_sectorSize, 0);
+    uchar *h = (uchar *) header.data();
+
+    memcpy(h, "EFI PART", 8);
+    qToLittleEndian<quint32>(0x00010000, h+8); /* Revision 1.0 */
+    qToLittleEndian<quint32>(GPT_HEADER_SIZE, h+12);
+    qToLittleEndian<quint64>(currentLba, h+24);
+    qToLittleEndian<quint64>(backupLba, h+32);
+    qToLittleEndian<quint64>(_firstUsable, h+40);
+    qToLittleEndian<quint64>(_lastUsable, h+48);
+    memcpy(h+56, diskGuid.constData(), 16);
+    qToLittleEndian<quint64>(entriesLba, h+72);
+    qToLittleEndian<quint32>(GPT_ENTRIES, h+80);
+    qToLittleEndian<quint32>(GPT_ENTRY_SIZE, h+84);
+    qToLittleEndian<quint32>(crc32(0, (const Bytef *) entries.constData(), entries.size()), h+88);
+    /* Header checksum is calculated with the checksum field itself set to zero */
+    qToLittleEndian<quint32>(crc32(0, h, GPT_HEADER_SIZE), h+16);
+
+    return header;
+}
+
+QString PartitionTable::errorString() const
+{
+    return _error;
+}
@@ -0,0 +1,84 @@
+#ifndef PARTITIONTABLE_H
+#define PARTITIONTABLE_H
+
+/* Berryboot -- MBR and GPT partition table writer
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QList>
+#include <QString>
+#include <QByteArray>
+
+class BlockDevice;
+
+class PartitionTable
+{
+public:
+    enum PartitionType { BootPartition, DataPartition };
+
+    /*
+     * Constructor
+     *
+     * - dev: opened block device to write the partition table to
+     */
+    explicit PartitionTable(BlockDevice *dev);
+
+    /*
+     * Add partition after the previous one
+     *
+     * - type: FAT boot partition or Linux data partition
+     * - size: minimum size in bytes, 0 to use all remaining space
+     *
+     * Start and size of every partition are aligned to BlockDevice::optimalAlignment()
+     */
+    void addPartition(PartitionType type, quint64 size = 0);
+
+    /*
+     * Write MBR, or protective MBR and primary and backup GPT, and let the kernel reread it
+     */
+    bool write(bool gpt);
+
+    QString errorString() const;
+
+protected:
+    struct Partition
+    {
+        PartitionType type;
+        quint64 size, start, sectors;
+    };
+
+    BlockDevice *_dev;
+    QList<Partition> _partitions;
+    QString _error;
+    int _sectorSize;
+    quint64 _firstUsable, _lastUsable;
+
+    bool layout();
+    bool writeMbr(bool protective, quint64 totalSectors);
+    bool writeGpt(quint64 totalSectors);
+    QByteArray gptHeader(quint64 currentLba, quint64 backupLba, quint64 entriesLba, const QByteArray &diskGuid, const QByteArray &entries);
+};
+
+#endif // PARTITIONTABLE_H
@@ -0,0 +1,157 @@
+/* Berryboot -- readahead profiles
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "readaheadprofile.h"
+#include "boottrace.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QList>
+#include <QPair>
+#include <QDebug>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Part of the image mapped at a time to look at, keeps address space use low on 32-bit */
+#define MINCORE_WINDOW_SIZE  (64*1024*1024)
+/* Cached ranges closer together than this are merged into one read */
+#define MERGE_GAP  (128*1024)
+
+QByteArray ReadaheadProfile::profileFile(const QByteArray &image)
+{
+    return "/mnt/data/"+image+".readahead";
+}
+
+bool ReadaheadProfile::record(const QByteArray &image, int seconds)
+{
+    QFileInfo imageInfo("/mnt/images/"+image), profileInfo(profileFile(image));
+
+    if (!imageInfo.exists())
+        return false;
+    /* Copied to RAM before booting, the page cache holds all of it and nothing is read from disk later */
+    if (QFile::exists("/mnt/data/"+image+"/copy_to_ram"))
+        return true;
+    /* Image has not been updated since the profile was recorded */
+    if (profileInfo.exists() && profileInfo.lastModified() >= imageInfo.lastModified())
+        return true;
+
+    ::sleep(seconds);
+
+    QFile f(imageInfo.filePath());
+    if (!f.open(f.ReadOnly))
+        return false;
+
+    long pagesize = sysconf(_SC_PAGESIZE);
+    qint64 size = f.size(), start = -1, end = -1;
+    QList<QPair<qint64,qint64> > ranges;
+    QByteArray vec;
+
+    for (qint64 window = 0; window < size; window += MINCORE_WINDOW_SIZE)
+    {
+        qint64 len = qMin(qint64(MINCORE_WINDOW_SIZE), size-window);
+        qint64 pages = (len+pagesize-1)/pagesize;
+        /* Mapping a file does not read it in, mincore() tells which pages were already in page cache */
+        uchar *p = f.map(window, len);
+
+        if (!p)
+            return false;
+        vec.resize(pages);
+        int ret = mincore(p, len, (unsigned char *) vec.data());
+        f.unmap(p);
+        if (ret != 0)
+            return false;
+
+        for (qint64 i = 0; i < pages; i++)
+        {
+            if (!(vec.at(i) & 1))
+                continue;
+
+            qint64 offset = window + i*pagesize;
+            if (start != -1 && offset-end <= MERGE_GAP)
+            {
+                end = offset+pagesize;
+            }
+            else
+            {
+                if (start != -1)
+                    ranges.append(qMakePair(start, end-start));
+                start = offset;
+                end   = offset+pagesize;
+            }
+        }
+    }
+    if (start != -1)
+        ranges.append(qMakePair(start, end-start));
+    f.close();
+
+    /* Format: <offset> <length> in bytes, one range per line */
+    QByteArray profile;
+    for (int i = 0; i < ranges.count(); i++)
+    {
+        profile += QByteArray::number(ranges.at(i).first)+" "+QByteArray::number(ranges.at(i).second)+"\n";
+    }
+
+    QFile p(profileFile(image)+".new");
+    if (!p.open(p.WriteOnly) || p.write(profile) != profile.size())
+    {
+        qDebug() << "Error writing readahead profile of" << image;
+        p.remove();
+        return false;
+    }
+    p.close();
+
+    return ::rename(p.fileName().toLatin1().constData(), profileFile(image).constData()) == 0;
+}
+
+qint64 ReadaheadProfile::prefetch(const QByteArray &image)
+{
+    QFile p(profileFile(image));
+    if (!p.open(p.ReadOnly))
+        return 0;
+
+    int fd = ::open(("/mnt/images/"+image).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return 0;
+
+    BootTraceScope trace("readahead "+image, BootTrace::BackgroundTrack);
+
+    /* Do not push everything else out of page cache for a big image on a small board */
+    qint64 budget = qint64(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE) / 4, total = 0;
+
+    while (!p.atEnd() && total < budget)
+    {
+        QList<QByteArray> range = p.readLine().trimmed().split(' ');
+        if (range.count() != 2)
+            continue;
+
+        qint64 offset = range.at(0).toLongLong(), len = qMin(range.at(1).toLongLong(), budget-total);
+        if (posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED) == 0)
+            total += len;
+    }
+    ::close(fd);
+
+    return total;
+}
@@ -0,0 +1,59 @@
+#ifndef READAHEADPROFILE_H
+#define READAHEADPROFILE_H
+
+/* Berryboot -- readahead profiles
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QByteArray>
+
+/*
+ * Learns which parts of an OS image are read while it boots, and prefetches them next time
+ *
+ * The init script starts "BerrybootGUI --record-readahead <image>" in the background before
+ * switching root. It waits while the OS boots, then takes a mincore() snapshot of the page
+ * cache of /mnt/images/<image>, and stores the cached ranges in /mnt/data/<image>.readahead
+ * During the next boot menu countdown, these ranges are read ahead in large sequential requests,
+ * instead of the OS faulting in squashfs blocks one by one.
+ */
+class ReadaheadProfile
+{
+public:
+    /*
+     * Record profile of image after waiting 'seconds'
+     * Does nothing if there is a profile that is newer than the image
+     */
+    static bool record(const QByteArray &image, int seconds);
+    /*
+     * Schedule asynchronous readahead of the ranges recorded for image
+     * Returns number of bytes scheduled
+     */
+    static qint64 prefetch(const QByteArray &image);
+
+protected:
+    static QByteArray profileFile(const QByteArray &image);
+};
+
+#endif // READAHEADPROFILE_H
@@ -27,7 +27,10 @@
 #include "statusdialog.h"
 #include "ui_statusdialog.h"
 #include "wifidialog.h"
+#include "installer.h"
+#include "devicemonitor.h"
 #include <QFile>
+#include <QFileSystemWatcher>
 #include <QDir>
 #include <QFileInfo>
 #include <QRegExp>
@@ -43,6 +46,7 @@ StatusDialog::StatusDialog(Installer *i, QWidget *parent) :
     _monitorConn(NULL),
     _controlConn(NULL),
     _ctrlPath("/var/run/wpa_supplicant/wlan0"),
+    _ctrlDirWatcher(NULL),
     _notifier(NULL),
     _isUp(false)
 {
@@ -53,8 +57,15 @@ StatusDialog::StatusDialog(Installer *i, QWidget *parent) :
     setMask(topRoundedRect(rect(), 10));
 
     ui->wifiCombo->installEventFilter(this);
-    connect(&_timer, SIGNAL(timeout()), this, SLOT(pollCtrlDir()));
-    _timer.start(500);
+
+    /* Check if wpa_supplicant has (re)started, or a (wired) connection has been made,
+       whenever network interfaces change or the control socket is (re)created */
+    connect(_i->deviceMonitor(), SIGNAL(linkChanged(QString)), this, SLOT(pollCtrlDir()));
+    connect(_i->deviceMonitor(), SIGNAL(addressAdded(QString,QString)), this, SLOT(pollCtrlDir()));
+    _ctrlDirWatcher = new QFileSystemWatcher(this);
+    _ctrlDirWatcher->addPath("/var/run");
+    connect(_ctrlDirWatcher, SIGNAL(directoryChanged(QString)), this, SLOT(pollCtrlDir()));
+    QTimer::singleShot(1, this, SLOT(pollCtrlDir()));
 }
 
 QRegion StatusDialog::topRoundedRect(const QRect& rect, int r)
@@ -204,12 +215,15 @@ void StatusDialog::updateStatus()
     ui->wifiCombo->setItemText(0, status);
 }
 
-/* Check every half a second if wpa_supplicant has (re)started,
+/* Check if wpa_supplicant has (re)started,
    or a (wired) connection has been made */
 void StatusDialog::pollCtrlDir()
 {
     QFileInfo fi(_ctrlPath);
 
+    if (!_ctrlDirWatcher->directories().contains("/var/run/wpa_supplicant") && QFile::exists("/var/run/wpa_supplicant"))
+        _ctrlDirWatcher->addPath("/var/run/wpa_supplicant");
+
     if (fi.exists() && fi.lastModified() != _lastmod)
     {
         _lastmod = fi.lastModified();
@@ -36,6 +36,7 @@ namespace Ui {
 class StatusDialog;
 }
 class Installer;
+class QFileSystemWatcher;
 struct wpa_ctrl;
 
 class StatusDialog : public QDialog
@@ -58,7 +59,7 @@ protected:
     Installer *_i;
     struct wpa_ctrl *_monitorConn, *_controlConn;
     QByteArray _ctrlPath;
-    QTimer _timer;
+    QFileSystemWatcher *_ctrlDirWatcher;
     QDateTime _lastmod;
     QSocketNotifier *_notifier;
     bool _isUp;
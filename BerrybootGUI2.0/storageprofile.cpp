@@ -0,0 +1,128 @@
+/* Berryboot -- file system parameters tuned to the storage device
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "storageprofile.h"
+#include "blockdevice.h"
+#include <QFile>
+#include <QThread>
+#include <sys/utsname.h>
+
+#define FS_BLOCK_SIZE  4096
+
+StorageProfile::StorageProfile(const QString &drive)
+    : _eraseSize(1024*1024), _flash(false), _cpuScore(0), _kernelVersion(0)
+{
+    BlockDevice dev(drive);
+    _eraseSize = dev.optimalAlignment();
+
+    /* USB card readers usually claim to be rotational */
+    QFile f("/sys/class/block/"+drive+"/queue/rotational");
+    f.open(f.ReadOnly);
+    _flash = drive.startsWith("mmcblk") || f.readAll().trimmed() == "0";
+    f.close();
+
+    /* Rough measure of CPU power: cores * MHz */
+    f.setFileName("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq");
+    int mhz = 1000;
+    if (f.open(f.ReadOnly))
+    {
+        mhz = f.readAll().trimmed().toInt() / 1000;
+        f.close();
+    }
+    _cpuScore = QThread::idealThreadCount() * mhz;
+
+    /* Kernel version as 0xMMmm */
+    struct utsname u;
+    if (uname(&u) == 0)
+    {
+        QList<QByteArray> version = QByteArray(u.release).split('.');
+        if (version.count() >= 2)
+            _kernelVersion = (version.at(0).toInt() << 8) | version.at(1).toInt();
+    }
+}
+
+QString StorageProfile::mkfsOptions(const QString &fs, QStringList extendedOptions) const
+{
+    QStringList opts;
+    int eraseBlocks = _eraseSize / FS_BLOCK_SIZE;
+
+    if (fs == "f2fs")
+    {
+        /* Garbage collect whole erase blocks: make a section (unit of 2 MB segments) as large as one */
+        if (_eraseSize > 2*1024*1024)
+            opts << "-s" << QString::number(_eraseSize / (2*1024*1024));
+    }
+    else if (fs == "btrfs")
+    {
+        /* Larger metadata nodes mean fewer, larger writes per erase block */
+        opts << "-s" << QString::number(FS_BLOCK_SIZE) << "-n" << (_eraseSize >= 4*1024*1024 ? "32768" : "16384");
+    }
+    else
+    {
+        /* Let the block allocator align to erase blocks, and keep more groups' metadata together */
+        extendedOptions << "stride="+QString::number(eraseBlocks) << "stripe_width="+QString::number(eraseBlocks);
+
+        if (_flash)
+        {
+            if (_eraseSize >= 4*1024*1024)
+                opts << "-G" << "64";
+            else if (_eraseSize >= 2*1024*1024)
+                opts << "-G" << "32";
+            opts << "-J" << "size=64";
+        }
+        opts << "-E" << extendedOptions.join(",");
+    }
+
+    return opts.join(" ");
+}
+
+QByteArray StorageProfile::mountOptions(const QString &fs) const
+{
+    QByteArray opts = "noatime";
+
+    /* Flush less often, to save flash writes. f2fs checkpoints on its own schedule */
+    if (_flash && fs != "f2fs")
+        opts += ",commit=30";
+
+    if (fs == "btrfs")
+    {
+        if (_cpuScore >= 4 * 1200)
+        {
+            /* compress=zstd:level requires Linux 5.1 */
+            opts += (_kernelVersion >= 0x0501 ? ",compress=zstd:3" : ",compress=zstd");
+        }
+        else if (_cpuScore >= 2 * 1000 && _kernelVersion >= 0x0501)
+        {
+            opts += ",compress=zstd:1";
+        }
+        else
+        {
+            opts += ",compress=lzo";
+        }
+    }
+
+    return opts;
+}
@@ -0,0 +1,62 @@
+#ifndef STORAGEPROFILE_H
+#define STORAGEPROFILE_H
+
+/* Berryboot -- file system parameters tuned to the storage device
+ *
+ * Copyright (c) 2012, Floris Bos
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QString>
+#include <QStringList>
+
+class StorageProfile
+{
+public:
+    /*
+     * Constructor
+     *
+     * - drive: drive the data partition is on, e.g. mmcblk0
+     */
+    explicit StorageProfile(const QString &drive);
+
+    /*
+     * mkfs arguments for file system (ext4, btrfs or f2fs), to be put in front of the device name
+     *
+     * - extendedOptions: additional mkfs.ext4 -E options, as mkfs.ext4 only honours one -E
+     */
+    QString mkfsOptions(const QString &fs, QStringList extendedOptions = QStringList()) const;
+
+    /*
+     * Mount options for file system (ext4, btrfs or f2fs)
+     * Recorded as mountopts= in cmdline.txt, so the boot menu mounts with the same profile
+     */
+    QByteArray mountOptions(const QString &fs) const;
+
+protected:
+    quint64 _eraseSize;
+    bool _flash;
+    int _cpuScore, _kernelVersion;
+};
+
+#endif // STORAGEPROFILE_H
@@ -32,6 +32,7 @@
 #include "wifidialog.h"
 #include "ui_wifidialog.h"
 #include "installer.h"
+#include "devicemonitor.h"
 #include <QFile>
 #include <QDir>
 #include <QDebug>
@@ -80,7 +81,7 @@ WifiDialog::WifiDialog(Installer *i, QWidget *parent) :
     t.start();
     while (t.elapsed() < 4000 && !QFile::exists("/sys/class/net/wlan0") )
     {
-        QApplication::processEvents(QEventLoop::WaitForMoreEvents, 250);
+        _i->deviceMonitor()->waitFor(SIGNAL(linkChanged(QString)), 4000 - t.elapsed());
     }
 
     if ( QFile::exists("/sys/class/net/wlan0") )
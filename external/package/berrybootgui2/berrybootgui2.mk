@@ -9,7 +9,7 @@ BERRYBOOTGUI2_VERSION=1.0
 BERRYBOOTGUI2_SITE=$(TOPDIR)/../BerrybootGUI2.0
 BERRYBOOTGUI2_SITE_METHOD=local
 BERRYBOOTGUI2_INSTALL_STAGING = NO
-BERRYBOOTGUI2_DEPENDENCIES=qt rpi-userland openssl libcurl wpa_supplicant util-linux
+BERRYBOOTGUI2_DEPENDENCIES=qt rpi-userland openssl libcurl wpa_supplicant util-linux kmod
 
 define BERRYBOOTGUI2_BUILD_CMDS
 	(cd $(@D) ; $(QT_QMAKE))
@@ -22,7 +22,6 @@ define BERRYBOOTGUI2_INSTALL_TARGET_CMDS
         rm -f $(TARGET_DIR)/init
         $(INSTALL) -m 0755 $(BERRYBOOTGUI2_PKGDIR)/init $(TARGET_DIR)/init
         $(INSTALL) -m 0755 $(BERRYBOOTGUI2_PKGDIR)/chroot_image $(TARGET_DIR)/usr/sbin
-        $(INSTALL) -m 0755 $(BERRYBOOTGUI2_PKGDIR)/hotplug $(TARGET_DIR)/sbin/hotplug
         $(INSTALL) -D -m 0644 $(BERRYBOOTGUI2_PKGDIR)/blacklist-dvb.conf $(TARGET_DIR)/etc/modprobe.d/blacklist-dvb.conf
 	$(INSTALL) -D -m 0644 $(BERRYBOOTGUI2_PKGDIR)/blacklist-drm.conf $(TARGET_DIR)/etc/modprobe.d/blacklist-drm.conf
 	$(INSTALL) -D -m 0644 $(BERRYBOOTGUI2_PKGDIR)/install-i2cdev.conf $(TARGET_DIR)/etc/modprobe.d/install-i2cdev.conf